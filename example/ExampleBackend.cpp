@@ -22,8 +22,12 @@
 
 #include <csignal>
 
+#include <xen/be/XenStoreSchema.hpp>
+
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::RingBufferPtr;
+using XenBackend::XenStoreField;
+using XenBackend::XenStoreSchema;
 
 //! [processRequest]
 void ExampleInRingBuffer::processRequest(const xentest_req& req)
@@ -71,30 +75,51 @@ void ExampleInRingBuffer::processRequest(const xentest_req& req)
 //! [processRequest]
 
 //! [onBind]
+struct RingConfig
+{
+	evtchn_port_t outPort;
+	grant_ref_t outRef;
+	evtchn_port_t inPort;
+	grant_ref_t inRef;
+};
+
+static const XenStoreField<RingConfig> cRingFields[] = {
+	XENSTORE_FIELD(RingConfig, outPort, "path/to/out/port"),
+	XENSTORE_FIELD(RingConfig, outRef, "path/to/out/ref"),
+	XENSTORE_FIELD(RingConfig, inPort, "path/to/in/port"),
+	XENSTORE_FIELD(RingConfig, inRef, "path/to/in/ref")
+};
+
+static const XenStoreSchema<RingConfig> cRingSchema(cRingFields);
+
 void ExampleFrontendHandler::onBind()
 {
 	LOG(mLog, DEBUG) << "Bind, dom id: " << getDomId();
 
-	// get out ring buffer event channel port
-	evtchn_port_t port = getXenStore().readInt(getXsFrontendPath() +
-											   "/path/to/out/port");
-	// get out ring buffer grant table reference
-	uint32_t ref = getXenStore().readInt(getXsFrontendPath() +
-										 "/path/to/out/ref");
+	RingConfig config;
+
+	// read all ring buffer event channel ports and grant table references:
+	// the four reads take one round trip if xenstored socket is available
+	if (mAsyncXenStore)
+	{
+		cRingSchema.read(*mAsyncXenStore, getXsFrontendPath(), config);
+	}
+	else
+	{
+		cRingSchema.read(getXenStore(), getXsFrontendPath(), config);
+	}
+
 	// create out ring buffer
-	mOutRingBuffer.reset(new ExampleOutRingBuffer(getDomId(), port, ref));
+	mOutRingBuffer.reset(new ExampleOutRingBuffer(getDomId(),
+												  config.outPort,
+												  config.outRef));
 	// add ring buffer
 	addRingBuffer(mOutRingBuffer);
 
-	// get in ring buffer event channel port
-	port = getXenStore().readInt(getXsFrontendPath() +
-								 "/path/to/in/port");
-	// get in ring buffer grant table reference
-	ref = getXenStore().readInt(getXsFrontendPath() +
-								"/path/to/in/ref");
 	// create in ring buffer
 	RingBufferPtr outRingBuffer(
-			new ExampleOutRingBuffer(getDomId(), port, ref));
+			new ExampleOutRingBuffer(getDomId(), config.inPort,
+									 config.inRef));
 	// add ring buffer
 	addRingBuffer(outRingBuffer);
 }
@@ -130,7 +155,8 @@ void ExampleBackend::onNewFrontend(domid_t domId, uint16_t devId)
 
 	// create new example frontend handler
 	addFrontendHandler(FrontendHandlerPtr(
-			new ExampleFrontendHandler(getDeviceName(), domId)));
+			new ExampleFrontendHandler(getDeviceName(), domId,
+									   mAsyncXenStore)));
 }
 //! [onNewFrontend]
 
@@ -23,6 +23,7 @@
 
 #include <memory>
 
+#include <xen/be/AsyncXenStore.hpp>
 #include <xen/be/BackendBase.hpp>
 #include <xen/be/FrontendHandlerBase.hpp>
 #include <xen/be/RingBufferBase.hpp>
@@ -74,8 +75,10 @@ class ExampleFrontendHandler : public XenBackend::FrontendHandlerBase
 {
 public:
 
-	ExampleFrontendHandler(const std::string& devName, domid_t feDomId) :
+	ExampleFrontendHandler(const std::string& devName, domid_t feDomId,
+			std::shared_ptr<XenBackend::AsyncXenStore> asyncXenStore) :
 		FrontendHandlerBase("FrontendHandler", "example_dev", 0, feDomId),
+		mAsyncXenStore(asyncXenStore),
 		mLog("FrontendHandler")
 	{
 		LOG(mLog, DEBUG) << "Create example frontend handler, dom id: "
@@ -93,6 +96,9 @@ private:
 	// Called when we need to send optional event to the frontend
 	void onSomeEvent();
 
+	// Pipelined Xen store reads, null if xenstored socket isn't available
+	std::shared_ptr<XenBackend::AsyncXenStore> mAsyncXenStore;
+
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
 
@@ -111,6 +117,16 @@ public:
 		mLog("ExampleBackend")
 	{
 		LOG(mLog, DEBUG) << "Create example backend";
+
+		try
+		{
+			// one connection is shared by all frontend handlers
+			mAsyncXenStore.reset(new XenBackend::AsyncXenStore());
+		}
+		catch(const XenBackend::XenStoreException& e)
+		{
+			LOG(mLog, WARNING) << e.what();
+		}
 	}
 
 private:
@@ -118,6 +134,9 @@ private:
 	// override onNewFrontend method
 	void onNewFrontend(domid_t domId, uint16_t devId) override;
 
+	// Pipelined Xen store reads, null if xenstored socket isn't available
+	std::shared_ptr<XenBackend::AsyncXenStore> mAsyncXenStore;
+
 	// XenBackend::Log can be used by backend
 	XenBackend::Log mLog;
 };
@@ -0,0 +1,343 @@
+/*
+ *  Asynchronous Xen Store client
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_ASYNCXENSTORE_HPP_
+#define XENBE_ASYNCXENSTORE_HPP_
+
+#include <climits>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+#include <xenstore.h>
+#include <xen/io/xs_wire.h>
+}
+
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include "XenStore.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Asynchronous Xen Store client.
+ *
+ * AsyncXenStore speaks the Xen store wire protocol (xs_wire.h) directly over
+ * the xenstored socket. Unlike XenStore, whose calls block for a full round
+ * trip, it sends requests without waiting for the replies: any number of
+ * requests may be outstanding. Replies are matched to requests by req_id and
+ * completed through callbacks or futures.
+ *
+ * Callbacks are called from the internal receive thread. They may issue new
+ * requests but should not block waiting for them.
+ *
+ * @code
+ * AsyncXenStore xenStore;
+ *
+ * auto port = xenStore.readString(path + "/port");
+ * auto ref = xenStore.readString(path + "/ref");
+ *
+ * // both requests are in flight here
+ *
+ * bind(std::stoi(port.get()), std::stoi(ref.get()));
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class AsyncXenStore
+{
+public:
+
+	/**
+	 * Callback which is called when a string reply is received.
+	 * <i>error</i> is 0 on success or errno value.
+	 */
+	typedef std::function<void(int error,
+							   const std::string& value)> StringCallback;
+
+	/**
+	 * Callback which is called when a directory reply is received.
+	 * <i>error</i> is 0 on success or errno value.
+	 */
+	typedef std::function<void(int error,
+							   const std::vector<std::string>& items)>
+							   DirectoryCallback;
+
+	/**
+	 * Callback which is called when a transaction is started.
+	 * <i>error</i> is 0 on success or errno value.
+	 */
+	typedef std::function<void(int error,
+							   xs_transaction_t transaction)>
+							   TransactionCallback;
+
+	/**
+	 * Callback which is called when a request without data is completed.
+	 * <i>error</i> is 0 on success or errno value.
+	 */
+	typedef std::function<void(int error)> ResultCallback;
+
+	/**
+	 * Callback which is called when a subtree is read.
+	 * <i>error</i> is 0 on success or errno value. The tree may be moved
+	 * out by the callback.
+	 */
+	typedef std::function<void(int error, XenStoreTree& tree)> TreeCallback;
+
+	/**
+	 * @param socketPath    xenstored socket path. If empty, XENSTORED_PATH
+	 *                      environment variable or the default xenstored
+	 *                      socket is used.
+	 * @param errorCallback callback called on connection error
+	 */
+	explicit AsyncXenStore(const std::string& socketPath = "",
+						   ErrorCallback errorCallback = nullptr);
+	AsyncXenStore(const AsyncXenStore&) = delete;
+	AsyncXenStore& operator=(AsyncXenStore const&) = delete;
+	~AsyncXenStore();
+
+	/**
+	 * Returns the home path of the domain.
+	 * @param domId    domain id
+	 * @param callback completion callback
+	 */
+	void getDomainPath(domid_t domId, StringCallback callback);
+
+	/**
+	 * Returns the home path of the domain.
+	 * @param domId domain id
+	 * @return future of the domain path
+	 */
+	std::future<std::string> getDomainPath(domid_t domId);
+
+	/**
+	 * Reads XS entry as string.
+	 * @param path        path to the entry
+	 * @param callback    completion callback
+	 * @param transaction transaction id
+	 */
+	void readString(const std::string& path, StringCallback callback,
+					xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads XS entry as string.
+	 * @param path        path to the entry
+	 * @param transaction transaction id
+	 * @return future of the entry value
+	 */
+	std::future<std::string> readString(const std::string& path,
+										xs_transaction_t transaction =
+										XBT_NULL);
+
+	/**
+	 * Writes string value into XS entry.
+	 * @param path        path to the entry
+	 * @param value       string value
+	 * @param callback    completion callback
+	 * @param transaction transaction id
+	 */
+	void writeString(const std::string& path, const std::string& value,
+					 ResultCallback callback,
+					 xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Writes string value into XS entry.
+	 * @param path        path to the entry
+	 * @param value       string value
+	 * @param transaction transaction id
+	 * @return future which is ready when the value is written
+	 */
+	std::future<void> writeString(const std::string& path,
+								  const std::string& value,
+								  xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads XS directory.
+	 * @param path        path to the directory
+	 * @param callback    completion callback
+	 * @param transaction transaction id
+	 */
+	void readDirectory(const std::string& path, DirectoryCallback callback,
+					   xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads XS directory.
+	 * @param path        path to the directory
+	 * @param transaction transaction id
+	 * @return future of directory items
+	 */
+	std::future<std::vector<std::string>> readDirectory(
+			const std::string& path, xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads keys and values of the subtree within one transaction. Value and
+	 * directory reads of an entry are sent together and the children are
+	 * requested as soon as the directory is received, thus the whole tree
+	 * takes about one round trip per level plus two for the transaction.
+	 * The transaction is repeated if Xen store asks for that.
+	 *
+	 * This is the only batched subtree reader: XenStore would pay a round
+	 * trip per entry and per directory. To read a fixed set of keys, use
+	 * XenStoreSchema which doesn't read directories at all.
+	 * @param path     path to the subtree root
+	 * @param depth    max depth to read: 0 reads the root only, 1 the root
+	 *                 and its children etc.
+	 * @param leaves   keys which have no children, their directories aren't
+	 *                 read
+	 * @param callback completion callback
+	 */
+	void readTree(const std::string& path, unsigned int depth,
+				  const std::vector<std::string>& leaves,
+				  TreeCallback callback);
+
+	/**
+	 * Reads keys and values of the subtree within one transaction.
+	 * @param path   path to the subtree root
+	 * @param depth  max depth to read: 0 reads the root only, 1 the root and
+	 *               its children etc.
+	 * @param leaves keys which have no children, their directories aren't
+	 *               read
+	 * @return future of the subtree
+	 */
+	std::future<XenStoreTree> readTree(const std::string& path,
+									   unsigned int depth = UINT_MAX,
+									   const std::vector<std::string>& leaves =
+									   std::vector<std::string>());
+
+	/**
+	 * Removes XS entry.
+	 * @param path        path to the entry
+	 * @param callback    completion callback
+	 * @param transaction transaction id
+	 */
+	void removePath(const std::string& path, ResultCallback callback,
+					xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Removes XS entry.
+	 * @param path        path to the entry
+	 * @param transaction transaction id
+	 * @return future which is ready when the entry is removed
+	 */
+	std::future<void> removePath(const std::string& path,
+								 xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Starts transaction.
+	 * @param callback completion callback
+	 */
+	void startTransaction(TransactionCallback callback);
+
+	/**
+	 * Starts transaction.
+	 * @return future of the transaction id
+	 */
+	std::future<xs_transaction_t> startTransaction();
+
+	/**
+	 * Ends transaction. EAGAIN error means the transaction should be
+	 * repeated.
+	 * @param transaction transaction id
+	 * @param abort       <i>true</i> to abort the transaction
+	 * @param callback    completion callback
+	 */
+	void endTransaction(xs_transaction_t transaction, bool abort,
+						ResultCallback callback);
+
+	/**
+	 * Ends transaction. The future throws XenStoreException with EAGAIN
+	 * error if the transaction should be repeated.
+	 * @param transaction transaction id
+	 * @param abort       <i>true</i> to abort the transaction
+	 * @return future which is ready when the transaction is ended
+	 */
+	std::future<void> endTransaction(xs_transaction_t transaction,
+									 bool abort = false);
+
+	/**
+	 * Returns number of requests waiting for the reply.
+	 */
+	size_t getPendingRequests();
+
+private:
+
+	typedef std::function<void(int error,
+							   const std::string& payload)> ReplyCallback;
+
+	// state of readTree(), is changed only from the receive thread
+	struct TreeRead
+	{
+		std::string path;
+		unsigned int depth;
+		std::vector<std::string> leaves;
+		TreeCallback callback;
+		xs_transaction_t transaction;
+		int retries;
+		size_t pending;
+		int error;
+		XenStoreTree tree;
+	};
+
+	const char* cDefaultSocketPath = "/var/run/xenstored/socket";
+	const int cTransactionRetries = 8;
+
+	int mFd;
+	ErrorCallback mErrorCallback;
+	uint32_t mReqId;
+	bool mTerminated;
+	Log mLog;
+
+	std::unordered_map<uint32_t, ReplyCallback> mRequests;
+	std::vector<char> mReceiveBuffer;
+
+	std::mutex mMutex;
+	std::mutex mWriteMutex;
+	std::thread mThread;
+	std::unique_ptr<PollFd> mPollFd;
+
+	void init(const std::string& socketPath);
+	void release();
+
+	void sendRequest(xsd_sockmsg_type type, xs_transaction_t transaction,
+					 const std::string& payload, ReplyCallback callback);
+	void receiveThread();
+	bool receiveReplies();
+	void handleReply(const xsd_sockmsg& header, const std::string& payload);
+	void cancelRequests(int error);
+
+	void startTreeRead(std::shared_ptr<TreeRead> read);
+	void readTreeEntry(std::shared_ptr<TreeRead> read, const std::string& key,
+					   unsigned int depth);
+	void finishTreeEntry(std::shared_ptr<TreeRead> read);
+
+	static int getError(const std::string& payload);
+	static std::string getString(const std::string& payload);
+};
+
+}
+
+#endif /* XENBE_ASYNCXENSTORE_HPP_ */
@@ -24,16 +24,23 @@
 #define XENBE_BACKENDBASE_HPP_
 
 #include <atomic>
-#include <list>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
+#include "AsyncXenStore.hpp"
 #include "Exception.hpp"
 #include "FrontendHandlerBase.hpp"
 #include "XenStore.hpp"
 #include "XenStat.hpp"
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -64,7 +71,8 @@ class BackendException : public Exception
  * It is expected that in this method a new instance of FrontendHandlerBase
  * class will be created and added with addFrontendHandler() method.
  * Adding the frontend handler is required to allow the backend class deleting
- * terminated frontends.
+ * terminated frontends. Frontend handlers are indexed by domain and device id,
+ * thus detection cost doesn't grow with the number of frontends.
  *
  * The client should create a class inherited from BackendBase and implement
  * onNewFrontend() method.
@@ -80,6 +88,19 @@ class BackendException : public Exception
  * The client may change the new frontend detection algorithm. For this
  * reason it may override getNewFrontend() method.
  *
+ * onNewFrontend() and stopping of removed frontends are called on a bounded
+ * pool of worker threads, thus a slow frontend bind doesn't delay detection
+ * of other frontends. Calls for the same domain are serialized in the order
+ * of detection. Bring-up latency (time from the frontend detection till
+ * onNewFrontend() is finished) is collected for each burst of new frontends,
+ * e.g. on host boot, and reported in the log and by getBringUpStats().
+ *
+ * If the xenstored socket is available, device lists of the domains are read
+ * through AsyncXenStore: the watch thread doesn't wait for the replies, thus
+ * rescans of many domains changed in one dispatch pass are pipelined.
+ * Otherwise, or if the connection is lost, the device lists are read
+ * synchronously. stop() cancels the pending reads.
+ *
  * When the backend instance is created, it should be started by calling start()
  * method. The backend will process frontends till stop() method is called.
  *
@@ -90,12 +111,33 @@ class BackendException : public Exception
 class BackendBase
 {
 public:
+
+	/**
+	 * Frontend bring-up statistics of a burst: period while at least one
+	 * detected frontend is waiting for onNewFrontend() to finish.
+	 */
+	struct BringUpStats
+	{
+		//! number of frontends brought up
+		size_t numFrontends;
+		//! time from the first detection till the last bring-up
+		std::chrono::milliseconds duration;
+		//! min bring-up latency
+		std::chrono::milliseconds minLatency;
+		//! max bring-up latency
+		std::chrono::milliseconds maxLatency;
+		//! average bring-up latency
+		std::chrono::milliseconds averageLatency;
+	};
+
 	/**
 	 * @param[in] name       optional backend name
 	 * @param[in] deviceName device name
-	 * @param[in] domId      domain id
+	 * @param[in] numWorkers number of threads to bring up frontends. If 0,
+	 *                       number of hardware threads is used.
 	 */
-	BackendBase(const std::string& name, const std::string& deviceName);
+	BackendBase(const std::string& name, const std::string& deviceName,
+				size_t numWorkers = 0);
 	virtual ~BackendBase();
 
 	/**
@@ -123,6 +165,11 @@ public:
 	 */
 	domid_t getDomId() const { return mDomId; }
 
+	/**
+	 * Returns bring-up statistics of the last finished burst
+	 */
+	BringUpStats getBringUpStats();
+
 protected:
 
 	XenStore mXenStore;
@@ -148,15 +195,43 @@ private:
 	domid_t mDomId;
 	std::string mDeviceName;
 	std::string mFrontendsPath;
-	std::list<domid_t> mDomainList;
-	std::list<FrontendHandlerPtr> mFrontendHandlers;
+	// known domains with sorted device ids
+	std::map<domid_t, std::vector<uint16_t>> mDomains;
+	// frontend handlers indexed by getFrontendKey()
+	std::unordered_map<uint32_t, FrontendHandlerPtr> mFrontendHandlers;
+	// frontends waiting for onNewFrontend()
+	std::unordered_set<uint32_t> mPendingFrontends;
+	std::mutex mMutex;
+
+	std::chrono::steady_clock::time_point mBurstStart;
+	BringUpStats mBurstStats;
+	BringUpStats mLastBurstStats;
 
 	Log mLog;
 
+	WorkerPool mWorkerPool;
+
+	// pipelined device list reads, null if xenstored socket isn't available
+	std::unique_ptr<AsyncXenStore> mAsyncXenStore;
+	std::atomic_bool mAsyncXenStoreLost;
+
+	static uint32_t getFrontendKey(domid_t domId, uint16_t devId)
+	{
+		return (static_cast<uint32_t>(domId) << 16) | devId;
+	}
+
 	void domainListChanged(const std::string& path);
-	void deviceListChanged(const std::string& path, domid_t domId);
+	void deviceListChanged(const std::vector<std::string>& paths,
+						   domid_t domId);
+	void devicesRead(domid_t domId, const std::vector<uint16_t>& current);
+	std::vector<uint16_t> readDevices(const std::string& domainPath);
 	void frontendPathChanged(const std::string& path, domid_t domId,
 							 uint16_t devId);
+	void bringUpFrontend(domid_t domId, uint16_t devId,
+						 std::chrono::steady_clock::time_point detected);
+	void updateBringUpStats(std::chrono::milliseconds latency);
+	void removeFrontend(domid_t domId, uint16_t devId);
+	void forgetDevice(domid_t domId, uint16_t devId);
 	FrontendHandlerPtr getFrontendHandler(domid_t domId, uint16_t devId);
 	void onError(const std::exception& e);
 };
@@ -0,0 +1,427 @@
+/*
+ *  Binary log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_BINARYLOG_HPP_
+#define XENBE_BINARYLOG_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Log.hpp"
+
+/**
+ * @def BLOG(instance, level, format, ...)
+ * Writes log with defined level to the binary log. The format is a string
+ * literal with <i>{}</i> placeholders which are replaced by the arguments.
+ * The level is checked against the binary log level set by
+ * BinaryLog::setLogLevel(). If the binary log is not opened, the level is
+ * checked against the text log level and the formatted line is displayed by
+ * LOG().
+ * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i>
+ * @param[in] level    log level
+ * @param[in] format   format string literal
+ * @ingroup log
+ *
+ * @code
+ * BLOG(mLog, DEBUG, "Send event, port: {}, size: {}", mPort, size);
+ * @endcode
+ */
+#define BLOG(instance, level, ...) \
+	!XenBackend::BinaryLog::isEnabled(instance, \
+									  XenBackend::LogLevel::log ## level) ? \
+	(void) 0 : XenBackend::BinaryLog::write( \
+			instance, XenBackend::LogLevel::log ## level, __FILENAME__, \
+			__LINE__, []() -> std::atomic<uint32_t>& \
+			{ static std::atomic<uint32_t> sId(0); return sId; }(), \
+			__VA_ARGS__)
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by BinaryLog.
+ * @ingroup log
+ ******************************************************************************/
+class BinaryLogException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Binary log.
+ *
+ * Formatting text log lines is expensive. The binary log writes the format
+ * id of the call site, the module name and raw arguments into the memory mapped
+ * file. The format string, source file and line are written only once per
+ * call site. The file is decoded offline by BinaryLogReader or by
+ * <i>xenbe-logdecode</i> tool.
+ *
+ * Records are appended without locking. When the file is full, new records
+ * are dropped and counted.
+ *
+ * The binary log has its own log level, thus the hot paths may be traced
+ * at DEBUG level into the file while the text log stays at INFO level.
+ *
+ * @code
+ * XenBackend::BinaryLog::open("/var/log/backend.blog", 64 * 1024 * 1024);
+ *
+ * BLOG(mLog, DEBUG, "Send event, port: {}", mPort);
+ *
+ * XenBackend::BinaryLog::close();
+ * @endcode
+ * @ingroup log
+ ******************************************************************************/
+class BinaryLog
+{
+public:
+
+	//! default file size
+	static const size_t cDefaultSize = 16 * 1024 * 1024;
+
+	/**
+	 * Creates the log file and starts writing into it
+	 * @param[in] path file path
+	 * @param[in] size file size
+	 */
+	static void open(const std::string& path, size_t size = cDefaultSize);
+
+	/**
+	 * Stops writing and truncates the file to the written size
+	 */
+	static void close();
+
+	/**
+	 * Returns <i>true</i> if the log file is opened
+	 */
+	static bool isOpened() { return sOpened; }
+
+	/**
+	 * Returns number of records dropped due to full file
+	 */
+	static size_t getNumDropped() { return sNumDropped; }
+
+	/**
+	 * Sets the level of the records written to the binary log. By default
+	 * all levels are written.
+	 * @param[in] level log level
+	 */
+	static void setLogLevel(LogLevel level) { sLevel = level; }
+
+	/**
+	 * Returns the binary log level
+	 */
+	static LogLevel getLogLevel() { return sLevel; }
+
+	/**
+	 * Checks if the level is enabled. Is called by BLOG().
+	 */
+	template<typename T>
+	static bool isEnabled(const T& instance, LogLevel level)
+	{
+		if (!sOpened)
+		{
+			return LogLine::isEnabled(instance, level);
+		}
+
+		LogLevel setLevel = sLevel;
+
+		return level <= setLevel && setLevel > LogLevel::logDISABLE;
+	}
+
+	/**
+	 * Writes the record. Is called by BLOG().
+	 */
+	template<typename... Args>
+	static void write(const Log& log, LogLevel level, const char* file,
+					  int line, std::atomic<uint32_t>& id, const char* format,
+					  const Args&... args)
+	{
+		Value values[] = { toValue(args)..., Value() };
+		auto name = log.mFileAndLine ? nullptr : log.mName.c_str();
+
+		if (!writeRecord(name, level, file, line, id, format, values,
+						 sizeof...(Args)) && LogLine::isEnabled(log, level))
+		{
+			LogLine().get(log, file, line, level)
+				<< render(format, values, sizeof...(Args));
+		}
+	}
+
+	/**
+	 * Writes the record. Is called by BLOG().
+	 */
+	template<typename... Args>
+	static void write(const char* name, LogLevel level, const char* file,
+					  int line, std::atomic<uint32_t>& id, const char* format,
+					  const Args&... args)
+	{
+		Value values[] = { toValue(args)..., Value() };
+
+		if (!writeRecord(name, level, file, line, id, format, values,
+						 sizeof...(Args)) && LogLine::isEnabled(name, level))
+		{
+			LogLine().get(name, file, line, level)
+				<< render(format, values, sizeof...(Args));
+		}
+	}
+
+	/// @cond HIDDEN_SYMBOLS
+	enum Tag : uint8_t
+	{
+		TAG_NONE, TAG_INT, TAG_UINT, TAG_BOOL, TAG_DOUBLE, TAG_STRING,
+		TAG_POINTER
+	};
+
+	struct Value
+	{
+		Value() : tag(TAG_NONE), u(0), str(nullptr), len(0) {}
+
+		const char* data() const { return str ? str : storage.data(); }
+		size_t size() const { return str ? len : storage.size(); }
+
+		Tag tag;
+		union
+		{
+			int64_t i;
+			uint64_t u;
+			double d;
+		};
+		// not owned string
+		const char* str;
+		uint32_t len;
+		// owned string: formatted class argument or char
+		std::string storage;
+	};
+
+	static std::string render(const char* format, const Value* values,
+							  size_t count);
+	/// @endcond
+
+private:
+
+	struct Format
+	{
+		std::string file;
+		uint32_t line;
+		LogLevel level;
+		std::string format;
+	};
+
+	static std::atomic_bool sOpened;
+	static std::atomic<LogLevel> sLevel;
+	static std::atomic<size_t> sNumDropped;
+	static std::atomic<int> sNumWriting;
+	static std::atomic<size_t> sOffset;
+	static char* sBuffer;
+	static size_t sSize;
+	static int sFd;
+
+	static std::mutex& getMutex();
+	static std::vector<Format>& getFormats();
+
+	static bool writeRecord(const char* name, LogLevel level, const char* file,
+							int line, std::atomic<uint32_t>& id,
+							const char* format, const Value* values,
+							size_t count);
+	static uint32_t registerFormat(LogLevel level, const char* file, int line,
+								   std::atomic<uint32_t>& id,
+								   const char* format);
+	static void writeFormat(uint32_t id, const Format& format);
+	static char* reserve(size_t size);
+
+	template<typename T>
+	static typename std::enable_if<std::is_integral<T>::value &&
+								   std::is_signed<T>::value, Value>::type
+	toValue(T arg)
+	{
+		Value value;
+
+		value.tag = TAG_INT;
+		value.i = arg;
+
+		return value;
+	}
+
+	template<typename T>
+	static typename std::enable_if<std::is_integral<T>::value &&
+								   std::is_unsigned<T>::value, Value>::type
+	toValue(T arg)
+	{
+		Value value;
+
+		value.tag = TAG_UINT;
+		value.u = arg;
+
+		return value;
+	}
+
+	template<typename T>
+	static typename std::enable_if<std::is_enum<T>::value, Value>::type
+	toValue(T arg)
+	{
+		return toValue(static_cast<typename std::underlying_type<T>::type>(
+				arg));
+	}
+
+	template<typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value,
+								   Value>::type
+	toValue(T arg)
+	{
+		Value value;
+
+		value.tag = TAG_DOUBLE;
+		value.d = arg;
+
+		return value;
+	}
+
+	template<typename T>
+	static Value toValue(const T* arg)
+	{
+		Value value;
+
+		value.tag = TAG_POINTER;
+		value.u = reinterpret_cast<uintptr_t>(arg);
+
+		return value;
+	}
+
+	template<typename T>
+	static typename std::enable_if<std::is_class<T>::value, Value>::type
+	toValue(const T& arg)
+	{
+		std::ostringstream stream;
+
+		stream << arg;
+
+		Value value;
+
+		value.tag = TAG_STRING;
+		value.storage = stream.str();
+
+		return value;
+	}
+
+	static Value toValue(bool arg)
+	{
+		Value value;
+
+		value.tag = TAG_BOOL;
+		value.u = arg;
+
+		return value;
+	}
+
+	static Value toValue(char arg)
+	{
+		Value value;
+
+		value.tag = TAG_STRING;
+		value.storage.assign(1, arg);
+
+		return value;
+	}
+
+	static Value toValue(const char* arg)
+	{
+		Value value;
+
+		value.tag = TAG_STRING;
+		value.str = arg ? arg : "(null)";
+		value.len = strlen(value.str);
+
+		return value;
+	}
+
+	static Value toValue(char* arg)
+	{
+		return toValue(const_cast<const char*>(arg));
+	}
+
+	static Value toValue(const std::string& arg)
+	{
+		Value value;
+
+		value.tag = TAG_STRING;
+		value.str = arg.c_str();
+		value.len = arg.length();
+
+		return value;
+	}
+};
+
+/***************************************************************************//**
+ * Decodes the binary log file.
+ *
+ * @code
+ * XenBackend::BinaryLogReader reader("/var/log/backend.blog");
+ * std::string line;
+ *
+ * while (reader.readLine(line))
+ * {
+ *     std::cout << line << std::endl;
+ * }
+ * @endcode
+ * @ingroup log
+ ******************************************************************************/
+class BinaryLogReader
+{
+public:
+
+	/**
+	 * @param[in] path binary log file path
+	 */
+	explicit BinaryLogReader(const std::string& path);
+
+	/**
+	 * Reads the next log line in the text log format
+	 * @param[out] line log line
+	 * @return <i>false</i> if there are no more lines
+	 */
+	bool readLine(std::string& line);
+
+private:
+
+	struct Format
+	{
+		std::string file;
+		uint32_t line;
+		LogLevel level;
+		std::string format;
+	};
+
+	std::vector<char> mData;
+	size_t mOffset;
+	std::map<uint32_t, Format> mFormats;
+
+	bool readRecord(size_t offset, uint32_t& type, uint32_t& size);
+	std::string readEvent(const char* data, size_t size);
+};
+
+}
+
+#endif /* XENBE_BINARYLOG_HPP_ */
@@ -0,0 +1,357 @@
+/*
+ *  Delegate
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_DELEGATE_HPP_
+#define XENBE_DELEGATE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace XenBackend {
+
+template<typename Signature>
+class Delegate;
+
+/***************************************************************************//**
+ * Callable wrapper which keeps small callables without heap allocation.
+ *
+ * Delegate is used instead of std::function for callbacks which are called
+ * on hot paths. Callables up to cBufferSize bytes (function pointers, lambdas
+ * capturing few pointers, std::bind of a member function and <i>this</i>,
+ * std::function) are stored inside the delegate, thus creating, copying and
+ * calling the delegate doesn't allocate. Bigger callables are allocated once
+ * when the delegate is created.
+ *
+ * Move-only callables are supported as well. Copying a delegate which holds
+ * such a callable throws std::logic_error.
+ *
+ * @code
+ * XenBackend::Delegate<void(int)> delegate([this](int value) { ... });
+ *
+ * if (delegate)
+ * {
+ *     delegate(5);
+ * }
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+template<typename R, typename... Args>
+class Delegate<R(Args...)>
+{
+public:
+
+	//! size of the internal buffer for callables
+	static const size_t cBufferSize = 4 * sizeof(void*);
+
+	Delegate() : mOps(nullptr) {}
+	Delegate(std::nullptr_t) : mOps(nullptr) {}
+
+	/**
+	 * @param f callable
+	 */
+	template<typename F, typename = typename std::enable_if<
+			 !std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+	Delegate(F&& f) : mOps(nullptr)
+	{
+		assign(std::forward<F>(f));
+	}
+
+	Delegate(const Delegate& other) : mOps(nullptr)
+	{
+		if (other.mOps)
+		{
+			other.mOps->copy(&mStorage, &other.mStorage);
+			mOps = other.mOps;
+		}
+	}
+
+	Delegate(Delegate&& other) noexcept : mOps(nullptr)
+	{
+		if (other.mOps)
+		{
+			other.mOps->move(&mStorage, &other.mStorage);
+			mOps = other.mOps;
+			other.mOps = nullptr;
+		}
+	}
+
+	~Delegate() { reset(); }
+
+	Delegate& operator=(const Delegate& other)
+	{
+		if (this != &other)
+		{
+			Delegate tmp(other);
+
+			*this = std::move(tmp);
+		}
+
+		return *this;
+	}
+
+	Delegate& operator=(Delegate&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+
+			if (other.mOps)
+			{
+				other.mOps->move(&mStorage, &other.mStorage);
+				mOps = other.mOps;
+				other.mOps = nullptr;
+			}
+		}
+
+		return *this;
+	}
+
+	Delegate& operator=(std::nullptr_t)
+	{
+		reset();
+
+		return *this;
+	}
+
+	/**
+	 * Returns <i>true</i> if the delegate holds a callable
+	 */
+	explicit operator bool() const { return mOps != nullptr; }
+
+	/**
+	 * Calls the callable. Throws std::bad_function_call if the delegate is
+	 * empty.
+	 */
+	R operator()(Args... args) const
+	{
+		if (!mOps)
+		{
+			throw std::bad_function_call();
+		}
+
+		return mOps->call(&mStorage, std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Returns <i>true</i> if the callable is stored without heap allocation
+	 */
+	bool isInline() const { return mOps && mOps->isInline; }
+
+private:
+
+	typedef typename std::aligned_storage<cBufferSize>::type Storage;
+
+	struct Ops
+	{
+		R (*call)(void* storage, Args&&... args);
+		void (*copy)(void* dst, const void* src);
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* storage);
+		bool isInline;
+	};
+
+	template<typename F>
+	struct InlineOps
+	{
+		static R call(void* storage, Args&&... args)
+		{
+			return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+		}
+
+		static void copy(void* dst, const void* src)
+		{
+			copy(dst, src, std::is_copy_constructible<F>());
+		}
+
+		static void copy(void* dst, const void* src, std::true_type)
+		{
+			new (dst) F(*static_cast<const F*>(src));
+		}
+
+		static void copy(void*, const void*, std::false_type)
+		{
+			throwNotCopyable();
+		}
+
+		static void move(void* dst, void* src)
+		{
+			new (dst) F(std::move(*static_cast<F*>(src)));
+			static_cast<F*>(src)->~F();
+		}
+
+		static void destroy(void* storage)
+		{
+			static_cast<F*>(storage)->~F();
+		}
+
+		static const Ops sOps;
+	};
+
+	template<typename F>
+	struct HeapOps
+	{
+		static F*& get(void* storage) { return *static_cast<F**>(storage); }
+
+		static R call(void* storage, Args&&... args)
+		{
+			return (*get(storage))(std::forward<Args>(args)...);
+		}
+
+		static void copy(void* dst, const void* src)
+		{
+			copy(dst, src, std::is_copy_constructible<F>());
+		}
+
+		static void copy(void* dst, const void* src, std::true_type)
+		{
+			new (dst) F*(new F(**static_cast<F* const*>(src)));
+		}
+
+		static void copy(void*, const void*, std::false_type)
+		{
+			throwNotCopyable();
+		}
+
+		static void move(void* dst, void* src)
+		{
+			new (dst) F*(get(src));
+		}
+
+		static void destroy(void* storage)
+		{
+			delete get(storage);
+		}
+
+		static const Ops sOps;
+	};
+
+	mutable Storage mStorage;
+	const Ops* mOps;
+
+	static void throwNotCopyable()
+	{
+		throw std::logic_error("Move-only callable can't be copied");
+	}
+
+	template<typename F>
+	static bool isNull(const F&) { return false; }
+
+	template<typename F>
+	static bool isNull(F* f) { return f == nullptr; }
+
+	template<typename C, typename M>
+	static bool isNull(M C::* f) { return f == nullptr; }
+
+	template<typename S>
+	static bool isNull(const std::function<S>& f) { return !f; }
+
+	template<typename F>
+	void assign(F&& f)
+	{
+		typedef typename std::decay<F>::type Type;
+		typedef std::integral_constant<bool,
+				sizeof(Type) <= sizeof(Storage) &&
+				std::alignment_of<Type>::value <=
+				std::alignment_of<Storage>::value &&
+				std::is_nothrow_move_constructible<Type>::value> IsInline;
+
+		if (isNull(f))
+		{
+			return;
+		}
+
+		assign<Type>(std::forward<F>(f), IsInline());
+	}
+
+	template<typename Type, typename F>
+	void assign(F&& f, std::true_type)
+	{
+		new (&mStorage) Type(std::forward<F>(f));
+		mOps = &InlineOps<Type>::sOps;
+	}
+
+	template<typename Type, typename F>
+	void assign(F&& f, std::false_type)
+	{
+		new (&mStorage) Type*(new Type(std::forward<F>(f)));
+		mOps = &HeapOps<Type>::sOps;
+	}
+
+	void reset()
+	{
+		if (mOps)
+		{
+			mOps->destroy(&mStorage);
+			mOps = nullptr;
+		}
+	}
+};
+
+/// @cond HIDDEN_SYMBOLS
+template<typename R, typename... Args>
+template<typename F>
+const typename Delegate<R(Args...)>::Ops
+Delegate<R(Args...)>::InlineOps<F>::sOps =
+{
+	&InlineOps<F>::call, &InlineOps<F>::copy, &InlineOps<F>::move,
+	&InlineOps<F>::destroy, true
+};
+
+template<typename R, typename... Args>
+template<typename F>
+const typename Delegate<R(Args...)>::Ops
+Delegate<R(Args...)>::HeapOps<F>::sOps =
+{
+	&HeapOps<F>::call, &HeapOps<F>::copy, &HeapOps<F>::move,
+	&HeapOps<F>::destroy, false
+};
+
+template<typename R, typename... Args>
+bool operator==(const Delegate<R(Args...)>& delegate, std::nullptr_t)
+{
+	return !delegate;
+}
+
+template<typename R, typename... Args>
+bool operator==(std::nullptr_t, const Delegate<R(Args...)>& delegate)
+{
+	return !delegate;
+}
+
+template<typename R, typename... Args>
+bool operator!=(const Delegate<R(Args...)>& delegate, std::nullptr_t)
+{
+	return static_cast<bool>(delegate);
+}
+
+template<typename R, typename... Args>
+bool operator!=(std::nullptr_t, const Delegate<R(Args...)>& delegate)
+{
+	return static_cast<bool>(delegate);
+}
+/// @endcond
+
+}
+
+#endif /* XENBE_DELEGATE_HPP_ */
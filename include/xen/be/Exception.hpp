@@ -28,12 +28,14 @@
 
 #include <cstring>
 
+#include "Delegate.hpp"
+
 namespace XenBackend {
 
 /**
  * Callback which is called when an error occurs
  */
-typedef std::function<void(const std::exception&)> ErrorCallback;
+typedef Delegate<void(const std::exception&)> ErrorCallback;
 
 /***************************************************************************//**
  * Base class for all Xen exception.
@@ -0,0 +1,329 @@
+/*
+ *  Host I/O queue
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_HOSTIO_HPP_
+#define XENBE_HOSTIO_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "Delegate.hpp"
+#include "Exception.hpp"
+#include "Log.hpp"
+#include "RingBufferBase.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by HostIoQueue.
+ * @ingroup backend
+ ******************************************************************************/
+class HostIoException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Queue of asynchronous I/O operations on host files.
+ *
+ * Operations are queued by read(), write() and fsync() and passed to the
+ * kernel in one batch by submit(). If the kernel supports io_uring, the
+ * operations are submitted to io_uring with one system call and are executed
+ * in parallel. Otherwise the operations are executed synchronously on
+ * submit(). In both cases the completions are called by reap() and the file
+ * descriptor returned by getFd() becomes readable when there are completed
+ * operations, thus the queue may be served by any poll based loop.
+ *
+ * The queue is not thread safe: all methods should be called from one thread.
+ * Buffers should be valid till the completion is called.
+ *
+ * @code
+ * XenBackend::HostIoQueue queue;
+ *
+ * queue.read(fd, buffer, size, offset, [](ssize_t result) { ... });
+ * queue.submit();
+ *
+ * // when queue.getFd() is readable
+ * queue.reap();
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+class HostIoQueue
+{
+public:
+
+	/**
+	 * Completion which is called with the number of transferred bytes or
+	 * negative error code
+	 */
+	typedef Delegate<void(ssize_t result)> Completion;
+
+	//! default maximal number of queued and running operations
+	static const unsigned int cDefaultDepth = 64;
+
+	/**
+	 * @param[in] depth     maximal number of queued and running operations
+	 * @param[in] useUring  use io_uring if it is supported by the kernel
+	 */
+	explicit HostIoQueue(unsigned int depth = cDefaultDepth,
+						 bool useUring = true);
+	HostIoQueue(const HostIoQueue&) = delete;
+	HostIoQueue& operator=(const HostIoQueue&) = delete;
+
+	/**
+	 * Waits for running operations. The completions are not called.
+	 */
+	~HostIoQueue();
+
+	/**
+	 * Queues reading from the file. If the queue is full, waits till one of
+	 * the running operations is completed and calls its completion.
+	 * @param[in] fd         file descriptor
+	 * @param[in] buffer     buffer to read into
+	 * @param[in] size       number of bytes to read
+	 * @param[in] offset     file offset
+	 * @param[in] completion completion
+	 */
+	void read(int fd, void* buffer, size_t size, off_t offset,
+			  Completion completion);
+
+	/**
+	 * Queues writing to the file. If the queue is full, waits till one of
+	 * the running operations is completed and calls its completion.
+	 * @param[in] fd         file descriptor
+	 * @param[in] buffer     buffer to write from
+	 * @param[in] size       number of bytes to write
+	 * @param[in] offset     file offset
+	 * @param[in] completion completion
+	 */
+	void write(int fd, const void* buffer, size_t size, off_t offset,
+			   Completion completion);
+
+	/**
+	 * Queues flushing the file data. If the queue is full, waits till one
+	 * of the running operations is completed and calls its completion.
+	 * @param[in] fd         file descriptor
+	 * @param[in] completion completion
+	 */
+	void fsync(int fd, Completion completion);
+
+	/**
+	 * Submits the queued operations
+	 * @return number of submitted operations
+	 */
+	size_t submit();
+
+	/**
+	 * Calls the completions of the completed operations. Doesn't block.
+	 * The operations queued by the completions are submitted.
+	 * @return number of called completions
+	 */
+	size_t reap();
+
+	/**
+	 * Submits the queued operations and waits till all operations are
+	 * completed. The completions are called.
+	 */
+	void wait();
+
+	/**
+	 * Returns the file descriptor which is readable when there are completed
+	 * operations
+	 */
+	int getFd() const { return mEventFd; }
+
+	/**
+	 * Returns <i>true</i> if the operations are executed by io_uring
+	 */
+	bool isUring() const { return mRingFd >= 0; }
+
+	/**
+	 * Returns number of queued and running operations
+	 */
+	size_t getNumPending() const { return mOps.size() - mFreeOps.size(); }
+
+private:
+
+	enum OpCode : uint8_t
+	{
+		OP_READ, OP_WRITE, OP_FSYNC
+	};
+
+	struct Op
+	{
+		OpCode opcode;
+		int fd;
+		iovec iov;
+		off_t offset;
+		ssize_t result;
+		Completion completion;
+	};
+
+	struct Ring
+	{
+		unsigned* head;
+		unsigned* tail;
+		unsigned* mask;
+		void* ptr;
+		size_t size;
+	};
+
+	int mEventFd;
+	int mRingFd;
+
+	Ring mSq;
+	Ring mCq;
+	unsigned* mSqArray;
+	void* mSqes;
+	size_t mSqesSize;
+	void* mCqes;
+
+	std::vector<Op> mOps;
+	std::vector<uint32_t> mFreeOps;
+	// in synchronous mode: queued and completed operations
+	std::vector<uint32_t> mQueued;
+	std::vector<uint32_t> mCompleted;
+	size_t mNumCompletedReaped;
+	size_t mNumUnsubmitted;
+
+	Log mLog;
+
+	void init(unsigned int depth, bool useUring);
+	bool initUring(unsigned int depth);
+	void release();
+
+	void queue(OpCode opcode, int fd, void* buffer, size_t size,
+			   off_t offset, Completion completion);
+	void queueUring(uint32_t index);
+	size_t submitUring();
+	size_t submitSync();
+	void waitCompletions(unsigned int count);
+	void waitRunning();
+	size_t reapUring(bool call);
+	size_t reapSync();
+	void complete(uint32_t index, ssize_t result, bool call);
+	void execute(Op& op);
+	void clearEventFd();
+};
+
+/***************************************************************************//**
+ * Base class to create the input ring buffer which serves requests by I/O on
+ * host files.
+ *
+ * HostIoRingBufferInBase is StaticRingBufferInBase with HostIoQueue. The
+ * derived class queues the I/O operations in processRequest() and sends the
+ * responses from the completions. The operations queued while the ring is
+ * consumed are submitted in one batch after the last pending request. The
+ * completions are called in the event channel thread, thus sendResponse()
+ * may be called from them directly.
+ *
+ * stop() waits for the running I/O operations and calls their completions,
+ * thus buffers and files of the derived class are not accessed after it.
+ * The derived class which owns them should call stop() in its destructor:
+ * the destructor of this class is called after they are destroyed.
+ *
+ * @code
+ * class MyRingBuffer : public XenBackend::HostIoRingBufferInBase<
+ *                          MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *                          xentest_req, xentest_rsp>
+ * {
+ *     ...
+ *
+ *     void processRequest(const xentest_req& req)
+ *     {
+ *         auto id = req.id;
+ *
+ *         mIo.read(mFd, getBuffer(req), req.size, req.offset,
+ *                  [this, id](ssize_t result)
+ *                  { sendResponse(makeResponse(id, result)); });
+ *     }
+ * };
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Derived, typename Ring, typename Page, typename Req,
+		 typename Rsp>
+class HostIoRingBufferInBase : public StaticRingBufferInBase<
+		Derived, Ring, Page, Req, Rsp>
+{
+public:
+
+	/**
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] size     ring buffer size
+	 * @param[in] depth    maximal number of queued and running I/O operations
+	 * @param[in] useUring use io_uring if it is supported by the kernel
+	 */
+	HostIoRingBufferInBase(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+						   int size = XC_PAGE_SIZE,
+						   unsigned int depth = HostIoQueue::cDefaultDepth,
+						   bool useUring = true) :
+		StaticRingBufferInBase<Derived, Ring, Page, Req, Rsp>(
+				domId, port, ref, size),
+		mIo(depth, useUring)
+	{
+		this->setFdCallback(mIo.getFd(), [this] { mIo.reap(); });
+	}
+
+	/**
+	 * Stops the ring buffer and waits for running I/O operations
+	 */
+	~HostIoRingBufferInBase() { stop(); }
+
+	/**
+	 * Stops the ring buffer, waits for running I/O operations and calls
+	 * their completions
+	 */
+	void stop()
+	{
+		RingBufferBase::stop();
+
+		try
+		{
+			mIo.wait();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(this->mLog, ERROR) << e.what();
+		}
+	}
+
+protected:
+
+	/**
+	 * I/O queue served in the event channel thread.
+	 */
+	HostIoQueue mIo;
+
+private:
+
+	friend class StaticRingBufferInBase<Derived, Ring, Page, Req, Rsp>;
+
+	void onRequestsProcessed() { mIo.submit(); }
+};
+
+}
+
+#endif /* XENBE_HOSTIO_HPP_ */
@@ -22,13 +22,20 @@
 #define XENBE_LOG_HPP_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 /***************************************************************************//**
@@ -36,8 +43,9 @@
  *
  * Special macros are designed to show logs: LOG() and DLOG().
  * DLOG is compiled to void in release build (NDEBUG is defined) and can be used
- * in time critical path. These macros returns a string stream object thus basic
- * c++ iostream operators can be used.
+ * in time critical path. LOG checks the level first, thus a disabled log costs
+ * one branch and its operands are not evaluated. These macros write to a
+ * string stream object thus basic c++ iostream operators can be used.
  * The macros take two parameters: first one could be
  * either instance of XenBackend::Log or string, second one is
  * XenBackend::LogLevel (for macro use DISABLE, ERROR, WARNING, INFO, DEBUG).
@@ -46,6 +54,10 @@
  * name. If <i>nullptr</i> is passed instead of string then the source file
  * name and line number will be displayed in the log.
  *
+ * Paths which may be triggered by a frontend at high rate should use
+ * LOG_RATELIMIT() or LOG_EVERY_N(). These macros limit lines of each call site
+ * and report number of suppressed lines in the next displayed line.
+ *
  * Log with string module name:
  * @code{.cpp}
  * LOG("ModuleName", DEBUG) << "This is debug log";
@@ -82,13 +94,18 @@
 
 /**
  * @def LOG(instance, level)
- * Displays log with defined level.
+ * Displays log with defined level. The level is checked before the log line
+ * is created: if the level is disabled, the stream operands are not
+ * evaluated.
  * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
  *                         <i>nullptr</i>
  * @param[in] level    log level
  * @ingroup log
  */
 #define LOG(instance, level) \
+	!XenBackend::LogLine::isEnabled(instance, \
+									XenBackend::LogLevel::log ## level) ? \
+	(void) 0 : XenBackend::LogVoid() & \
 	XenBackend::LogLine().get(instance, __FILENAME__, __LINE__, \
 							  XenBackend::LogLevel::log ## level)
 
@@ -108,10 +125,60 @@
 #else
 
 #define DLOG(instance, level) \
-	true ? (void) 0 : XenBackend::LogVoid() & LOG(instance, level)
+	true ? (void) 0 : LOG(instance, level)
 
 #endif
 
+/**
+ * @def LOG_RATELIMIT(instance, level, periodMs)
+ * Displays log with defined level not often than once per period for each call
+ * site. The number of lines suppressed since the last displayed line is put in
+ * front of the message. Suppressed lines don't evaluate the stream operands.
+ * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
+ *                         <i>nullptr</i>
+ * @param[in] level    log level
+ * @param[in] periodMs period in milliseconds
+ * @ingroup log
+ *
+ * @code
+ * LOG_RATELIMIT(mLog, WARNING, 1000) << "Ring buffer overflow";
+ *
+ * output:
+ *
+ * 07.11.16 16:46:54.029 | MyModule | WRN - (125 suppressed) Ring buffer overflow
+ * @endcode
+ */
+#define LOG_RATELIMIT(instance, level, periodMs) \
+	LOG_LIMITED(instance, level, \
+				checkPeriod(std::chrono::milliseconds(periodMs)))
+
+/**
+ * @def LOG_EVERY_N(instance, level, n)
+ * Displays each n-th log with defined level for each call site, starting from
+ * the first one. The number of lines suppressed since the last displayed line
+ * is put in front of the message.
+ * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
+ *                         <i>nullptr</i>
+ * @param[in] level    log level
+ * @param[in] n        display each n-th line
+ * @ingroup log
+ */
+#define LOG_EVERY_N(instance, level, n) \
+	LOG_LIMITED(instance, level, checkEveryN(n))
+
+/// @cond HIDDEN_SYMBOLS
+#define LOG_LIMITED(instance, level, check) \
+	for (auto xenbeLogLimit = []() -> XenBackend::LogLimit* \
+		 { static XenBackend::LogLimit sLimit; return &sLimit; }(); \
+		 xenbeLogLimit && \
+		 XenBackend::LogLine::isEnabled(instance, \
+										XenBackend::LogLevel::log ## level) && \
+		 xenbeLogLimit->check; xenbeLogLimit = nullptr) \
+		XenBackend::LogLine().get(instance, __FILENAME__, __LINE__, \
+								  XenBackend::LogLevel::log ## level) \
+			<< xenbeLogLimit->takeSuppressed()
+/// @endcond
+
 namespace XenBackend {
 
 /**
@@ -271,7 +338,9 @@ public:
 
 private:
 
+	friend class BinaryLog;
 	friend class LogLine;
+	friend class LogWriter;
 
 	std::string mName;
 	LogLevel mLevel;
@@ -291,6 +360,13 @@ private:
 		return sOutput;
 	}
 
+	static std::mutex& getOutputMutex()
+	{
+		static std::mutex sMutex;
+
+		return sMutex;
+	}
+
 	void setLogLevelByMask()
 	{
 		for(auto item : getLogMaskItems())
@@ -386,20 +462,197 @@ private:
 	}
 };
 
+/***************************************************************************//**
+ * Asynchronous log writer.
+ *
+ * By default each log line is written and flushed by the logging thread under
+ * the global lock. When the writer is started, log lines are moved into
+ * the bounded buffer of the logging thread without locking and written by
+ * the background thread. The logging threads share no counters or locks. If
+ * the thread buffer is full, the line is dropped and counted. The background
+ * thread is woken up when a buffer gets half full, otherwise the buffers are
+ * drained periodically. The output is flushed once per drain.
+ *
+ * @code
+ * XenBackend::LogWriter::start();
+ *
+ * ...
+ *
+ * XenBackend::LogWriter::stop();
+ * @endcode
+ *
+ * Log::setStreamBuffer() should not be called while the writer is started.
+ * @ingroup log
+ ******************************************************************************/
+class LogWriter
+{
+public:
+
+	//! default size of the thread buffer in bytes
+	static const size_t cDefaultBufferSize = 64 * 1024;
+	//! default period of draining thread buffers in milliseconds
+	static const int cDefaultDrainPeriodMs = 50;
+
+	/**
+	 * Starts the writer
+	 * @param[in] bufferSize    size of each thread buffer in bytes
+	 * @param[in] drainPeriodMs period of draining thread buffers
+	 */
+	static void start(size_t bufferSize = cDefaultBufferSize,
+					  int drainPeriodMs = cDefaultDrainPeriodMs);
+
+	/**
+	 * Writes all buffered lines and stops the writer
+	 */
+	static void stop();
+
+	/**
+	 * Returns <i>true</i> if the writer is started
+	 */
+	static bool isStarted() { return sStarted; }
+
+	/**
+	 * Returns number of lines dropped due to full thread buffer
+	 */
+	static size_t getNumDropped() { return sNumDropped; }
+
+	/**
+	 * Moves the line into the thread buffer
+	 * @param[in] line log line, it is not moved if the writer is not started
+	 * @return <i>false</i> if the writer is not started
+	 */
+	static bool write(std::string&& line);
+
+private:
+
+	struct ThreadBuffer;
+
+	static std::atomic_bool sStarted;
+	static std::atomic<size_t> sNumDropped;
+
+	std::mutex mMutex;
+	std::mutex mItfMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+	bool mTerminate;
+	size_t mBufferSize;
+	int mDrainPeriodMs;
+	// thread buffers of previous starts are not used
+	std::atomic<unsigned> mGeneration;
+	std::vector<std::shared_ptr<ThreadBuffer>> mBuffers;
+
+	LogWriter();
+	~LogWriter();
+
+	static LogWriter& getInstance();
+	static std::shared_ptr<ThreadBuffer>& getThreadBuffer();
+
+	void release();
+	void run();
+	void drain();
+};
+
 /// @cond HIDDEN_SYMBOLS
+/*
+ * Limit of the log call site. Lines are counted without locking, thus
+ * concurrent callers may rarely display one line more than the limit.
+ */
+class LogLimit
+{
+public:
+
+	struct Suppressed
+	{
+		uint64_t count;
+	};
+
+	LogLimit() : mCount(0), mNextTime(0), mNumSuppressed(0) {}
+
+	bool checkEveryN(uint64_t n)
+	{
+		if (n <= 1 || mCount++ % n == 0)
+		{
+			return true;
+		}
+
+		mNumSuppressed++;
+
+		return false;
+	}
+
+	bool checkPeriod(std::chrono::milliseconds period)
+	{
+		auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		auto nextTime = mNextTime.load();
+
+		if (now >= nextTime &&
+			mNextTime.compare_exchange_strong(nextTime, now + period.count()))
+		{
+			return true;
+		}
+
+		mNumSuppressed++;
+
+		return false;
+	}
+
+	Suppressed takeSuppressed() { return { mNumSuppressed.exchange(0) }; }
+
+private:
+
+	std::atomic<uint64_t> mCount;
+	std::atomic<int64_t> mNextTime;
+	std::atomic<uint64_t> mNumSuppressed;
+};
+
+inline std::ostream& operator<<(std::ostream& stream,
+								const LogLimit::Suppressed& suppressed)
+{
+	if (suppressed.count)
+	{
+		stream << "(" << suppressed.count << " suppressed) ";
+	}
+
+	return stream;
+}
+
 class LogLine
 {
 public:
 
-	virtual ~LogLine()
+	/**
+	 * Checks if the level is enabled for the log instance
+	 */
+	static bool isEnabled(const Log& log, LogLevel level)
 	{
-		static std::mutex sMutex;
+		return level <= log.mLevel && log.mLevel > LogLevel::logDISABLE;
+	}
 
+	/**
+	 * Checks if the level is enabled for the module name
+	 */
+	static bool isEnabled(const char* name, LogLevel level)
+	{
+		auto setLevel = Log::getLogLevel();
+
+		return level <= setLevel && setLevel > LogLevel::logDISABLE;
+	}
+
+	virtual ~LogLine()
+	{
 		if (mCurrentLevel <= mSetLevel && mSetLevel > LogLevel::logDISABLE)
 		{
-			std::lock_guard<std::mutex> lock(sMutex);
+			auto line = mStream.str();
+
+			if (LogWriter::write(std::move(line)))
+			{
+				return;
+			}
 
-			Log::getOutputStream() << mStream.str() << std::endl;
+			std::lock_guard<std::mutex> lock(Log::getOutputMutex());
+
+			Log::getOutputStream() << line << std::endl;
 		}
 	}
 
@@ -465,17 +718,31 @@ private:
 
 	std::string nowTime()
 	{
+		// date and time are formatted once per second per thread
+		static thread_local time_t sLastTime = 0;
+		static thread_local char sPrefix[32] = "";
+
 		auto now = std::chrono::system_clock::now();
 		auto time = std::chrono::system_clock::to_time_t(now);
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
 					  now.time_since_epoch()) % 1000;
 
-		std::stringstream ss;
+		if (time != sLastTime)
+		{
+			tm localTime;
+
+			localtime_r(&time, &localTime);
+			strftime(sPrefix, sizeof(sPrefix), "%d.%m.%y %X.", &localTime);
+
+			sLastTime = time;
+		}
+
+		char buffer[40];
 
-		ss << std::put_time(localtime(&time), "%d.%m.%y %X.")
-		   << std::setfill('0') << std::setw(3) << ms.count();
+		snprintf(buffer, sizeof(buffer), "%s%03d", sPrefix,
+				 static_cast<int>(ms.count()));
 
-		return ss.str();
+		return buffer;
 	}
 
 	std::string levelToString(LogLevel level)
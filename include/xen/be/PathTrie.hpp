@@ -0,0 +1,403 @@
+/*
+ *  Radix trie of Xen store paths
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_PATHTRIE_HPP_
+#define XENBE_PATHTRIE_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Radix trie keyed by Xen store paths.
+ *
+ * Keys are stored with shared prefixes compressed into single edges, so
+ * lookups cost O(path length) regardless of the number of stored keys.
+ * Besides the exact lookup the trie can enumerate all keys which are
+ * path prefixes of the given path (i.e. parents of the path in Xen store
+ * terms) and all keys located inside the subtree of the given path.
+ * A key is considered a path prefix only if it ends on a path component
+ * boundary: <i>/local/domain/1</i> is a prefix of <i>/local/domain/1/device</i>
+ * but not of <i>/local/domain/12</i>.
+ *
+ * @code
+ * PathTrie<int> trie;
+ *
+ * trie.insert("/local/domain/1", 1);
+ * trie.insert("/local/domain/1/device", 2);
+ *
+ * trie.forEachPrefix("/local/domain/1/device/vif/0",
+ *                    [](const std::string& key, int& value) { ... });
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+template<typename T>
+class PathTrie
+{
+public:
+
+	PathTrie() : mSize(0) {}
+	PathTrie(const PathTrie&) = delete;
+	PathTrie& operator=(PathTrie const&) = delete;
+
+	/**
+	 * Inserts or replaces the value for the key.
+	 * @param[in] key   path
+	 * @param[in] value value
+	 * @return reference to the stored value
+	 */
+	T& insert(const std::string& key, const T& value)
+	{
+		Node* node = &mRoot;
+		size_t pos = 0;
+
+		while (pos < key.length())
+		{
+			auto it = node->children.find(key[pos]);
+
+			if (it == node->children.end())
+			{
+				std::unique_ptr<Node> child(new Node);
+
+				child->label = key.substr(pos);
+				child->parent = node;
+
+				Node* newNode = child.get();
+
+				node->children[key[pos]] = std::move(child);
+
+				node = newNode;
+
+				break;
+			}
+
+			Node* child = it->second.get();
+
+			auto common = commonLength(child->label, key, pos);
+
+			if (common < child->label.length())
+			{
+				std::unique_ptr<Node> middle(new Node);
+
+				middle->label = child->label.substr(0, common);
+				middle->parent = node;
+
+				child->label.erase(0, common);
+				child->parent = middle.get();
+
+				middle->children[child->label[0]] = std::move(it->second);
+
+				it->second = std::move(middle);
+
+				child = it->second.get();
+			}
+
+			node = child;
+			pos += common;
+		}
+
+		if (!node->value)
+		{
+			mSize++;
+		}
+
+		node->value.reset(new T(value));
+
+		return *node->value;
+	}
+
+	/**
+	 * Removes the key.
+	 * @param[in] key path
+	 * @return <i>true</i> if the key was found and removed
+	 */
+	bool erase(const std::string& key)
+	{
+		Node* node = findNode(key);
+
+		if (!node || !node->value)
+		{
+			return false;
+		}
+
+		node->value.reset();
+
+		mSize--;
+
+		prune(node);
+
+		return true;
+	}
+
+	/**
+	 * Finds the value by the exact key.
+	 * @param[in] key path
+	 * @return pointer to the value or <i>nullptr</i> if not found
+	 */
+	T* find(const std::string& key)
+	{
+		Node* node = findNode(key);
+
+		return node ? node->value.get() : nullptr;
+	}
+
+	/**
+	 * Finds the value of the longest key which is a path prefix of the path.
+	 * @param[in]  path path
+	 * @param[out] key  found key
+	 * @return pointer to the value or <i>nullptr</i> if not found
+	 */
+	T* findLongestPrefix(const std::string& path, std::string& key)
+	{
+		T* result = nullptr;
+
+		forEachPrefix(path, [&result, &key](const std::string& prefix,
+											T& value)
+		{
+			key = prefix;
+			result = &value;
+		});
+
+		return result;
+	}
+
+	/**
+	 * Calls the visitor for all keys which are path prefixes of the path,
+	 * including the path itself. Keys are visited from the shortest one.
+	 * @param[in] path    path
+	 * @param[in] visitor visitor called with the key and the value
+	 */
+	template<typename Visitor>
+	void forEachPrefix(const std::string& path, Visitor visitor)
+	{
+		Node* node = &mRoot;
+		size_t pos = 0;
+
+		while (true)
+		{
+			if (node->value && isBoundary(path, pos))
+			{
+				visitor(path.substr(0, pos), *node->value);
+			}
+
+			if (pos == path.length())
+			{
+				return;
+			}
+
+			auto it = node->children.find(path[pos]);
+
+			if (it == node->children.end())
+			{
+				return;
+			}
+
+			node = it->second.get();
+
+			if (path.compare(pos, node->label.length(), node->label) != 0)
+			{
+				return;
+			}
+
+			pos += node->label.length();
+		}
+	}
+
+	/**
+	 * Calls the visitor for all keys located in the subtree of the path,
+	 * including the path itself. Parents are visited before their children.
+	 * @param[in] path    path
+	 * @param[in] visitor visitor called with the key and the value
+	 */
+	template<typename Visitor>
+	void forEachInSubtree(const std::string& path, Visitor visitor)
+	{
+		Node* node = &mRoot;
+		size_t pos = 0;
+		std::string key;
+
+		// find the node which covers the whole path
+		while (pos < path.length())
+		{
+			auto it = node->children.find(path[pos]);
+
+			if (it == node->children.end())
+			{
+				return;
+			}
+
+			node = it->second.get();
+
+			auto common = commonLength(node->label, path, pos);
+
+			if (common < node->label.length() &&
+				pos + common < path.length())
+			{
+				return;
+			}
+
+			key.append(node->label);
+			pos += node->label.length();
+		}
+
+		visitSubtree(node, key, path.length(), visitor);
+	}
+
+	/**
+	 * Removes all keys.
+	 */
+	void clear()
+	{
+		mRoot.children.clear();
+		mRoot.value.reset();
+		mSize = 0;
+	}
+
+	/**
+	 * Returns number of stored keys.
+	 */
+	size_t size() const { return mSize; }
+
+	/**
+	 * Checks if the trie is empty.
+	 */
+	bool empty() const { return mSize == 0; }
+
+private:
+
+	struct Node
+	{
+		Node() : parent(nullptr) {}
+
+		std::string label;
+		Node* parent;
+		std::map<char, std::unique_ptr<Node>> children;
+		std::unique_ptr<T> value;
+	};
+
+	Node mRoot;
+	size_t mSize;
+
+	static size_t commonLength(const std::string& label,
+							   const std::string& key, size_t pos)
+	{
+		size_t i = 0;
+
+		while (i < label.length() && pos + i < key.length() &&
+			   label[i] == key[pos + i])
+		{
+			i++;
+		}
+
+		return i;
+	}
+
+	static bool isBoundary(const std::string& path, size_t pos)
+	{
+		return pos == path.length() || path[pos] == '/' ||
+			   (pos > 0 && path[pos - 1] == '/');
+	}
+
+	Node* findNode(const std::string& key)
+	{
+		Node* node = &mRoot;
+		size_t pos = 0;
+
+		while (pos < key.length())
+		{
+			auto it = node->children.find(key[pos]);
+
+			if (it == node->children.end())
+			{
+				return nullptr;
+			}
+
+			node = it->second.get();
+
+			if (key.compare(pos, node->label.length(), node->label) != 0)
+			{
+				return nullptr;
+			}
+
+			pos += node->label.length();
+		}
+
+		return node;
+	}
+
+	void prune(Node* node)
+	{
+		while (node != &mRoot && !node->value)
+		{
+			Node* parent = node->parent;
+
+			if (node->children.empty())
+			{
+				parent->children.erase(node->label[0]);
+			}
+			else if (node->children.size() == 1)
+			{
+				auto& child = node->children.begin()->second;
+
+				child->label.insert(0, node->label);
+				child->parent = parent;
+
+				// moving the child releases the node itself
+				std::unique_ptr<Node> merged = std::move(child);
+
+				parent->children[merged->label[0]] = std::move(merged);
+			}
+			else
+			{
+				return;
+			}
+
+			node = parent;
+		}
+	}
+
+	template<typename Visitor>
+	void visitSubtree(Node* node, std::string& key, size_t prefixLength,
+					  Visitor& visitor)
+	{
+		if (node->value && (prefixLength == 0 ||
+							isBoundary(key, prefixLength)))
+		{
+			visitor(const_cast<const std::string&>(key), *node->value);
+		}
+
+		for (auto& child : node->children)
+		{
+			auto length = key.length();
+
+			key.append(child.second->label);
+
+			visitSubtree(child.second.get(), key, prefixLength, visitor);
+
+			key.resize(length);
+		}
+	}
+};
+
+}
+
+#endif /* XENBE_PATHTRIE_HPP_ */
@@ -21,17 +21,25 @@
 #ifndef XENBE_RINGBUFFERBASE_HPP_
 #define XENBE_RINGBUFFERBASE_HPP_
 
+#include <chrono>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <tuple>
+#include <vector>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xen/io/ring.h>
 }
 
+#include "BinaryLog.hpp"
+#include "XenCtrl.hpp"
 #include "XenEvtchn.hpp"
 #include "Exception.hpp"
 #include "XenGnttab.hpp"
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -44,8 +52,152 @@ class RingBufferException : public Exception
 	using Exception::Exception;
 };
 
+/***************************************************************************//**
+ * Event channel and grant table buffer of a ring buffer.
+ * @ingroup backend
+ ******************************************************************************/
+struct RingBufferResources
+{
+	/**
+	 * @param domId frontend domain id
+	 * @param port  event channel port number
+	 * @param ref   grant table reference
+	 */
+	RingBufferResources(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+		eventChannel(domId, port, nullptr),
+		buffer(domId, ref, PROT_READ | PROT_WRITE) {}
+
+	//! event channel bound to the frontend port
+	XenEvtchn eventChannel;
+	//! mapped ring page
+	XenGnttabBuffer buffer;
+};
+
+/***************************************************************************//**
+ * Keeps event channels and grant mappings of deleted ring buffers.
+ *
+ * When a frontend reconnects, e.g. after a guest driver reload, it usually
+ * publishes the same event channel port and grant reference again. If the
+ * grace period is set, resources of a deleted ring buffer are kept for this
+ * period and a new ring buffer with the same domain id, port and reference
+ * takes them instead of binding and mapping again. Resources which are not
+ * taken within the grace period are released.
+ *
+ * Reuse assumes the frontend keeps the grant and the port alive while
+ * reconnecting. Before the resources are reused, the cached event channel is
+ * checked to be still bound to the frontend domain and port. If the frontend
+ * has closed it, or the check isn't possible, the resources are dropped and
+ * new ones are created. A frontend which frees the grant should not be used
+ * with the cache. Resources of a destroyed domain are dropped by BackendBase.
+ *
+ * The cache is disabled by default.
+ * @ingroup backend
+ ******************************************************************************/
+class RingBufferCache
+{
+public:
+
+	/**
+	 * Cache statistics
+	 */
+	struct Stats
+	{
+		//! number of ring buffers created with cached resources
+		size_t hits;
+		//! number of ring buffers created with new resources
+		size_t misses;
+		//! number of cached resources released on the grace period expiration
+		size_t expired;
+		//! number of cached resources dropped as their event channel isn't
+		//! bound to the frontend port anymore
+		size_t dropped;
+	};
+
+	/**
+	 * Sets the grace period. 0 disables the cache and releases all cached
+	 * resources.
+	 * @param period grace period
+	 */
+	static void setGracePeriod(std::chrono::milliseconds period);
+
+	/**
+	 * Returns the grace period
+	 */
+	static std::chrono::milliseconds getGracePeriod();
+
+	/**
+	 * Releases cached resources of the domain
+	 * @param domId domain id
+	 */
+	static void clear(domid_t domId);
+
+	/**
+	 * Returns number of cached resources
+	 */
+	static size_t size();
+
+	/**
+	 * Returns cache statistics
+	 */
+	static Stats getStats();
+
+	/**
+	 * Returns cached resources or creates new ones
+	 * @param domId frontend domain id
+	 * @param port  event channel port number
+	 * @param ref   grant table reference
+	 */
+	static std::shared_ptr<RingBufferResources> take(domid_t domId,
+													 evtchn_port_t port,
+													 grant_ref_t ref);
+
+	/**
+	 * Puts resources to the cache. The resources are released if the cache
+	 * is disabled.
+	 * @param domId     frontend domain id
+	 * @param port      event channel port number
+	 * @param ref       grant table reference
+	 * @param resources resources
+	 */
+	static void put(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+					std::shared_ptr<RingBufferResources> resources);
+
+private:
+
+	typedef std::tuple<domid_t, evtchn_port_t, grant_ref_t> Key;
+
+	struct Entry
+	{
+		std::shared_ptr<RingBufferResources> resources;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	std::chrono::milliseconds mGracePeriod;
+	std::map<Key, Entry> mEntries;
+	Stats mStats;
+	std::mutex mMutex;
+	Log mLog;
+	// opened on the first reuse, null if it can't be opened
+	std::unique_ptr<XenInterface> mXenInterface;
+	bool mXenInterfaceOpened;
+	// should be destroyed first as it purges the entries
+	Timer mTimer;
+
+	RingBufferCache();
+
+	static RingBufferCache& getInstance();
+
+	void purge();
+	bool isBound(domid_t domId, evtchn_port_t port,
+				 const RingBufferResources& resources);
+};
+
 /***************************************************************************//**
  * Interface to implement custom ring buffer.
+ *
+ * The event channel and the grant table buffer are taken from
+ * RingBufferCache, thus they may survive the ring buffer when the cache is
+ * enabled.
  * @ingroup backend
  ******************************************************************************/
 class RingBufferBase
@@ -63,12 +215,13 @@ public:
 	/**
 	 * Starts ring buffer handling.
 	 */
-	void start();
+	virtual void start();
 
 	/**
-	 * Stops ring buffer handling.
+	 * Stops ring buffer handling. Derived classes which run operations
+	 * outside of the event channel thread may extend it to finish them.
 	 */
-	void stop();
+	virtual void stop();
 
 	/**
 	 * Returns event channel port.
@@ -95,20 +248,39 @@ protected:
 	 */
 	virtual void onReceiveIndication() = 0;
 
+	/**
+	 * Sets the callback of the file descriptor which is polled in the event
+	 * channel thread together with the event channel. Should be called while
+	 * the ring buffer is stopped.
+	 * @param fd       file descriptor
+	 * @param callback callback which is called in the event channel thread
+	 * when the file descriptor is readable, nullptr removes the file
+	 * descriptor
+	 */
+	void setFdCallback(int fd, XenEvtchn::Callback callback);
+
+private:
+
+	// should be initialized before the references below
+	std::shared_ptr<RingBufferResources> mResources;
+
+protected:
+
 	/**
 	 * Event channel.
 	 */
-	XenEvtchn mEventChannel;
+	XenEvtchn& mEventChannel;
 
 	/**
 	 * Grant table buffer.
 	 */
-	XenGnttabBuffer mBuffer;
+	XenGnttabBuffer& mBuffer;
 
 	Log mLog;
 
 private:
 
+	domid_t mDomId;
 	evtchn_port_t mPort;
 	grant_ref_t mRef;
 
@@ -116,30 +288,42 @@ private:
 };
 
 /***************************************************************************//**
- * Base class to create the custom input ring buffer (for handling requests
- * from the frontend).
- * RingBufferInBase is a template with arguments taken from PV driver protocol.
- * The arguments of the template are structures defined with Xen
- * DEFINE_RING_TYPES() macro from ring.h. Also the in ring buffer takes a remote
- * event channel number and a grant reference on which the ring buffer is
- * mapped. Xen event channel is used to notify the backend that a new request is
- * available in the ring buffer. When a new request is received,
- * processRequest() method is called. To send the response, the client should
- * call sendResponse() method.
+ * Base class to create the input ring buffer with static dispatch of requests.
  *
- * In order to create the in ring buffer the client should implement a class
- * inherited from RingBufferInBase and override processRequest() method.
+ * StaticRingBufferInBase is the same as RingBufferInBase but the derived
+ * class is passed as the first template argument (CRTP) and its
+ * processRequest() method is called directly, without virtual call. Thus the
+ * compiler may inline the request handling into the loop which consumes
+ * requests. processRequest() should be accessible from the base class:
+ * it should be public or the base class should be declared as friend.
  *
- * @snippet ExampleBackend.hpp ExampleInRingBuffer
+ * @code
+ * class MyRingBuffer : public XenBackend::StaticRingBufferInBase<
+ *                          MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *                          xentest_req, xentest_rsp>
+ * {
+ * public:
+ *     MyRingBuffer(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+ *         StaticRingBufferInBase(domId, port, ref) {}
  *
- * processRequest():
+ * private:
+ *     friend class XenBackend::StaticRingBufferInBase<
+ *         MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *         xentest_req, xentest_rsp>;
  *
- * @snippet ExampleBackend.cpp processRequest
+ *     void processRequest(const xentest_req& req) { ... sendResponse(rsp); }
+ * };
+ * @endcode
+ *
+ * The derived class may also define onRequestsProcessed() which is called
+ * when all pending requests are consumed, e.g. to submit the work collected
+ * by processRequest() in one batch.
  *
  * @ingroup backend
  ******************************************************************************/
-template<typename Ring, typename Page, typename Req, typename Rsp>
-class RingBufferInBase : public RingBufferBase
+template<typename Derived, typename Ring, typename Page, typename Req,
+		 typename Rsp>
+class StaticRingBufferInBase : public RingBufferBase
 {
 public:
 
@@ -149,8 +333,8 @@ public:
 	 * @param[in] ref      ring buffer ref number
 	 * @param[in] size ring buffer size
 	 */
-	RingBufferInBase(domid_t domId, evtchn_port_t port,
-					 grant_ref_t ref, int size = XC_PAGE_SIZE) :
+	StaticRingBufferInBase(domid_t domId, evtchn_port_t port,
+						   grant_ref_t ref, int size = XC_PAGE_SIZE) :
 		RingBufferBase(domId, port, ref)
 	{
 		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()), size);
@@ -158,14 +342,6 @@ public:
 
 protected:
 
-	/**
-	 * Processes frontend requests.
-	 * This function is called when the request from the frontend is received
-	 * and should be implemented in a derived class.
-	 * @param req request
-	 */
-	virtual void processRequest(const Req& req) = 0;
-
 	/**
 	 * Sends the response to the frontend
 	 * @param rsp response
@@ -186,11 +362,7 @@ protected:
 		}
 	}
 
-private:
-
-	Ring mRing;
-
-	void onReceiveIndication()
+	void onReceiveIndication() final
 	{
 		int numPendingRequests = 0;
 
@@ -221,12 +393,320 @@ private:
 
 				xen_mb();
 
-				processRequest(req);
+				static_cast<Derived*>(this)->processRequest(req);
 			}
 
 			RING_FINAL_CHECK_FOR_REQUESTS(&mRing, numPendingRequests);
 		}
 		while (numPendingRequests);
+
+		static_cast<Derived*>(this)->onRequestsProcessed();
+	}
+
+	/**
+	 * Is called when all pending requests are processed. Does nothing by
+	 * default, the derived class may hide it.
+	 */
+	void onRequestsProcessed() {}
+
+	/**
+	 * Returns number of requests in the ring buffer
+	 */
+	unsigned int getRingSize() const { return RING_SIZE(&mRing); }
+
+private:
+
+	Ring mRing;
+};
+
+/***************************************************************************//**
+ * Base class to create the custom input ring buffer (for handling requests
+ * from the frontend).
+ * RingBufferInBase is a template with arguments taken from PV driver protocol.
+ * The arguments of the template are structures defined with Xen
+ * DEFINE_RING_TYPES() macro from ring.h. Also the in ring buffer takes a remote
+ * event channel number and a grant reference on which the ring buffer is
+ * mapped. Xen event channel is used to notify the backend that a new request is
+ * available in the ring buffer. When a new request is received,
+ * processRequest() method is called. To send the response, the client should
+ * call sendResponse() method.
+ *
+ * In order to create the in ring buffer the client should implement a class
+ * inherited from RingBufferInBase and override processRequest() method.
+ *
+ * @snippet ExampleBackend.hpp ExampleInRingBuffer
+ *
+ * processRequest():
+ *
+ * @snippet ExampleBackend.cpp processRequest
+ *
+ * processRequest() is called virtually for each request. StaticRingBufferInBase
+ * may be used to avoid it.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Ring, typename Page, typename Req, typename Rsp>
+class RingBufferInBase : public StaticRingBufferInBase<
+		RingBufferInBase<Ring, Page, Req, Rsp>, Ring, Page, Req, Rsp>
+{
+public:
+
+	/**
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] size ring buffer size
+	 */
+	RingBufferInBase(domid_t domId, evtchn_port_t port,
+					 grant_ref_t ref, int size = XC_PAGE_SIZE) :
+		StaticRingBufferInBase<RingBufferInBase, Ring, Page, Req, Rsp>(
+				domId, port, ref, size) {}
+
+protected:
+
+	/**
+	 * Processes frontend requests.
+	 * This function is called when the request from the frontend is received
+	 * and should be implemented in a derived class.
+	 * @param req request
+	 */
+	virtual void processRequest(const Req& req) = 0;
+
+private:
+
+	friend class StaticRingBufferInBase<RingBufferInBase, Ring, Page, Req,
+										Rsp>;
+};
+
+/***************************************************************************//**
+ * Base class to create the input ring buffer with asynchronous handling of
+ * requests.
+ *
+ * For each request AsyncRingBufferInBase takes a Request object from a pool
+ * and calls processAsyncRequest() of the derived class (static dispatch). The
+ * request may be completed later, after processAsyncRequest() returns: the
+ * handler starts asynchronous operations (grant copies, XenStore reads, host
+ * I/O) and continues when they are done. complete() sends the response and
+ * returns the request to the pool. Thus the event channel thread is not
+ * blocked and many requests may be in flight.
+ *
+ * The frontend can't have more requests in flight than the ring buffer
+ * size, so the pool is allocated once with the ring buffer size: taking and
+ * completing requests doesn't allocate. The Context type holds the state of
+ * the request between the asynchronous steps, it is reset to Context() for
+ * each request.
+ *
+ * complete() should be called in the event channel thread. Operations which
+ * finish in other threads return to the event channel thread by post().
+ *
+ * stop() cancels the requests in flight: the posted functions are dropped
+ * and post() rejects new ones till start(). The threads which may call
+ * post() should be stopped before the ring buffer is deleted. Handlers
+ * written as C++20 coroutines are supported by RingBufferCoroutine.hpp.
+ *
+ * @code
+ * class MyRingBuffer : public XenBackend::AsyncRingBufferInBase<
+ *                          MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *                          xentest_req, xentest_rsp, MyContext>
+ * {
+ *     ...
+ *
+ * private:
+ *     friend class XenBackend::AsyncRingBufferInBase<
+ *         MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *         xentest_req, xentest_rsp, MyContext>;
+ *
+ *     void processAsyncRequest(Request& request)
+ *     {
+ *         auto req = &request;
+ *
+ *         // the callback is called in the AsyncXenStore thread
+ *         mXenStore.readString(path, [this, req](int error,
+ *                                                const std::string& value)
+ *         {
+ *             auto rsp = makeResponse(req->get(), error, value);
+ *
+ *             post([this, req, rsp] { complete(*req, rsp); });
+ *         });
+ *     }
+ * };
+ * @endcode
+ *
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Derived, typename Ring, typename Page, typename Req,
+		 typename Rsp, typename Context>
+class AsyncRingBufferInBase : public StaticRingBufferInBase<
+		Derived, Ring, Page, Req, Rsp>
+{
+public:
+
+	/**
+	 * Request in flight
+	 */
+	class Request
+	{
+	public:
+
+		/**
+		 * Returns the request received from the frontend
+		 */
+		const Req& get() const { return mReq; }
+
+		/**
+		 * Returns the state of the request
+		 */
+		Context& getContext() { return mContext; }
+
+	private:
+
+		friend class AsyncRingBufferInBase;
+
+		Req mReq;
+		Context mContext;
+		uint32_t mIndex;
+		bool mInFlight;
+	};
+
+	/**
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] size     ring buffer size
+	 */
+	AsyncRingBufferInBase(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+						  int size = XC_PAGE_SIZE) :
+		StaticRingBufferInBase<Derived, Ring, Page, Req, Rsp>(
+				domId, port, ref, size),
+		mRequests(this->getRingSize())
+	{
+		mFreeRequests.reserve(mRequests.size());
+
+		for (size_t index = 0; index < mRequests.size(); index++)
+		{
+			mRequests[index].mIndex = index;
+		}
+
+		resetRequests();
+
+		this->setFdCallback(mCalls.getFd(), [this] { mCalls.run(); });
+	}
+
+	/**
+	 * Stops the ring buffer and cancels the requests in flight
+	 */
+	~AsyncRingBufferInBase() { stop(); }
+
+	/**
+	 * Starts the ring buffer
+	 */
+	void start()
+	{
+		mCalls.start();
+
+		RingBufferBase::start();
+	}
+
+	/**
+	 * Stops the ring buffer and cancels the requests in flight: they are
+	 * not completed, the posted functions are dropped.
+	 */
+	void stop()
+	{
+		RingBufferBase::stop();
+
+		mCalls.stop();
+
+		resetRequests();
+	}
+
+	/**
+	 * Calls the function in the event channel thread. Thread safe.
+	 * @param call function
+	 * @return <i>false</i> if the ring buffer is stopped: the function is
+	 * dropped
+	 */
+	bool post(CallQueue::Call call) { return mCalls.post(std::move(call)); }
+
+	/**
+	 * Returns number of requests in flight. Should be called in the event
+	 * channel thread.
+	 */
+	size_t getNumPending() const
+	{
+		return mRequests.size() - mFreeRequests.size();
+	}
+
+protected:
+
+	/**
+	 * Sends the response and returns the request to the pool. Should be
+	 * called in the event channel thread.
+	 * @param request request
+	 * @param rsp     response
+	 */
+	void complete(Request& request, const Rsp& rsp)
+	{
+		if (!request.mInFlight)
+		{
+			throw RingBufferException("Request is already completed", EINVAL);
+		}
+
+		request.mInFlight = false;
+		mFreeRequests.push_back(request.mIndex);
+
+		this->sendResponse(rsp);
+	}
+
+private:
+
+	friend class StaticRingBufferInBase<Derived, Ring, Page, Req, Rsp>;
+
+	std::vector<Request> mRequests;
+	std::vector<uint32_t> mFreeRequests;
+	CallQueue mCalls;
+
+	void resetRequests()
+	{
+		mFreeRequests.clear();
+
+		for (auto index = mRequests.size(); index > 0; index--)
+		{
+			mRequests[index - 1].mInFlight = false;
+			mFreeRequests.push_back(index - 1);
+		}
+	}
+
+	void processRequest(const Req& req)
+	{
+		if (mFreeRequests.empty())
+		{
+			throw RingBufferException("No free requests", ENOMEM);
+		}
+
+		auto index = mFreeRequests.back();
+		auto& request = mRequests[index];
+
+		mFreeRequests.pop_back();
+
+		request.mReq = req;
+		request.mContext = Context();
+		request.mInFlight = true;
+
+		try
+		{
+			static_cast<Derived*>(this)->processAsyncRequest(request);
+		}
+		catch(const std::exception& e)
+		{
+			if (request.mInFlight)
+			{
+				request.mInFlight = false;
+				mFreeRequests.push_back(index);
+			}
+
+			throw;
+		}
 	}
 };
 
@@ -287,17 +767,18 @@ public:
 
 		if (static_cast<int>(mPage->in_prod - mPage->in_cons) >= mNumEvents)
 		{
-			LOG(mLog, WARNING) << "Ring buffer overflow, port: " << getPort()
-							   <<", prod: " << mPage->in_prod
-							   << ", cons: " << mPage->in_cons;
+			// overflow is caused by the frontend: limit the log rate
+			LOG_RATELIMIT(mLog, WARNING, 1000)
+				<< "Ring buffer overflow, port: " << getPort()
+				<<", prod: " << mPage->in_prod
+				<< ", cons: " << mPage->in_cons;
 
 			return;
 		}
 
-		LOG(mLog, DEBUG) << "Send event, port: " << getPort()
-						 <<", prod: " << mPage->in_prod
-						 << ", cons: " << mPage->in_cons
-						 << ", num events: " << mNumEvents;
+		BLOG(mLog, DEBUG, "Send event, port: {}, prod: {}, cons: {}, "
+			 "num events: {}", getPort(), mPage->in_prod, mPage->in_cons,
+			 mNumEvents);
 
 		mEventBuffer[mPage->in_prod % mNumEvents] = event;
 
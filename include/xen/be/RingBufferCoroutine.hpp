@@ -0,0 +1,293 @@
+/*
+ *  Coroutine request handlers
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_RINGBUFFERCOROUTINE_HPP_
+#define XENBE_RINGBUFFERCOROUTINE_HPP_
+
+/*
+ * The library is built as C++11: the header is empty unless the client is
+ * compiled with coroutine support.
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+//! defined if coroutine request handlers are supported
+#define XENBE_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "Log.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Return type of coroutines which handle requests of AsyncRingBufferInBase.
+ *
+ * The coroutine starts immediately and is not awaited by the caller:
+ * processAsyncRequest() starts it and returns on the first suspension. The
+ * coroutine is resumed in the event channel thread by the awaitables
+ * returned by resumeIn() and awaitCallback(), thus it may call complete()
+ * directly. If the ring buffer is stopped while the coroutine is suspended,
+ * the coroutine is destroyed instead of being resumed.
+ *
+ * Coroutine frames are cached per thread and reused by next requests, thus
+ * taking a request doesn't allocate in steady state.
+ *
+ * @code
+ * class MyRingBuffer : public XenBackend::AsyncRingBufferInBase<
+ *                          MyRingBuffer, xen_test_back_ring, xen_test_sring,
+ *                          xentest_req, xentest_rsp, MyContext>
+ * {
+ *     ...
+ *
+ *     void processAsyncRequest(Request& request) { handle(request); }
+ *
+ *     XenBackend::RequestTask handle(Request& request)
+ *     {
+ *         auto [error, value] = co_await XenBackend::awaitCallback<
+ *             int, std::string>(*this, [&](auto done)
+ *             { mXenStore.readString(path, done); });
+ *
+ *         complete(request, makeResponse(request.get(), error, value));
+ *     }
+ * };
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+class RequestTask
+{
+public:
+
+	/// @cond HIDDEN_SYMBOLS
+	struct promise_type
+	{
+		RequestTask get_return_object() { return RequestTask(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+
+		void unhandled_exception()
+		{
+			// nobody awaits the task: the error is logged
+			try
+			{
+				throw;
+			}
+			catch(const std::exception& e)
+			{
+				LOG("RequestTask", ERROR) << e.what();
+			}
+		}
+
+		static void* operator new(size_t size)
+		{
+			auto& frames = getFrames();
+
+			for (auto it = frames.begin(); it != frames.end(); ++it)
+			{
+				if (it->first == size)
+				{
+					auto frame = it->second;
+
+					frames.erase(it);
+
+					return frame;
+				}
+			}
+
+			return ::operator new(size);
+		}
+
+		static void operator delete(void* frame, size_t size)
+		{
+			auto& frames = getFrames();
+
+			if (frames.size() < cMaxCachedFrames)
+			{
+				frames.emplace_back(size, frame);
+			}
+			else
+			{
+				::operator delete(frame);
+			}
+		}
+	};
+	/// @endcond
+
+private:
+
+	static const size_t cMaxCachedFrames = 256;
+
+	struct FrameCache : public std::vector<std::pair<size_t, void*>>
+	{
+		~FrameCache()
+		{
+			for (auto& frame : *this)
+			{
+				::operator delete(frame.second);
+			}
+		}
+	};
+
+	static FrameCache& getFrames()
+	{
+		thread_local FrameCache sFrames;
+
+		return sFrames;
+	}
+};
+
+/// @cond HIDDEN_SYMBOLS
+namespace Coroutine {
+
+// owns the suspended coroutine till it is resumed: the coroutine is
+// destroyed if the posted function is dropped. It is move-only with noexcept
+// move, thus Delegate keeps it inline and resuming doesn't allocate.
+class Resumer
+{
+public:
+
+	explicit Resumer(std::coroutine_handle<> handle) noexcept :
+		mHandle(handle) {}
+	Resumer(Resumer&& other) noexcept :
+		mHandle(std::exchange(other.mHandle, nullptr)) {}
+	Resumer(const Resumer&) = delete;
+	Resumer& operator=(const Resumer&) = delete;
+
+	~Resumer()
+	{
+		if (mHandle)
+		{
+			mHandle.destroy();
+		}
+	}
+
+	void operator()() { std::exchange(mHandle, nullptr).resume(); }
+
+private:
+
+	std::coroutine_handle<> mHandle;
+};
+
+// resumes the coroutine in the event channel thread of the ring buffer or
+// destroys it if the ring buffer is stopped
+template<typename RingBuffer>
+void resume(RingBuffer& ringBuffer, std::coroutine_handle<> handle)
+{
+	ringBuffer.post(Resumer(handle));
+}
+
+template<typename RingBuffer>
+class ResumeAwaiter
+{
+public:
+
+	explicit ResumeAwaiter(RingBuffer& ringBuffer) : mRingBuffer(ringBuffer) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		resume(mRingBuffer, handle);
+	}
+	void await_resume() const noexcept {}
+
+private:
+
+	RingBuffer& mRingBuffer;
+};
+
+template<typename RingBuffer, typename Start, typename... Args>
+class CallbackAwaiter
+{
+public:
+
+	CallbackAwaiter(RingBuffer& ringBuffer, Start start) :
+		mRingBuffer(ringBuffer), mStart(std::move(start)) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		// the callback may be called in any thread, even before the start
+		// returns: the coroutine is resumed by the posted function
+		mStart(std::function<void(Args...)>(
+			[this, handle](Args... args)
+			{
+				mResult = std::make_tuple(std::move(args)...);
+
+				resume(mRingBuffer, handle);
+			}));
+	}
+
+	std::tuple<Args...> await_resume() { return std::move(mResult); }
+
+private:
+
+	RingBuffer& mRingBuffer;
+	Start mStart;
+	std::tuple<Args...> mResult;
+};
+
+}
+/// @endcond
+
+/**
+ * Returns the awaitable which resumes the coroutine in the event channel
+ * thread of the ring buffer. It is used to continue in the event channel
+ * thread after the coroutine is resumed in another thread.
+ * @param[in] ringBuffer ring buffer derived from AsyncRingBufferInBase
+ * @ingroup backend
+ */
+template<typename RingBuffer>
+Coroutine::ResumeAwaiter<RingBuffer> resumeIn(RingBuffer& ringBuffer)
+{
+	return Coroutine::ResumeAwaiter<RingBuffer>(ringBuffer);
+}
+
+/**
+ * Returns the awaitable which starts the asynchronous operation with the
+ * callback and resumes the coroutine in the event channel thread of the
+ * ring buffer when the callback is called. The arguments of the callback are
+ * returned by <i>co_await</i> as std::tuple.
+ * @param[in] ringBuffer ring buffer derived from AsyncRingBufferInBase
+ * @param[in] start      function which starts the operation, it takes
+ *                       std::function<void(Args...)> callback
+ * @ingroup backend
+ */
+template<typename... Args, typename RingBuffer, typename Start>
+Coroutine::CallbackAwaiter<RingBuffer, Start, Args...> awaitCallback(
+		RingBuffer& ringBuffer, Start start)
+{
+	return Coroutine::CallbackAwaiter<RingBuffer, Start, Args...>(
+			ringBuffer, std::move(start));
+}
+
+}
+
+#endif
+#endif
+
+#endif /* XENBE_RINGBUFFERCOROUTINE_HPP_ */
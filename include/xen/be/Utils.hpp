@@ -24,8 +24,11 @@
 #include <condition_variable>
 #include <functional>
 #include <list>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <poll.h>
 #include <unistd.h>
@@ -35,6 +38,9 @@ extern "C" {
 #include <xen/io/xenbus.h>
 }
 
+#include "Delegate.hpp"
+#include "Log.hpp"
+
 namespace XenBackend {
 
 /***************************************************************************//**
@@ -73,7 +79,8 @@ public:
  * for both: the defined file descriptor and the internal pipe file descriptor.
  * The internal pipe file descriptor breaks poll() when stop() method is
  * invoked. It is used to unblock poll() when an object using PollFd is been
- * deleted.
+ * deleted. Extra file descriptors may be added with addExtraFd() to wait for
+ * them in the same poll() call.
  * @ingroup backend
  ******************************************************************************/
 class PollFd
@@ -89,16 +96,43 @@ public:
 
 	/**
 	 * Polls the file descriptors for defined events
-	 * @return <i>true</i> if one of defined events occurred and <i>false</i>
-	 * if the method was interrupted by calling stop()
+	 * @param timeout poll timeout in milliseconds, -1 means infinite timeout
+	 * @return <i>true</i> if one of defined events occurred or the timeout
+	 * expired and <i>false</i> if the method was interrupted by calling stop()
 	 */
-	bool poll();
+	bool poll(int timeout = -1);
 
 	/**
 	 * Stops polling
 	 */
 	void stop();
 
+	/**
+	 * Adds the extra file descriptor which is polled together with the
+	 * defined one. If the file descriptor is already added, its events are
+	 * replaced.
+	 * @param fd     file descriptor
+	 * @param events events to poll (same as in system poll function)
+	 */
+	void addExtraFd(int fd, short int events);
+
+	/**
+	 * Removes the extra file descriptor
+	 * @param fd file descriptor
+	 */
+	void removeExtraFd(int fd);
+
+	/**
+	 * Returns events occurred on the defined file descriptor on last poll()
+	 */
+	short int getEvents() const { return mFds[PollIndex::FILE].revents; }
+
+	/**
+	 * Returns events occurred on the extra file descriptor on last poll()
+	 * @param fd file descriptor
+	 */
+	short int getExtraEvents(int fd) const;
+
 private:
 
 	enum PipeType
@@ -110,10 +144,12 @@ private:
 	enum PollIndex
 	{
 		FILE = 0,
-		PIPE = 1
+		PIPE = 1,
+		EXTRA = 2
 	};
 
-	pollfd mFds[2];
+	// extra file descriptors follow the pipe
+	std::vector<pollfd> mFds;
 	int mPipeFds[2];
 
 	void init(int fd, short int events);
@@ -159,6 +195,138 @@ private:
 	void run();
 };
 
+/***************************************************************************//**
+ * Queue of functions called in the thread which polls the queue.
+ *
+ * post() may be called from any thread. The file descriptor returned by
+ * getFd() becomes readable when there are posted functions and the thread
+ * polling it calls them by run(). It allows to continue the work started in
+ * other threads in one thread, e.g. in the event channel thread.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class CallQueue
+{
+public:
+
+	typedef Delegate<void()> Call;
+
+	CallQueue();
+	CallQueue(const CallQueue&) = delete;
+	CallQueue& operator=(const CallQueue&) = delete;
+	~CallQueue();
+
+	/**
+	 * Adds the function to be called by run(). Thread safe.
+	 * @param call function
+	 * @return <i>false</i> if the queue is stopped: the function is dropped
+	 */
+	bool post(Call call);
+
+	/**
+	 * Drops the posted functions and rejects new ones till start() is
+	 * called. Thread safe.
+	 */
+	void stop();
+
+	/**
+	 * Accepts posted functions again after stop(). Thread safe.
+	 */
+	void start();
+
+	/**
+	 * Calls the posted functions in the order they were posted
+	 * @return number of called functions
+	 */
+	size_t run();
+
+	/**
+	 * Returns the file descriptor which is readable when there are posted
+	 * functions
+	 */
+	int getFd() const { return mEventFd; }
+
+private:
+
+	int mEventFd;
+	bool mStopped;
+	std::mutex mMutex;
+	std::vector<Call> mCalls;
+	std::vector<Call> mRunning;
+};
+
+/***************************************************************************//**
+ * Implements pool of worker threads
+ *
+ * Functions are called on a bounded number of worker threads. Each function
+ * is called with a key: functions with the same key are called one by one in
+ * the order they were added, functions with different keys are called in
+ * parallel. Exceptions thrown by the functions are logged.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class WorkerPool
+{
+public:
+
+	typedef std::function<void()> Task;
+
+	/**
+	 * @param numWorkers number of worker threads. If 0, number of hardware
+	 *                   threads is used.
+	 */
+	explicit WorkerPool(size_t numWorkers = 0);
+	~WorkerPool();
+
+	/**
+	 * Calls all added functions and stops worker threads
+	 */
+	void stop();
+
+	/**
+	 * Adds a function to be called by a worker thread. Throws Exception if
+	 * the pool is stopped.
+	 * @param key  functions with the same key are serialized
+	 * @param task function
+	 */
+	void call(uint32_t key, Task task);
+
+	/**
+	 * Waits till all added functions are called
+	 */
+	void wait();
+
+	/**
+	 * Returns number of worker threads
+	 */
+	size_t getNumWorkers() const { return mThreads.size(); }
+
+private:
+
+	struct Queue
+	{
+		Queue() : running(false) {}
+
+		std::list<Task> tasks;
+		bool running;
+	};
+
+	bool mTerminate;
+	size_t mNumTasks;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::condition_variable mIdleCondVar;
+	std::vector<std::thread> mThreads;
+
+	std::unordered_map<uint32_t, Queue> mQueues;
+	// keys of queues which have tasks and are not running
+	std::list<uint32_t> mReadyQueues;
+
+	Log mLog;
+
+	void run();
+};
+
 /***************************************************************************//**
  * Implements timer
  *
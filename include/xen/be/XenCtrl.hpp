@@ -22,6 +22,9 @@
 #ifndef XENBE_XENCTRL_HPP_
 #define XENBE_XENCTRL_HPP_
 
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <vector>
 
 extern "C" {
@@ -30,6 +33,7 @@ extern "C" {
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -57,10 +61,19 @@ public:
 
 	/**
 	 * Returns all domains info
-	 * @param[out] infos
+	 * @param[out] infos domains info sorted by domain id. The vector capacity
+	 *                   is reused, thus passing the same vector avoids
+	 *                   allocations.
 	 */
 	void getDomainsInfo(std::vector<xc_domaininfo_t>& infos);
 
+	/**
+	 * Returns status of the local event channel
+	 * @param[in]  port   local event channel port
+	 * @param[out] status event channel status
+	 */
+	void getEvtchnStatus(evtchn_port_t port, xc_evtchn_status_t& status);
+
 private:
 
 	const int cDomInfoChunkSize = 64;
@@ -73,6 +86,141 @@ private:
 	void release();
 };
 
+/***************************************************************************//**
+ * Periodically samples resource usage of domains.
+ *
+ * Each period domains info is read and a sample is stored into the ring of
+ * the last samples of each domain. The samples may be used to prioritize or
+ * throttle frontends by activity of their domains. Query methods only copy
+ * already stored samples and don't read domains info.
+ *
+ * @code
+ * XenBackend::XenDomainSampler sampler;
+ *
+ * sampler.start();
+ *
+ * ...
+ *
+ * XenBackend::XenDomainSampler::Sample sample;
+ *
+ * if (sampler.getLatest(domId, sample) && sample.cpuUsage > 0.9)
+ * {
+ *     ...
+ * }
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenDomainSampler
+{
+public:
+
+	/**
+	 * Resource usage of the domain
+	 */
+	struct Sample
+	{
+		//! time of the sample
+		std::chrono::steady_clock::time_point time;
+		//! total CPU time of the domain in ns
+		uint64_t cpuTime;
+		//! CPU time used since the previous sample in ns
+		uint64_t cpuTimeDelta;
+		//! CPU time used since the previous sample per wall time: 1.0 means
+		//! one physical CPU is fully used
+		double cpuUsage;
+		//! number of online vCPUs
+		uint32_t numVcpus;
+		//! memory of the domain in bytes
+		uint64_t memory;
+		//! max memory of the domain in bytes
+		uint64_t maxMemory;
+	};
+
+	//! default number of stored samples per domain
+	static const size_t cDefaultNumSamples = 16;
+
+	/**
+	 * @param[in] period     sampling period
+	 * @param[in] numSamples number of stored samples per domain
+	 */
+	explicit XenDomainSampler(std::chrono::milliseconds period =
+							  std::chrono::milliseconds(1000),
+							  size_t numSamples = cDefaultNumSamples);
+	XenDomainSampler(const XenDomainSampler&) = delete;
+	XenDomainSampler& operator=(XenDomainSampler const&) = delete;
+	~XenDomainSampler();
+
+	/**
+	 * Starts periodic sampling
+	 */
+	void start();
+
+	/**
+	 * Stops periodic sampling
+	 */
+	void stop();
+
+	/**
+	 * Takes the sample of all domains now
+	 */
+	void sample();
+
+	/**
+	 * Returns ids of sampled domains
+	 */
+	std::vector<domid_t> getDomains();
+
+	/**
+	 * Gets the latest sample of the domain
+	 * @param[in]  domId  domain id
+	 * @param[out] sample latest sample
+	 * @return <i>false</i> if the domain is not sampled
+	 */
+	bool getLatest(domid_t domId, Sample& sample);
+
+	/**
+	 * Returns stored samples of the domain from the oldest to the latest
+	 * @param[in] domId domain id
+	 */
+	std::vector<Sample> getSamples(domid_t domId);
+
+	/**
+	 * Returns CPU usage of the domain averaged over the stored samples
+	 * @param[in] domId domain id
+	 */
+	double getAverageCpuUsage(domid_t domId);
+
+private:
+
+	struct Domain
+	{
+		xen_domain_handle_t handle;
+		// ring of samples: head is the next sample position
+		std::vector<Sample> samples;
+		size_t head;
+		size_t count;
+		uint64_t seen;
+	};
+
+	XenInterface mInterface;
+	std::chrono::milliseconds mPeriod;
+	size_t mNumSamples;
+	uint64_t mNumSampling;
+
+	std::mutex mMutex;
+	// domains info buffer is reused between samples
+	std::vector<xc_domaininfo_t> mInfos;
+	std::map<domid_t, Domain> mDomains;
+
+	Log mLog;
+
+	Timer mTimer;
+
+	void onTimer();
+	void addSample(Domain& domain, const xc_domaininfo_t& info,
+				   std::chrono::steady_clock::time_point time);
+};
+
 }
 
 #endif /* XENBE_XENCTRL_HPP_ */
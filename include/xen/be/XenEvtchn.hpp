@@ -24,6 +24,8 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <xenctrl.h>
@@ -78,7 +80,7 @@ public:
 	/**
 	 * Callback which is called when the event channel is notified
 	 */
-	typedef std::function<void()> Callback;
+	typedef Delegate<void()> Callback;
 
 	/**
 	 * @param[in] domId domain id
@@ -119,11 +121,36 @@ public:
 	 */
 	void setErrorCallback(ErrorCallback errorCallback);
 
+	/**
+	 * Sets callback. Should be called while the event channel is stopped.
+	 * @param callback callback which is called when the notification is
+	 * received
+	 */
+	void setCallback(Callback callback);
+
+	/**
+	 * Sets the callback of the file descriptor which is polled in the event
+	 * channel thread together with the event channel. Should be called while
+	 * the event channel is stopped.
+	 * @param fd       file descriptor
+	 * @param callback callback which is called in the event channel thread
+	 * when the file descriptor is readable, nullptr removes the file
+	 * descriptor
+	 */
+	void setFdCallback(int fd, Callback callback);
+
+	/**
+	 * Removes all file descriptors set by setFdCallback(). Should be called
+	 * while the event channel is stopped.
+	 */
+	void clearFdCallbacks();
+
 private:
 
 	xenevtchn_port_or_error_t mPort;
 	xenevtchn_handle *mHandle;
 	Callback mCallback;
+	std::vector<std::pair<int, Callback>> mFdCallbacks;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
 	Log mLog;
@@ -22,15 +22,29 @@
 #define XENBE_XENGNTTAB_HPP_
 
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xengnttab.h>
+#include <xen/grant_table.h>
 }
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -72,6 +86,94 @@ private:
 	xengnttab_handle* mHandle;
 };
 
+/***************************************************************************//**
+ * Deferred grant unmapping.
+ * By default grant table buffers are unmapped synchronously when deleted.
+ * Each unmap costs a TLB shootdown on the deleting (request processing)
+ * thread. When the queue is enabled, deleted mappings are unmapped by the
+ * background thread in batches: once the oldest mapping waits longer than
+ * the max delay or number of pending pages exceeds the page budget.
+ *
+ * Only mappings which are not used anymore are queued: a buffer is queued
+ * when it is deleted, thus shared buffers are queued when the last owner
+ * releases them. The queued memory should not be accessed.
+ * @code
+ * XenGnttabUnmapQueue::enable(std::chrono::milliseconds(10), 1024);
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabUnmapQueue
+{
+public:
+
+	/**
+	 * Enables deferred unmapping
+	 * @param[in] maxDelay max time a mapping waits for unmapping
+	 * @param[in] maxPages max number of pending pages
+	 */
+	static void enable(std::chrono::milliseconds maxDelay, size_t maxPages);
+
+	/**
+	 * Disables deferred unmapping and unmaps all pending mappings
+	 */
+	static void disable();
+
+	/**
+	 * Unmaps all pending mappings
+	 */
+	static void flush();
+
+	/**
+	 * Returns <i>true</i> if deferred unmapping is enabled
+	 */
+	static bool isEnabled() { return sEnabled; }
+
+	/**
+	 * Returns number of pages waiting for unmapping
+	 */
+	static size_t getNumPendingPages();
+
+	/**
+	 * Unmaps the mapping or queues it if deferred unmapping is enabled
+	 * @param[in] handle  grant table handle
+	 * @param[in] address mapped address
+	 * @param[in] count   number of mapped pages
+	 */
+	static void unmap(xengnttab_handle* handle, void* address, size_t count);
+
+private:
+
+	struct Mapping
+	{
+		xengnttab_handle* handle;
+		void* address;
+		size_t count;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	static std::atomic_bool sEnabled;
+
+	std::chrono::milliseconds mMaxDelay;
+	size_t mMaxPages;
+	size_t mNumPages;
+	bool mTerminate;
+	std::list<Mapping> mMappings;
+	std::mutex mMutex;
+	std::mutex mItfMutex;
+	std::condition_variable mCondVar;
+	std::thread mThread;
+	Log mLog;
+
+	XenGnttabUnmapQueue();
+	~XenGnttabUnmapQueue();
+
+	static XenGnttabUnmapQueue& getInstance();
+
+	void stop();
+	void run();
+	void unmapAll(std::list<Mapping>& mappings);
+};
+
 /***************************************************************************//**
  * Gran table buffer.
  * XenGnttabBuffer instance maps grant table reference(s) into local linear
@@ -138,6 +240,440 @@ private:
 	void release();
 };
 
+/***************************************************************************//**
+ * Segment of granted page.
+ * @ingroup xen
+ ******************************************************************************/
+struct XenGnttabSegment
+{
+	//! grant reference id
+	grant_ref_t ref;
+	//! offset of the data inside the page
+	size_t offset;
+	//! data size, the data should not cross the page boundary
+	size_t len;
+};
+
+/***************************************************************************//**
+ * Scatter-gather grant table buffer.
+ * XenGnttabSgBuffer maps pages of all segments with one call and exposes the
+ * segment data as an iovec array, thus the data can be passed to writev(),
+ * sendmsg() etc. without copying. Segments which are contiguous in the
+ * mapping (one ends at the page end and the next one starts at the next page
+ * beginning) are merged into one iovec.
+ * @code
+ * std::vector<XenGnttabSegment> segments;
+ *
+ * for (int i = 0; i < req.nr_segments; i++)
+ * {
+ *     segments.push_back({req.seg[i].ref, req.seg[i].offset,
+ *                         req.seg[i].len});
+ * }
+ *
+ * XenGnttabSgBuffer buffer(domId, segments);
+ *
+ * writev(fd, buffer.getIov(), buffer.getIovCount());
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabSgBuffer
+{
+public:
+
+	/**
+	 * @param[in] domId    domain id
+	 * @param[in] segments segments
+	 * @param[in] prot     same flag as in mmap()
+	 */
+	XenGnttabSgBuffer(domid_t domId,
+					  const std::vector<XenGnttabSegment>& segments,
+					  int prot = PROT_READ | PROT_WRITE);
+	XenGnttabSgBuffer(const XenGnttabSgBuffer&) = delete;
+	XenGnttabSgBuffer& operator=(XenGnttabSgBuffer const&) = delete;
+
+	/**
+	 * Returns iovec array
+	 */
+	const iovec* getIov() const { return mIov.data(); }
+
+	/**
+	 * Returns number of iovec entries
+	 */
+	size_t getIovCount() const { return mIov.size(); }
+
+	/**
+	 * Returns iterator to the first iovec entry
+	 */
+	std::vector<iovec>::const_iterator begin() const { return mIov.begin(); }
+
+	/**
+	 * Returns iterator after the last iovec entry
+	 */
+	std::vector<iovec>::const_iterator end() const { return mIov.end(); }
+
+	/**
+	 * Returns total data size
+	 */
+	size_t size() const { return mSize; }
+
+private:
+
+	std::unique_ptr<XenGnttabBuffer> mBuffer;
+	std::vector<iovec> mIov;
+	size_t mSize;
+
+	void init(domid_t domId, const std::vector<XenGnttabSegment>& segments,
+			  int prot);
+};
+
+/***************************************************************************//**
+ * Persistent grant mapping cache.
+ * XenGnttabCache keeps single page mappings of frequently used data buffers,
+ * thus the request processing doesn't map and unmap the same grant reference
+ * for each request. Mappings are kept in least recently used order per domain.
+ * When number of the domain mapped pages exceeds the budget, the least
+ * recently used mapping is evicted. An evicted buffer is unmapped when the
+ * last user releases it.
+ *
+ * The frontend should keep the cached references granted (persistent grants).
+ * Once the reference is revoked, it should be removed from the cache.
+ * @code
+ * XenGnttabCache cache(256);
+ *
+ * auto buffer = cache.get(domId, req.ref);
+ *
+ * memcpy(data, buffer->get(), size);
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabCache
+{
+public:
+
+	/**
+	 * Cache statistics
+	 */
+	struct Stats
+	{
+		//! number of requests served by cached mappings
+		size_t hits;
+		//! number of requests which mapped the reference
+		size_t misses;
+		//! number of mappings evicted due to the page budget
+		size_t evictions;
+	};
+
+	/**
+	 * @param[in] maxPages max number of mapped pages per domain
+	 * @param[in] prot     same flag as in mmap()
+	 */
+	explicit XenGnttabCache(size_t maxPages,
+							int prot = PROT_READ | PROT_WRITE);
+	XenGnttabCache(const XenGnttabCache&) = delete;
+	XenGnttabCache& operator=(XenGnttabCache const&) = delete;
+
+	/**
+	 * Returns mapped buffer of the grant reference. Maps the reference if it
+	 * is not cached.
+	 * @param[in] domId domain id
+	 * @param[in] ref   grant reference id
+	 */
+	std::shared_ptr<XenGnttabBuffer> get(domid_t domId, grant_ref_t ref);
+
+	/**
+	 * Removes the grant reference from the cache
+	 * @param[in] domId domain id
+	 * @param[in] ref   grant reference id
+	 */
+	void remove(domid_t domId, grant_ref_t ref);
+
+	/**
+	 * Removes all grant references of the domain from the cache
+	 * @param[in] domId domain id
+	 */
+	void clear(domid_t domId);
+
+	/**
+	 * Returns number of cached pages of the domain
+	 * @param[in] domId domain id
+	 */
+	size_t size(domid_t domId);
+
+	/**
+	 * Returns cache statistics
+	 */
+	Stats getStats();
+
+private:
+
+	struct Entry
+	{
+		grant_ref_t ref;
+		std::shared_ptr<XenGnttabBuffer> buffer;
+	};
+
+	struct Domain
+	{
+		// most recently used first
+		std::list<Entry> entries;
+		std::unordered_map<grant_ref_t, std::list<Entry>::iterator> index;
+	};
+
+	size_t mMaxPages;
+	int mProt;
+	Stats mStats;
+	std::unordered_map<domid_t, Domain> mDomains;
+	std::mutex mMutex;
+	Log mLog;
+};
+
+/***************************************************************************//**
+ * Batch of grant references mapped with one call.
+ * XenGnttabBatch collects grant references of many requests, e.g. during
+ * one ring pass, and maps all of them with one grant table call. Then each
+ * request gets its own view of the batch buffer. All references are unmapped
+ * at once when the batch is completed. It amortizes the mapping and the TLB
+ * flush cost across the batch. If the batch call fails, e.g. one of the
+ * references is invalid, each request is mapped on its own, thus one bad
+ * request doesn't fail the others: isMapped() tells which requests are
+ * mapped.
+ * @code
+ * XenGnttabBatch batch(domId);
+ *
+ * for (auto& req : requests)
+ * {
+ *     req.index = batch.add(req.refs, req.count);
+ * }
+ *
+ * batch.map();
+ *
+ * for (auto& req : requests)
+ * {
+ *     processRequest(req, batch.get(req.index), batch.size(req.index));
+ * }
+ *
+ * batch.unmap();
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabBatch
+{
+public:
+
+	/**
+	 * @param[in] domId domain id
+	 * @param[in] prot  same flag as in mmap()
+	 */
+	explicit XenGnttabBatch(domid_t domId, int prot = PROT_READ | PROT_WRITE);
+	XenGnttabBatch(const XenGnttabBatch&) = delete;
+	XenGnttabBatch& operator=(XenGnttabBatch const&) = delete;
+	~XenGnttabBatch();
+
+	/**
+	 * Adds grant references of the request. Should be called before map().
+	 * @param[in] refs  array of grant reference ids
+	 * @param[in] count number of grant reference ids
+	 * @return request index
+	 */
+	size_t add(const grant_ref_t* refs, size_t count);
+
+	/**
+	 * Adds grant reference of the request. Should be called before map().
+	 * @param[in] ref grant reference id
+	 * @return request index
+	 */
+	size_t add(grant_ref_t ref) { return add(&ref, 1); }
+
+	/**
+	 * Maps all added grant references. Throws if no request can be mapped.
+	 */
+	void map();
+
+	/**
+	 * Unmaps all grant references and removes them from the batch
+	 */
+	void unmap();
+
+	/**
+	 * Returns pointer to the mapped buffer of the request. Throws if the
+	 * request is not mapped.
+	 * @param[in] index request index
+	 */
+	void* get(size_t index) const;
+
+	/**
+	 * Returns size of the mapped buffer of the request
+	 * @param[in] index request index
+	 */
+	size_t size(size_t index) const;
+
+	/**
+	 * Returns number of requests in the batch
+	 */
+	size_t getNumRequests() const { return mRequests.size(); }
+
+	/**
+	 * Returns number of pages in the batch
+	 */
+	size_t getNumPages() const { return mRefs.size(); }
+
+	/**
+	 * Returns <i>true</i> if the batch is mapped
+	 */
+	bool isMapped() const { return mMapped; }
+
+	/**
+	 * Returns <i>true</i> if the request is mapped
+	 * @param[in] index request index
+	 */
+	bool isMapped(size_t index) const;
+
+private:
+
+	struct Request
+	{
+		size_t offset;
+		size_t count;
+		// own mapping if the batch call failed
+		void* buffer;
+		int error;
+	};
+
+	domid_t mDomId;
+	int mProt;
+	bool mMapped;
+	void* mBuffer;
+	xengnttab_handle* mHandle;
+	GrantRefs mRefs;
+	std::vector<Request> mRequests;
+	Log mLog;
+
+	const Request& getRequest(size_t index) const;
+	bool mapRequests();
+};
+
+/***************************************************************************//**
+ * Batch of grant copy segments.
+ * XenGnttabCopy collects copy segments between local memory and foreign
+ * grant references in both directions and performs all of them with one
+ * grant table call. Each segment gets its own status. For small payloads
+ * copying is cheaper than mapping and unmapping the pages: isPreferred()
+ * tells which one to use for the payload size.
+ * @code
+ * XenGnttabCopy copy(domId);
+ *
+ * auto index = copy.copyFrom(req.ref, req.offset, data, req.size);
+ *
+ * copy.copy();
+ *
+ * if (copy.getStatus(index) != GNTST_okay)
+ * {
+ *     ...
+ * }
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabCopy
+{
+public:
+
+	/**
+	 * Default payload size up to which copying is preferred over mapping
+	 */
+	static const size_t cDefaultThreshold = XC_PAGE_SIZE;
+
+	/**
+	 * @param[in] domId domain id
+	 */
+	explicit XenGnttabCopy(domid_t domId);
+	XenGnttabCopy(const XenGnttabCopy&) = delete;
+	XenGnttabCopy& operator=(XenGnttabCopy const&) = delete;
+
+	/**
+	 * Adds segment to copy from the foreign grant reference to local memory.
+	 * The segment should not cross the page boundary.
+	 * @param[in]  ref    grant reference id
+	 * @param[in]  offset offset inside the granted page
+	 * @param[out] dst    local memory
+	 * @param[in]  len    number of bytes to copy
+	 * @return segment index
+	 */
+	size_t copyFrom(grant_ref_t ref, size_t offset, void* dst, size_t len);
+
+	/**
+	 * Adds segment to copy from local memory to the foreign grant reference.
+	 * The segment should not cross the page boundary.
+	 * @param[in] ref    grant reference id
+	 * @param[in] offset offset inside the granted page
+	 * @param[in] src    local memory
+	 * @param[in] len    number of bytes to copy
+	 * @return segment index
+	 */
+	size_t copyTo(grant_ref_t ref, size_t offset, const void* src,
+				  size_t len);
+
+	/**
+	 * Copies all added segments. Throws if the grant table call fails,
+	 * errors of segments are reported by getStatus().
+	 */
+	void copy();
+
+	/**
+	 * Returns status of the copied segment: GNTST_okay or GNTST_* error
+	 * @param[in] index segment index
+	 */
+	int getStatus(size_t index) const;
+
+	/**
+	 * Returns <i>true</i> if all copied segments succeeded
+	 */
+	bool isSucceeded() const;
+
+	/**
+	 * Returns number of segments
+	 */
+	size_t getNumSegments() const { return mSegments.size(); }
+
+	/**
+	 * Removes all segments
+	 */
+	void clear() { mSegments.clear(); }
+
+	/**
+	 * Sets payload size up to which copying is preferred over mapping
+	 * @param[in] threshold size in bytes
+	 */
+	static void setThreshold(size_t threshold) { sThreshold = threshold; }
+
+	/**
+	 * Returns payload size up to which copying is preferred over mapping
+	 */
+	static size_t getThreshold() { return sThreshold; }
+
+	/**
+	 * Returns <i>true</i> if the payload should be copied rather than mapped
+	 * @param[in] size payload size in bytes
+	 */
+	static bool isPreferred(size_t size) { return size <= sThreshold; }
+
+private:
+
+	static std::atomic<size_t> sThreshold;
+
+	domid_t mDomId;
+	xengnttab_handle* mHandle;
+	std::vector<xengnttab_grant_copy_segment_t> mSegments;
+	Log mLog;
+
+	xengnttab_grant_copy_segment_t& addSegment(size_t offset, size_t len);
+};
+
 /***************************************************************************//**
  * Create a DMA buffer for grant reference(s) provided.
  * XenGnttabDmaBufferExporter maps foreign grant table reference(s)
@@ -164,10 +700,34 @@ public:
 	XenGnttabDmaBufferExporter(domid_t domId, const GrantRefs &refs,
 							   size_t offset = 0);
 
+	/**
+	 * Callback which is called when the DMA buffer is released
+	 * @param[in] result 0 on success, -1 on error or timeout
+	 */
+	typedef std::function<void(int result)> ReleaseCallback;
+
 	int getFd() const { return mDmaBufFd; }
 
+	/**
+	 * Closes the DMA buffer and waits for it is released by all importers.
+	 * The grant device identifies the buffer by its fd number, thus the
+	 * number stays reserved by a placeholder till the wait is finished and
+	 * can't be taken by a new export meanwhile.
+	 * @param[in] timeoutMs wait timeout in milliseconds
+	 * @return 0 on success, -1 on error or timeout
+	 */
 	int waitForReleased(int timeoutMs);
 
+	/**
+	 * Closes the DMA buffer and waits for it is released by all importers
+	 * in the background. Doesn't block the caller. The exporter may be
+	 * deleted before the callback is called. The fd number stays reserved
+	 * till the wait is finished as in waitForReleased().
+	 * @param[in] callback  called when the buffer is released or on timeout
+	 * @param[in] timeoutMs wait timeout in milliseconds
+	 */
+	void waitForReleasedAsync(ReleaseCallback callback, int timeoutMs);
+
 	XenGnttabDmaBufferExporter(const XenGnttabDmaBufferExporter&) =
 			delete;
 	XenGnttabDmaBufferExporter& operator=(XenGnttabDmaBufferExporter const&) =
@@ -175,14 +735,116 @@ public:
 	~XenGnttabDmaBufferExporter();
 
 private:
+	// number of threads waiting for release asynchronously
+	static const size_t cNumReleaseWorkers = 2;
+
 	int mDmaBufFd;
 	xengnttab_handle* mHandle;
 	Log mLog;
 
+	static WorkerPool& getReleasePool();
+	static int getPlaceholderFd();
+	static int waitReleased(xengnttab_handle* handle, int fd, int timeoutMs);
+
 	void init(domid_t domId, const GrantRefs &refs, size_t offset);
+	int detach();
 	void release();
 };
 
+/***************************************************************************//**
+ * Pool of DMA buffer exporters.
+ * Display backends reuse the same framebuffers every frame. The pool keeps
+ * exporters keyed by domain id, grant references and offset, thus the
+ * framebuffer is exported only once. When the frontend destroys the buffer,
+ * it should be removed from the pool: the removed exporter is released
+ * asynchronously.
+ * @code
+ * XenGnttabDmaBufferPool pool;
+ *
+ * auto exporter = pool.get(domId, refs);
+ *
+ * display(exporter->getFd());
+ *
+ * ...
+ *
+ * pool.remove(domId, refs);
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabDmaBufferPool
+{
+public:
+
+	typedef std::shared_ptr<XenGnttabDmaBufferExporter> ExporterPtr;
+
+	/**
+	 * Pool statistics
+	 */
+	struct Stats
+	{
+		//! number of requests served by pooled exporters
+		size_t hits;
+		//! number of requests which exported the buffer
+		size_t misses;
+	};
+
+	/**
+	 * @param[in] releaseTimeoutMs timeout to wait for release of removed
+	 *                             exporters
+	 */
+	explicit XenGnttabDmaBufferPool(int releaseTimeoutMs = 3000);
+	XenGnttabDmaBufferPool(const XenGnttabDmaBufferPool&) = delete;
+	XenGnttabDmaBufferPool& operator=(XenGnttabDmaBufferPool const&) = delete;
+	~XenGnttabDmaBufferPool();
+
+	/**
+	 * Returns pooled exporter or exports the buffer
+	 * @param[in] domId  domain id
+	 * @param[in] refs   grant references
+	 * @param[in] offset offset of the data inside the buffer
+	 */
+	ExporterPtr get(domid_t domId, const GrantRefs& refs, size_t offset = 0);
+
+	/**
+	 * Removes the exporter from the pool and releases it asynchronously.
+	 * The removed exporter should not be used.
+	 * @param[in] domId    domain id
+	 * @param[in] refs     grant references
+	 * @param[in] offset   offset of the data inside the buffer
+	 * @param[in] callback called when the buffer is released
+	 */
+	void remove(domid_t domId, const GrantRefs& refs, size_t offset = 0,
+				XenGnttabDmaBufferExporter::ReleaseCallback callback =
+						nullptr);
+
+	/**
+	 * Removes all exporters of the domain and releases them asynchronously
+	 * @param[in] domId domain id
+	 */
+	void clear(domid_t domId);
+
+	/**
+	 * Returns number of pooled exporters
+	 */
+	size_t size();
+
+	/**
+	 * Returns pool statistics
+	 */
+	Stats getStats();
+
+private:
+
+	typedef std::tuple<domid_t, size_t, GrantRefs> Key;
+
+	int mReleaseTimeoutMs;
+	Stats mStats;
+	std::map<Key, ExporterPtr> mExporters;
+	std::mutex mMutex;
+	Log mLog;
+};
+
 /***************************************************************************//**
  * Grant references for the pages of a DMA buffer.
  * XenGnttabDmaBufferImporter grants reference(s) and exports those for
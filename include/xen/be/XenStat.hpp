@@ -21,6 +21,9 @@
 #ifndef XENBE_XENSTAT_HPP_
 #define XENBE_XENSTAT_HPP_
 
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <vector>
 
 #include "Exception.hpp"
@@ -40,12 +43,49 @@ class XenStatException : public Exception
 
 /***************************************************************************//**
  * Provides different Xen domains statistics.
+ *
+ * Domains info is read into the cached snapshot which is refreshed not often
+ * than the refresh period. Each refresh which detects added or removed domains
+ * increments the snapshot generation. The client may keep the generation
+ * and get domains added or removed since it:
+ *
+ * @code
+ * XenBackend::XenStat xenStat(std::chrono::milliseconds(500));
+ * uint64_t generation = 0;
+ *
+ * ...
+ *
+ * auto newGeneration = xenStat.getGeneration();
+ *
+ * for (auto domId : xenStat.domainsAdded(generation))
+ * {
+ *     ...
+ * }
+ *
+ * for (auto domId : xenStat.domainsRemoved(generation))
+ * {
+ *     ...
+ * }
+ *
+ * generation = newGeneration;
+ * @endcode
+ *
+ * A domain which is removed and created again with the same id since the
+ * generation is reported in both lists, even if it is recreated between two
+ * refreshes: the domains are compared by the handle.
  * @ingroup xen
  ******************************************************************************/
 class XenStat
 {
 public:
-	XenStat();
+
+	/**
+	 * @param[in] refreshPeriod minimal period between refreshes of domains
+	 *                          info. If 0, domains info is refreshed on each
+	 *                          call.
+	 */
+	explicit XenStat(std::chrono::milliseconds refreshPeriod =
+					 std::chrono::milliseconds(0));
 	~XenStat();
 
 	/**
@@ -58,10 +98,68 @@ public:
 	 */
 	std::vector<domid_t> getExistingDoms();
 
+	/**
+	 * Sets minimal period between refreshes of domains info
+	 * @param[in] refreshPeriod refresh period
+	 */
+	void setRefreshPeriod(std::chrono::milliseconds refreshPeriod);
+
+	/**
+	 * Refreshes domains info regardless of the refresh period
+	 */
+	void refresh();
+
+	/**
+	 * Returns generation of domains info. Domains info is refreshed if the
+	 * refresh period is expired.
+	 */
+	uint64_t getGeneration();
+
+	/**
+	 * Returns ids of existing domains added since the generation. Domains info
+	 * is not refreshed.
+	 * @param[in] generation generation returned by getGeneration()
+	 */
+	std::vector<domid_t> domainsAdded(uint64_t generation);
+
+	/**
+	 * Returns ids of domains removed since the generation. Domains info is
+	 * not refreshed.
+	 * @param[in] generation generation returned by getGeneration()
+	 */
+	std::vector<domid_t> domainsRemoved(uint64_t generation);
+
 private:
 
+	struct DomainRecord
+	{
+		//! generation in which the domain is added
+		uint64_t added;
+		//! generation in which the domain is removed last time
+		uint64_t removed;
+		//! refresh in which the domain is seen last time
+		uint64_t seen;
+		bool exists;
+		//! distinguishes the domain from one created again with the same id
+		xen_domain_handle_t handle;
+	};
+
 	XenInterface mInterface;
+	std::mutex mMutex;
+
+	std::chrono::milliseconds mRefreshPeriod;
+	std::chrono::steady_clock::time_point mLastRefresh;
+	bool mValid;
+	uint64_t mNumRefreshes;
+	uint64_t mGeneration;
+
+	// last domains info, the buffer is reused between refreshes
+	std::vector<xc_domaininfo_t> mInfos;
+	std::map<domid_t, DomainRecord> mDomains;
+
 	Log mLog;
+
+	void update(bool force);
 };
 
 }
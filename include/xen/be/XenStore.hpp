@@ -22,12 +22,15 @@
 #define XENBE_XENSTORE_HPP_
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <thread>
-#include <unordered_map>
 #include <vector>
 
 extern "C" {
@@ -37,6 +40,7 @@ extern "C" {
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "PathTrie.hpp"
 #include "Utils.hpp"
 
 namespace XenBackend {
@@ -50,8 +54,140 @@ class XenStoreException : public Exception
 	using Exception::Exception;
 };
 
+/***************************************************************************//**
+ * Xen store subtree read by AsyncXenStore::readTree().
+ *
+ * All keys and values of the subtree are kept as zero terminated strings in
+ * one contiguous buffer, thus the tree takes two allocations regardless of
+ * the number of entries. Keys are relative to the tree path: the empty key is
+ * the tree path itself, <i>ring/port</i> is <i>&lt;path&gt;/ring/port</i>.
+ * @ingroup xen
+ ******************************************************************************/
+class XenStoreTree
+{
+public:
+
+	XenStoreTree() {}
+
+	/**
+	 * Returns the path of the subtree root.
+	 */
+	const std::string& getPath() const { return mPath; }
+
+	/**
+	 * Returns number of entries including the root.
+	 */
+	size_t size() const { return mEntries.size(); }
+
+	/**
+	 * Checks if the tree is empty.
+	 */
+	bool empty() const { return mEntries.empty(); }
+
+	/**
+	 * Returns the key of the entry. Entries are sorted by key.
+	 * @param index entry index
+	 */
+	const char* getKey(size_t index) const
+	{
+		return &mArena[mEntries[index].key];
+	}
+
+	/**
+	 * Returns the value of the entry.
+	 * @param index entry index
+	 */
+	const char* getValue(size_t index) const
+	{
+		return &mArena[mEntries[index].value];
+	}
+
+	/**
+	 * Checks if the entry exists.
+	 * @param key relative path of the entry
+	 */
+	bool checkIfExist(const std::string& key) const
+	{
+		return findValue(key.c_str()) != nullptr;
+	}
+
+	/**
+	 * Returns the value of the entry or <i>nullptr</i> if it doesn't exist.
+	 * @param key relative path of the entry
+	 */
+	const char* findValue(const char* key) const;
+
+	/**
+	 * Returns the value of the entry or <i>nullptr</i> if it doesn't exist.
+	 * @param key relative path of the entry
+	 */
+	const char* findValue(const std::string& key) const
+	{
+		return findValue(key.c_str());
+	}
+
+	/**
+	 * Reads the entry as integer.
+	 * @param key relative path of the entry
+	 */
+	int readInt(const std::string& key) const;
+
+	/**
+	 * Reads the entry as unsigned integer.
+	 * @param key relative path of the entry
+	 */
+	unsigned int readUint(const std::string& key) const;
+
+	/**
+	 * Reads the entry as string.
+	 * @param key relative path of the entry
+	 */
+	std::string readString(const std::string& key) const;
+
+	/**
+	 * Returns names of the entry children.
+	 * @param key relative path of the entry
+	 */
+	std::vector<std::string> readDirectory(const std::string& key) const;
+
+private:
+
+	friend class AsyncXenStore;
+
+	struct Entry
+	{
+		size_t key;
+		size_t value;
+	};
+
+	std::string mPath;
+	std::vector<char> mArena;
+	std::vector<Entry> mEntries;
+
+	void clear();
+	void append(const std::string& key, const char* value, size_t length);
+	void sort();
+	const char* getEntryKey(const Entry& entry) const
+	{
+		return &mArena[entry.key];
+	}
+};
+
 /***************************************************************************//**
  * Provides Xen Store functionality.
+ *
+ * Watches are kept in a radix trie indexed by the watched path. Each Xen store
+ * event is routed by the path which actually fired to all watches whose path
+ * is a parent of (or equal to) the fired path. When a watch is set from a
+ * watch callback and one of its parents is already watched, the new watch is
+ * served by the parent's Xen store watch and no additional watch is
+ * registered in Xen store. Thus one subtree watch replaces many per-key
+ * watches.
+ *
+ * A watch set by setCoalescedWatch() doesn't fire on each Xen store event.
+ * Events are collected per watch and the callback is called once with the set
+ * of changed paths: either at the end of the dispatch pass which handles all
+ * events queued at the moment, or when the defined time window expires.
  * @ingroup xen
  ******************************************************************************/
 class XenStore
@@ -59,9 +195,18 @@ class XenStore
 public:
 
 	/**
-	 * Callback which is called when the watch is triggered
+	 * Callback which is called when the watch is triggered. The callback
+	 * receives the path which has fired: the watched path itself or one of
+	 * its children.
 	 */
-	typedef std::function<void(const std::string& path)> WatchCallback;
+	typedef Delegate<void(const std::string& path)> WatchCallback;
+
+	/**
+	 * Callback which is called when the coalesced watch is triggered. The
+	 * callback receives sorted paths which have fired since the last call.
+	 */
+	typedef Delegate<void(const std::vector<std::string>& paths)>
+		CoalescedWatchCallback;
 
 	/**
 	 * @param errorCallback callback called on XS watches error
@@ -147,6 +292,18 @@ public:
 	 */
 	void setWatch(const std::string& path, WatchCallback callback);
 
+	/**
+	 * Sets watch which merges the entry changes.
+	 * @param path     path to the entry
+	 * @param callback callback which will be called with all changed paths
+	 * @param window   time to collect the changes after the first one. If
+	 *                 zero, the changes are merged within one dispatch pass.
+	 */
+	void setCoalescedWatch(const std::string& path,
+						   CoalescedWatchCallback callback,
+						   std::chrono::milliseconds window =
+						   std::chrono::milliseconds(0));
+
 	/**
 	 * Clears watch for XS entry change.
 	 * @param path path to the entry.
@@ -170,12 +327,37 @@ public:
 
 private:
 
+	// callbacks are shared with the dispatching thread, thus they are not
+	// copied on each event and may be cleared from the callback itself
+	struct Watch
+	{
+		std::shared_ptr<const WatchCallback> callback;
+		std::shared_ptr<const CoalescedWatchCallback> coalescedCallback;
+		std::chrono::milliseconds window;
+		// path of the watch registered in Xen store which serves this watch
+		std::string owner;
+	};
+
+	struct WatchEvent
+	{
+		std::string path;
+		std::shared_ptr<const WatchCallback> callback;
+	};
+
+	struct CoalescedEvents
+	{
+		std::set<std::string> paths;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
 	xs_handle*	mXsHandle;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
 	Log mLog;
 
-	std::unordered_map<std::string, WatchCallback> mWatches;
+	PathTrie<Watch> mWatches;
+	std::map<std::string, CoalescedEvents> mCoalescedEvents;
+	std::list<std::string> mPendingWatches;
 
 	std::thread mThread;
 	std::mutex mMutex;
@@ -187,7 +369,18 @@ private:
 
 	void watchesThread();
 	std::string readXsWatch(std::string& token);
-	WatchCallback getWatchCallback(const std::string& path);
+	std::string getOwner(const std::string& path);
+	void adoptWatches(const std::string& owner);
+	size_t getWatchCallbacks(const std::string& path, const std::string& token,
+							 std::vector<WatchEvent>& events);
+	bool getPendingWatch(std::string& path,
+						 std::shared_ptr<const WatchCallback>& callback);
+	void addWatch(const std::string& path, Watch watch);
+	void addCoalescedEvent(const std::string& watchPath,
+						   const std::string& path, const Watch& watch);
+	bool getCoalescedEvents(std::vector<std::string>& paths,
+			std::shared_ptr<const CoalescedWatchCallback>& callback);
+	int getCoalescedTimeout();
 };
 
 }
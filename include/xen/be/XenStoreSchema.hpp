@@ -0,0 +1,442 @@
+/*
+ *  Xen Store schema binding
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_XENSTORESCHEMA_HPP_
+#define XENBE_XENSTORESCHEMA_HPP_
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "AsyncXenStore.hpp"
+#include "XenStore.hpp"
+
+/**
+ * Declares the required schema field.
+ * @param type   structure type
+ * @param member structure member
+ * @param key    Xen store key relative to the schema path
+ * @ingroup xen
+ */
+#define XENSTORE_FIELD(type, member, key) \
+	{ key, &XenBackend::parseXenStoreField<type, decltype(type::member), \
+										   &type::member>, false }
+
+/**
+ * Declares the optional schema field. The member keeps its value if the key
+ * doesn't exist.
+ * @param type   structure type
+ * @param member structure member
+ * @param key    Xen store key relative to the schema path
+ * @ingroup xen
+ */
+#define XENSTORE_OPTIONAL_FIELD(type, member, key) \
+	{ key, &XenBackend::parseXenStoreField<type, decltype(type::member), \
+										   &type::member>, true }
+
+namespace XenBackend {
+
+/**
+ * Parses signed integer value.
+ * @return 0 on success or errno value
+ */
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value &&
+						std::is_signed<T>::value, int>::type
+parseXenStoreValue(const char* value, T& result)
+{
+	char* end;
+
+	errno = 0;
+
+	auto parsed = strtoll(value, &end, 10);
+
+	if (end == value || *end)
+	{
+		return EINVAL;
+	}
+
+	if (errno == ERANGE || parsed < std::numeric_limits<T>::min() ||
+		parsed > std::numeric_limits<T>::max())
+	{
+		return ERANGE;
+	}
+
+	result = parsed;
+
+	return 0;
+}
+
+/**
+ * Parses unsigned integer value.
+ * @return 0 on success or errno value
+ */
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value &&
+						std::is_unsigned<T>::value &&
+						!std::is_same<T, bool>::value, int>::type
+parseXenStoreValue(const char* value, T& result)
+{
+	char* end;
+
+	// strtoull silently negates negative values
+	if (strchr(value, '-'))
+	{
+		return ERANGE;
+	}
+
+	errno = 0;
+
+	auto parsed = strtoull(value, &end, 10);
+
+	if (end == value || *end)
+	{
+		return EINVAL;
+	}
+
+	if (errno == ERANGE || parsed > std::numeric_limits<T>::max())
+	{
+		return ERANGE;
+	}
+
+	result = parsed;
+
+	return 0;
+}
+
+/**
+ * Parses boolean value: "0" or "1".
+ * @return 0 on success or errno value
+ */
+inline int parseXenStoreValue(const char* value, bool& result)
+{
+	if (strcmp(value, "0") && strcmp(value, "1"))
+	{
+		return EINVAL;
+	}
+
+	result = *value == '1';
+
+	return 0;
+}
+
+/**
+ * Parses enumeration value as its underlying integer.
+ * @return 0 on success or errno value
+ */
+template<typename T>
+typename std::enable_if<std::is_enum<T>::value, int>::type
+parseXenStoreValue(const char* value, T& result)
+{
+	typename std::underlying_type<T>::type parsed;
+
+	auto error = parseXenStoreValue(value, parsed);
+
+	if (!error)
+	{
+		result = static_cast<T>(parsed);
+	}
+
+	return error;
+}
+
+/**
+ * Copies string value.
+ * @return 0
+ */
+inline int parseXenStoreValue(const char* value, std::string& result)
+{
+	result.assign(value);
+
+	return 0;
+}
+
+/**
+ * Parses the value into the structure member.
+ * @return 0 on success or errno value
+ */
+template<typename S, typename T, T S::*member>
+int parseXenStoreField(const char* value, S& object)
+{
+	return parseXenStoreValue(value, object.*member);
+}
+
+/***************************************************************************//**
+ * Descriptor of Xen store schema field. Use XENSTORE_FIELD and
+ * XENSTORE_OPTIONAL_FIELD macros to declare it.
+ * @ingroup xen
+ ******************************************************************************/
+template<typename S>
+struct XenStoreField
+{
+	//! key relative to the schema path
+	const char* key;
+	//! parses the value into the structure member
+	int (*parse)(const char* value, S& object);
+	//! field may be absent
+	bool optional;
+};
+
+/***************************************************************************//**
+ * Error of Xen store schema field.
+ * @ingroup xen
+ ******************************************************************************/
+struct XenStoreFieldError
+{
+	//! field key
+	const char* key;
+	//! ENOENT if the required field is absent, EINVAL if the value is
+	//! malformed, ERANGE if the value doesn't fit the member
+	int error;
+};
+
+/***************************************************************************//**
+ * Binds Xen store subtree to the structure.
+ *
+ * The schema is a static array of field descriptors. Each descriptor maps Xen
+ * store key to the structure member and knows how to parse it. Only the
+ * declared keys are read: AsyncXenStore sends all reads at once, thus the
+ * structure takes one round trip regardless of the number of fields. With
+ * XenStore the keys are read one by one. A subtree already read by
+ * AsyncXenStore::readTree() can be parsed in place as well. All fields are
+ * parsed even if some of them fail, thus all errors are reported at once.
+ *
+ * @code
+ * struct RingConfig
+ * {
+ *     evtchn_port_t port;
+ *     grant_ref_t ref;
+ *     std::string protocol;
+ * };
+ *
+ * static const XenStoreField<RingConfig> cRingFields[] = {
+ *     XENSTORE_FIELD(RingConfig, port, "event-channel"),
+ *     XENSTORE_FIELD(RingConfig, ref, "ring-ref"),
+ *     XENSTORE_OPTIONAL_FIELD(RingConfig, protocol, "protocol")
+ * };
+ *
+ * static const XenStoreSchema<RingConfig> cRingSchema(cRingFields);
+ *
+ * RingConfig config;
+ *
+ * cRingSchema.read(asyncXenStore, getXsFrontendPath(), config);
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+template<typename S>
+class XenStoreSchema
+{
+public:
+
+	/**
+	 * @param fields field descriptors. The array should outlive the schema.
+	 */
+	template<size_t N>
+	explicit XenStoreSchema(const XenStoreField<S> (&fields)[N]) :
+		mFields(fields), mSize(N) {}
+
+	/**
+	 * Returns number of fields.
+	 */
+	size_t size() const { return mSize; }
+
+	/**
+	 * Fills the structure from already read tree.
+	 * @param[in]  tree   Xen store subtree
+	 * @param[out] object structure to fill
+	 * @return field errors, empty on success
+	 */
+	std::vector<XenStoreFieldError> parse(const XenStoreTree& tree,
+										  S& object) const
+	{
+		std::vector<XenStoreFieldError> errors;
+
+		for (size_t i = 0; i < mSize; i++)
+		{
+			auto value = tree.findValue(mFields[i].key);
+
+			parseField(mFields[i], value ? 0 : ENOENT, value, object, errors);
+		}
+
+		return errors;
+	}
+
+	/**
+	 * Reads the declared keys one by one and fills the structure.
+	 * Throws XenStoreException which lists all failed fields.
+	 * @param[in]  xenStore Xen store
+	 * @param[in]  path     path to the subtree
+	 * @param[out] object   structure to fill
+	 */
+	void read(XenStore& xenStore, const std::string& path, S& object) const
+	{
+		std::vector<XenStoreFieldError> errors;
+
+		for (size_t i = 0; i < mSize; i++)
+		{
+			std::string value;
+			int error = 0;
+
+			try
+			{
+				value = xenStore.readString(path + "/" + mFields[i].key);
+			}
+			catch(const XenStoreException& e)
+			{
+				error = e.getErrno();
+			}
+
+			parseField(mFields[i], error, value.c_str(), object, errors);
+		}
+
+		check(path, errors);
+	}
+
+	/**
+	 * Reads the declared keys with pipelined requests and fills the
+	 * structure. Throws XenStoreException which lists all failed fields.
+	 * Shall not be called from AsyncXenStore callbacks.
+	 * @param[in]  xenStore asynchronous Xen store
+	 * @param[in]  path     path to the subtree
+	 * @param[out] object   structure to fill
+	 */
+	void read(AsyncXenStore& xenStore, const std::string& path,
+			  S& object) const
+	{
+		// the replies may come after an exception, thus the values are
+		// shared with the callbacks
+		auto reads = std::make_shared<ValueReads>(mSize);
+
+		for (size_t i = 0; i < mSize; i++)
+		{
+			try
+			{
+				xenStore.readString(path + "/" + mFields[i].key,
+					[reads, i](int error, const std::string& value)
+					{ reads->set(i, error, value); });
+			}
+			catch(const XenStoreException& e)
+			{
+				reads->set(i, e.getErrno(), std::string());
+			}
+		}
+
+		reads->wait();
+
+		std::vector<XenStoreFieldError> errors;
+
+		for (size_t i = 0; i < mSize; i++)
+		{
+			parseField(mFields[i], reads->values[i].error,
+					   reads->values[i].value.c_str(), object, errors);
+		}
+
+		check(path, errors);
+	}
+
+private:
+
+	struct Value
+	{
+		int error;
+		std::string value;
+	};
+
+	struct ValueReads
+	{
+		explicit ValueReads(size_t size) : pending(size), values(size) {}
+
+		void set(size_t index, int error, const std::string& value)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			values[index].error = error;
+			values[index].value = value;
+
+			if (--pending == 0)
+			{
+				condVar.notify_all();
+			}
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			condVar.wait(lock, [this] { return pending == 0; });
+		}
+
+		std::mutex mutex;
+		std::condition_variable condVar;
+		size_t pending;
+		std::vector<Value> values;
+	};
+
+	const XenStoreField<S>* mFields;
+	size_t mSize;
+
+	static void parseField(const XenStoreField<S>& field, int error,
+						   const char* value, S& object,
+						   std::vector<XenStoreFieldError>& errors)
+	{
+		if (error == ENOENT && field.optional)
+		{
+			return;
+		}
+
+		if (!error)
+		{
+			error = field.parse(value, object);
+		}
+
+		if (error)
+		{
+			errors.push_back({field.key, error});
+		}
+	}
+
+	static void check(const std::string& path,
+					  const std::vector<XenStoreFieldError>& errors)
+	{
+		if (!errors.empty())
+		{
+			std::string message = "Can't read " + path + " fields:";
+
+			for (auto& error : errors)
+			{
+				message += std::string(&error == &errors.front() ? " " : ", ") +
+						   error.key + " (" + strerror(error.error) + ")";
+			}
+
+			throw XenStoreException(message, errors.front().error);
+		}
+	}
+};
+
+}
+
+#endif /* XENBE_XENSTORESCHEMA_HPP_ */
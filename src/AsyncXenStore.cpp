@@ -0,0 +1,808 @@
+/*
+ *  Asynchronous Xen Store client
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "AsyncXenStore.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::find;
+using std::future;
+using std::lock_guard;
+using std::make_exception_ptr;
+using std::make_shared;
+using std::mutex;
+using std::promise;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unordered_map;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * AsyncXenStore
+ ******************************************************************************/
+
+AsyncXenStore::AsyncXenStore(const string& socketPath,
+							 ErrorCallback errorCallback) :
+	mFd(-1),
+	mErrorCallback(errorCallback),
+	mReqId(0),
+	mTerminated(false),
+	mLog("AsyncXenStore")
+{
+	try
+	{
+		init(socketPath);
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+AsyncXenStore::~AsyncXenStore()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void AsyncXenStore::getDomainPath(domid_t domId, StringCallback callback)
+{
+	sendRequest(XS_GET_DOMAIN_PATH, XBT_NULL, to_string(domId) + '\0',
+				[callback](int error, const string& payload)
+				{ callback(error, getString(payload)); });
+}
+
+future<string> AsyncXenStore::getDomainPath(domid_t domId)
+{
+	auto result = make_shared<promise<string>>();
+
+	getDomainPath(domId, [result](int error, const string& value)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't get domain path", error)));
+		}
+		else
+		{
+			result->set_value(value);
+		}
+	});
+
+	return result->get_future();
+}
+
+void AsyncXenStore::readString(const string& path, StringCallback callback,
+							   xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Read string " << path;
+
+	sendRequest(XS_READ, transaction, path + '\0',
+				[callback](int error, const string& payload)
+				{ callback(error, error ? string() : payload); });
+}
+
+future<string> AsyncXenStore::readString(const string& path,
+										 xs_transaction_t transaction)
+{
+	auto result = make_shared<promise<string>>();
+
+	readString(path, [result, path](int error, const string& value)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't read from: " + path, error)));
+		}
+		else
+		{
+			result->set_value(value);
+		}
+	}, transaction);
+
+	return result->get_future();
+}
+
+void AsyncXenStore::writeString(const string& path, const string& value,
+								ResultCallback callback,
+								xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Write string " << path << " : " << value;
+
+	sendRequest(XS_WRITE, transaction, path + '\0' + value,
+				[callback](int error, const string& payload)
+				{ callback(error); });
+}
+
+future<void> AsyncXenStore::writeString(const string& path,
+										const string& value,
+										xs_transaction_t transaction)
+{
+	auto result = make_shared<promise<void>>();
+
+	writeString(path, value, [result, path](int error)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't write value to " + path, error)));
+		}
+		else
+		{
+			result->set_value();
+		}
+	}, transaction);
+
+	return result->get_future();
+}
+
+void AsyncXenStore::readDirectory(const string& path,
+								  DirectoryCallback callback,
+								  xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Read directory " << path;
+
+	sendRequest(XS_DIRECTORY, transaction, path + '\0',
+				[callback](int error, const string& payload)
+	{
+		vector<string> items;
+
+		if (!error)
+		{
+			size_t pos = 0;
+
+			while (pos < payload.length())
+			{
+				auto end = payload.find('\0', pos);
+
+				if (end == string::npos)
+				{
+					end = payload.length();
+				}
+
+				if (end != pos)
+				{
+					items.push_back(payload.substr(pos, end - pos));
+				}
+
+				pos = end + 1;
+			}
+		}
+
+		callback(error, items);
+	});
+}
+
+future<vector<string>> AsyncXenStore::readDirectory(
+		const string& path, xs_transaction_t transaction)
+{
+	auto result = make_shared<promise<vector<string>>>();
+
+	readDirectory(path, [result, path](int error, const vector<string>& items)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't read directory " + path, error)));
+		}
+		else
+		{
+			result->set_value(items);
+		}
+	}, transaction);
+
+	return result->get_future();
+}
+
+void AsyncXenStore::readTree(const string& path, unsigned int depth,
+							 const vector<string>& leaves,
+							 TreeCallback callback)
+{
+	DLOG(mLog, DEBUG) << "Read tree " << path;
+
+	auto read = make_shared<TreeRead>();
+
+	read->path = path;
+	read->depth = depth;
+	read->leaves = leaves;
+	read->callback = callback;
+	read->transaction = XBT_NULL;
+	read->retries = 0;
+	read->tree.mPath = path;
+
+	startTreeRead(read);
+}
+
+future<XenStoreTree> AsyncXenStore::readTree(const string& path,
+											 unsigned int depth,
+											 const vector<string>& leaves)
+{
+	auto result = make_shared<promise<XenStoreTree>>();
+
+	readTree(path, depth, leaves, [result, path](int error, XenStoreTree& tree)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't read tree " + path, error)));
+		}
+		else
+		{
+			result->set_value(std::move(tree));
+		}
+	});
+
+	return result->get_future();
+}
+
+void AsyncXenStore::removePath(const string& path, ResultCallback callback,
+							   xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Remove path " << path;
+
+	sendRequest(XS_RM, transaction, path + '\0',
+				[callback](int error, const string& payload)
+				{ callback(error); });
+}
+
+future<void> AsyncXenStore::removePath(const string& path,
+									   xs_transaction_t transaction)
+{
+	auto result = make_shared<promise<void>>();
+
+	removePath(path, [result, path](int error)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't remove path " + path, error)));
+		}
+		else
+		{
+			result->set_value();
+		}
+	}, transaction);
+
+	return result->get_future();
+}
+
+void AsyncXenStore::startTransaction(TransactionCallback callback)
+{
+	sendRequest(XS_TRANSACTION_START, XBT_NULL, string(1, '\0'),
+				[callback](int error, const string& payload)
+	{
+		xs_transaction_t transaction = XBT_NULL;
+
+		if (!error)
+		{
+			transaction = strtoul(getString(payload).c_str(), nullptr, 10);
+		}
+
+		callback(error, transaction);
+	});
+}
+
+future<xs_transaction_t> AsyncXenStore::startTransaction()
+{
+	auto result = make_shared<promise<xs_transaction_t>>();
+
+	startTransaction([result](int error, xs_transaction_t transaction)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't start transaction", error)));
+		}
+		else
+		{
+			result->set_value(transaction);
+		}
+	});
+
+	return result->get_future();
+}
+
+void AsyncXenStore::endTransaction(xs_transaction_t transaction, bool abort,
+								   ResultCallback callback)
+{
+	sendRequest(XS_TRANSACTION_END, transaction, abort ? string("F\0", 2) :
+				string("T\0", 2),
+				[callback](int error, const string& payload)
+				{ callback(error); });
+}
+
+future<void> AsyncXenStore::endTransaction(xs_transaction_t transaction,
+										   bool abort)
+{
+	auto result = make_shared<promise<void>>();
+
+	endTransaction(transaction, abort, [result](int error)
+	{
+		if (error)
+		{
+			result->set_exception(make_exception_ptr(
+					XenStoreException("Can't end transaction", error)));
+		}
+		else
+		{
+			result->set_value();
+		}
+	});
+
+	return result->get_future();
+}
+
+size_t AsyncXenStore::getPendingRequests()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mRequests.size();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void AsyncXenStore::init(const string& socketPath)
+{
+	string path = socketPath;
+
+	if (path.empty())
+	{
+		auto envPath = getenv("XENSTORED_PATH");
+
+		path = envPath ? envPath : cDefaultSocketPath;
+	}
+
+	sockaddr_un addr = {};
+
+	if (path.length() >= sizeof(addr.sun_path))
+	{
+		throw XenStoreException("Socket path is too long: " + path,
+								ENAMETOOLONG);
+	}
+
+	addr.sun_family = AF_UNIX;
+	path.copy(addr.sun_path, path.length());
+
+	mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (mFd < 0)
+	{
+		throw XenStoreException("Can't create socket", errno);
+	}
+
+	if (connect(mFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		throw XenStoreException("Can't connect to " + path, errno);
+	}
+
+	mPollFd.reset(new PollFd(mFd, POLLIN));
+
+	mThread = thread(&AsyncXenStore::receiveThread, this);
+
+	LOG(mLog, DEBUG) << "Connected to " << path;
+}
+
+void AsyncXenStore::release()
+{
+	if (mPollFd)
+	{
+		mPollFd->stop();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	cancelRequests(ECANCELED);
+
+	if (mFd >= 0)
+	{
+		close(mFd);
+
+		mFd = -1;
+
+		LOG(mLog, DEBUG) << "Disconnected";
+	}
+}
+
+void AsyncXenStore::sendRequest(xsd_sockmsg_type type,
+								xs_transaction_t transaction,
+								const string& payload,
+								ReplyCallback callback)
+{
+	if (payload.length() > XENSTORE_PAYLOAD_MAX)
+	{
+		throw XenStoreException("Request is too long", E2BIG);
+	}
+
+	xsd_sockmsg header = {};
+
+	header.type = type;
+	header.tx_id = transaction;
+	header.len = payload.length();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (mTerminated)
+		{
+			throw XenStoreException("Xen store connection is closed",
+									ECONNRESET);
+		}
+
+		header.req_id = mReqId++;
+
+		mRequests[header.req_id] = callback;
+	}
+
+	string message(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	message.append(payload);
+
+	lock_guard<mutex> lock(mWriteMutex);
+
+	size_t written = 0;
+
+	while (written < message.length())
+	{
+		auto ret = send(mFd, message.data() + written,
+						message.length() - written, MSG_NOSIGNAL);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			auto error = errno;
+
+			{
+				lock_guard<mutex> lock(mMutex);
+
+				mRequests.erase(header.req_id);
+			}
+
+			throw XenStoreException("Can't send request", error);
+		}
+
+		written += ret;
+	}
+}
+
+void AsyncXenStore::receiveThread()
+{
+	try
+	{
+		while(mPollFd->poll())
+		{
+			if (!receiveReplies())
+			{
+				throw XenStoreException("Xen store connection is closed",
+										ECONNRESET);
+			}
+		}
+	}
+	catch(const std::exception& e)
+	{
+		cancelRequests(ECONNRESET);
+
+		if (mErrorCallback)
+		{
+			mErrorCallback(e);
+		}
+		else
+		{
+			LOG(mLog, ERROR) << e.what();
+		}
+	}
+}
+
+bool AsyncXenStore::receiveReplies()
+{
+	char buffer[XENSTORE_PAYLOAD_MAX];
+
+	auto size = read(mFd, buffer, sizeof(buffer));
+
+	if (size < 0)
+	{
+		if (errno == EINTR || errno == EAGAIN)
+		{
+			return true;
+		}
+
+		throw XenStoreException("Can't read reply", errno);
+	}
+
+	if (size == 0)
+	{
+		return false;
+	}
+
+	mReceiveBuffer.insert(mReceiveBuffer.end(), buffer, buffer + size);
+
+	size_t pos = 0;
+
+	while (mReceiveBuffer.size() - pos >= sizeof(xsd_sockmsg))
+	{
+		xsd_sockmsg header;
+
+		memcpy(&header, &mReceiveBuffer[pos], sizeof(header));
+
+		if (header.len > XENSTORE_PAYLOAD_MAX)
+		{
+			throw XenStoreException("Reply is too long", E2BIG);
+		}
+
+		if (mReceiveBuffer.size() - pos < sizeof(header) + header.len)
+		{
+			break;
+		}
+
+		string payload(&mReceiveBuffer[pos + sizeof(header)], header.len);
+
+		pos += sizeof(header) + header.len;
+
+		handleReply(header, payload);
+	}
+
+	mReceiveBuffer.erase(mReceiveBuffer.begin(),
+						 mReceiveBuffer.begin() + pos);
+
+	return true;
+}
+
+void AsyncXenStore::handleReply(const xsd_sockmsg& header,
+								const string& payload)
+{
+	if (header.type == XS_WATCH_EVENT)
+	{
+		DLOG(mLog, WARNING) << "Unexpected watch event";
+
+		return;
+	}
+
+	ReplyCallback callback;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mRequests.find(header.req_id);
+
+		if (it == mRequests.end())
+		{
+			LOG(mLog, ERROR) << "Unexpected reply, id: " << header.req_id;
+
+			return;
+		}
+
+		callback = it->second;
+
+		mRequests.erase(it);
+	}
+
+	int error = header.type == XS_ERROR ? getError(payload) : 0;
+
+	if (callback)
+	{
+		callback(error, payload);
+	}
+}
+
+void AsyncXenStore::cancelRequests(int error)
+{
+	unordered_map<uint32_t, ReplyCallback> requests;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminated = true;
+
+		requests.swap(mRequests);
+	}
+
+	for (auto& request : requests)
+	{
+		if (request.second)
+		{
+			request.second(error, string());
+		}
+	}
+}
+
+void AsyncXenStore::startTreeRead(shared_ptr<TreeRead> read)
+{
+	read->tree.clear();
+	read->pending = 0;
+	read->error = 0;
+
+	startTransaction([this, read](int error, xs_transaction_t transaction)
+	{
+		if (error)
+		{
+			read->callback(error, read->tree);
+
+			return;
+		}
+
+		read->transaction = transaction;
+
+		// holds the tree till the root requests are sent
+		read->pending++;
+
+		readTreeEntry(read, "", read->depth);
+
+		finishTreeEntry(read);
+	});
+}
+
+void AsyncXenStore::readTreeEntry(shared_ptr<TreeRead> read, const string& key,
+								  unsigned int depth)
+{
+	auto path = key.empty() ? read->path : read->path + "/" + key;
+
+	try
+	{
+		read->pending++;
+
+		sendRequest(XS_READ, read->transaction, path + '\0',
+					[this, read, key](int error, const string& payload)
+		{
+			if (error)
+			{
+				read->error = read->error ? read->error : error;
+			}
+			else
+			{
+				read->tree.append(key, payload.data(), payload.length());
+			}
+
+			finishTreeEntry(read);
+		});
+
+		if (depth == 0 ||
+			find(read->leaves.begin(), read->leaves.end(), key) !=
+			read->leaves.end())
+		{
+			return;
+		}
+
+		read->pending++;
+
+		readDirectory(path, [this, read, key, depth](int error,
+													 const vector<string>& items)
+		{
+			// directory errors are ignored as in XenStore::readTree()
+			if (!error && !read->error)
+			{
+				// holds the tree till the children requests are sent
+				read->pending++;
+
+				for (auto& child : items)
+				{
+					readTreeEntry(read, key.empty() ? child : key + "/" + child,
+								  depth - 1);
+				}
+
+				finishTreeEntry(read);
+			}
+
+			finishTreeEntry(read);
+		}, read->transaction);
+	}
+	catch(const XenStoreException& e)
+	{
+		read->pending--;
+		read->error = read->error ? read->error : e.getErrno();
+	}
+}
+
+void AsyncXenStore::finishTreeEntry(shared_ptr<TreeRead> read)
+{
+	if (--read->pending)
+	{
+		return;
+	}
+
+	try
+	{
+		if (read->error)
+		{
+			endTransaction(read->transaction, true, [](int) {});
+			read->callback(read->error, read->tree);
+
+			return;
+		}
+
+		endTransaction(read->transaction, false, [this, read](int error)
+		{
+			if (error == EAGAIN && ++read->retries < cTransactionRetries)
+			{
+				DLOG(mLog, DEBUG) << "Repeat read tree " << read->path;
+
+				try
+				{
+					startTreeRead(read);
+				}
+				catch(const XenStoreException& e)
+				{
+					read->callback(e.getErrno(), read->tree);
+				}
+
+				return;
+			}
+
+			if (!error)
+			{
+				read->tree.sort();
+
+				DLOG(mLog, DEBUG) << "Read tree " << read->path
+								  << ", entries: " << read->tree.size();
+			}
+
+			read->callback(error, read->tree);
+		});
+	}
+	catch(const XenStoreException& e)
+	{
+		read->callback(read->error ? read->error : e.getErrno(), read->tree);
+	}
+}
+
+int AsyncXenStore::getError(const string& payload)
+{
+	auto error = getString(payload);
+
+	for (auto& item : xsd_errors)
+	{
+		if (error == item.errstring)
+		{
+			return item.errnum;
+		}
+	}
+
+	return EINVAL;
+}
+
+string AsyncXenStore::getString(const string& payload)
+{
+	return payload.substr(0, payload.find('\0'));
+}
+
+}
@@ -21,20 +21,36 @@
 #include "BackendBase.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
 
 #include "Utils.hpp"
 
+using std::back_inserter;
+using std::binary_search;
 using std::bind;
-using std::find_if;
-using std::list;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::equal_range;
+using std::lock_guard;
 using std::make_pair;
+using std::map;
+using std::mutex;
+using std::none_of;
+using std::numeric_limits;
 using std::unique_ptr;
 using std::pair;
 using std::placeholders::_1;
+using std::set_difference;
+using std::sort;
 using std::stoi;
 using std::string;
 using std::to_string;
+using std::unordered_map;
 using std::vector;
 
 namespace XenBackend {
@@ -71,15 +87,132 @@ namespace XenBackend {
  * @example ExampleBackend.hpp
  ******************************************************************************/
 
+/*******************************************************************************
+ * Static
+ ******************************************************************************/
+
+/*
+ * Converts directory items to sorted ids. Items which are not ids are skipped.
+ */
+template<typename T>
+static vector<T> getIds(const vector<string>& items)
+{
+	vector<T> ids;
+
+	ids.reserve(items.size());
+
+	for (auto& item : items)
+	{
+		char* end;
+		auto id = strtoul(item.c_str(), &end, 10);
+
+		if (item.empty() || *end || id > numeric_limits<T>::max())
+		{
+			continue;
+		}
+
+		ids.push_back(id);
+	}
+
+	sort(ids.begin(), ids.end());
+
+	return ids;
+}
+
+/*
+ * Finds ids which are added to and removed from sorted known ids.
+ */
+template<typename T>
+static void diffIds(const vector<T>& known, const vector<T>& current,
+					vector<T>& added, vector<T>& removed)
+{
+	set_difference(current.begin(), current.end(), known.begin(), known.end(),
+				   back_inserter(added));
+	set_difference(known.begin(), known.end(), current.begin(), current.end(),
+				   back_inserter(removed));
+}
+
+/*
+ * Finds ids which are added to and removed from the known map keys.
+ */
+template<typename T, typename V>
+static void diffIds(const map<T, V>& known, const vector<T>& current,
+					vector<T>& added, vector<T>& removed)
+{
+	for (auto id : current)
+	{
+		if (!known.count(id))
+		{
+			added.push_back(id);
+		}
+	}
+
+	for (auto& item : known)
+	{
+		if (!binary_search(current.begin(), current.end(), item.first))
+		{
+			removed.push_back(item.first);
+		}
+	}
+}
+
+template<typename T>
+static bool isKnownId(const vector<T>& known, T id)
+{
+	return binary_search(known.begin(), known.end(), id);
+}
+
+template<typename T, typename V>
+static bool isKnownId(const map<T, V>& known, T id)
+{
+	return known.count(id);
+}
+
+/*
+ * Checks if the changed path may change items of the list path. Changes
+ * inside known items don't change the list, thus the list is not rescanned
+ * on each write of a known frontend.
+ */
+template<typename T, typename Known>
+static bool isListChanged(const string& path, const string& listPath,
+						  const Known& known)
+{
+	if (path.length() <= listPath.length())
+	{
+		return true;
+	}
+
+	auto pos = path.find('/', listPath.length() + 1);
+
+	if (pos == string::npos)
+	{
+		// the item itself is added or removed
+		return true;
+	}
+
+	auto item = path.substr(listPath.length() + 1,
+							pos - listPath.length() - 1);
+	char* end;
+	auto id = strtoul(item.c_str(), &end, 10);
+
+	return item.empty() || *end || id > numeric_limits<T>::max() ||
+		   !isKnownId(known, static_cast<T>(id));
+}
+
 /*******************************************************************************
  * BackendBase
  ******************************************************************************/
 
-BackendBase::BackendBase(const string& name, const string& deviceName) :
+BackendBase::BackendBase(const string& name, const string& deviceName,
+						 size_t numWorkers) :
 	mXenStore(bind(&BackendBase::onError, this, _1)),
 	mDomId(0),
 	mDeviceName(deviceName),
-	mLog(name.empty() ? "Backend" : name)
+	mBurstStats(),
+	mLastBurstStats(),
+	mLog(name.empty() ? "Backend" : name),
+	mWorkerPool(numWorkers),
+	mAsyncXenStoreLost(false)
 {
 	mDomId = mXenStore.readInt("domid");
 
@@ -94,12 +227,20 @@ BackendBase::~BackendBase()
 {
 	stop();
 
-	for(auto frontend : mFrontendHandlers)
+	mWorkerPool.stop();
+
+	unordered_map<uint32_t, FrontendHandlerPtr> frontendHandlers;
+
 	{
-		frontend->stop();
+		lock_guard<mutex> lock(mMutex);
+
+		frontendHandlers.swap(mFrontendHandlers);
 	}
 
-	mFrontendHandlers.clear();
+	for(auto frontend : frontendHandlers)
+	{
+		frontend.second->stop();
+	}
 
 	LOG(mLog, DEBUG) << "Delete";
 }
@@ -110,6 +251,18 @@ BackendBase::~BackendBase()
 
 void BackendBase::start()
 {
+	try
+	{
+		mAsyncXenStoreLost = false;
+		mAsyncXenStore.reset(new AsyncXenStore(
+				"", bind(&BackendBase::onError, this, _1)));
+	}
+	catch(const XenStoreException& e)
+	{
+		LOG(mLog, DEBUG) << "Device lists are read synchronously: "
+						 << e.what();
+	}
+
 	mXenStore.start();
 
 	mXenStore.setWatch(mFrontendsPath,
@@ -121,6 +274,19 @@ void BackendBase::stop()
 	mXenStore.clearWatches();
 
 	mXenStore.stop();
+
+	// cancels pending device list reads and waits for the running one: no
+	// frontend is brought up after the workers are finished
+	mAsyncXenStore.reset();
+
+	mWorkerPool.wait();
+}
+
+BackendBase::BringUpStats BackendBase::getBringUpStats()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mLastBurstStats;
 }
 
 /*******************************************************************************
@@ -131,22 +297,36 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 {
 	auto domId = frontendHandler->getDomId();
 	auto devId = frontendHandler->getDevId();
+	auto key = getFrontendKey(domId, devId);
 
-	if (getFrontendHandler(domId, devId))
 	{
-		throw BackendException("Frontend already exists", EEXIST);
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mFrontendHandlers.emplace(key, frontendHandler).second)
+		{
+			throw BackendException("Frontend already exists", EEXIST);
+		}
 	}
 
 	auto frontendPath = mFrontendsPath + "/" + to_string(domId) + "/" +
 						to_string(devId);
 
-	mXenStore.setWatch(frontendPath,
-					   bind(&BackendBase::frontendPathChanged, this,
-							_1, domId, devId));
+	try
+	{
+		mXenStore.setWatch(frontendPath,
+						   bind(&BackendBase::frontendPathChanged, this,
+								_1, domId, devId));
+
+		frontendHandler->start();
+	}
+	catch(const std::exception& e)
+	{
+		lock_guard<mutex> lock(mMutex);
 
-	frontendHandler->start();
+		mFrontendHandlers.erase(key);
 
-	mFrontendHandlers.push_back(frontendHandler);
+		throw;
+	}
 }
 
 /*******************************************************************************
@@ -155,55 +335,195 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 
 void BackendBase::domainListChanged(const string& path)
 {
-	for (auto domain : mXenStore.readDirectory(path))
 	{
-		domid_t domId = stoi(domain);
+		lock_guard<mutex> lock(mMutex);
+
+		if (!isListChanged<domid_t>(path, mFrontendsPath, mDomains))
+		{
+			return;
+		}
+	}
+
+	auto current = getIds<domid_t>(mXenStore.readDirectory(mFrontendsPath));
+	vector<domid_t> added, removed;
+
+	{
+		lock_guard<mutex> lock(mMutex);
 
-		if (find(mDomainList.begin(), mDomainList.end(), domId) ==
-			mDomainList.end())
+		diffIds(mDomains, current, added, removed);
+
+		for (auto domId : added)
 		{
-			mXenStore.setWatch(mFrontendsPath + "/" + domain,
-							   bind(&BackendBase::deviceListChanged, this,
-									_1, domId));
+			mDomains[domId];
+		}
 
-			mDomainList.push_back(domId);
+		for (auto domId : removed)
+		{
+			mDomains.erase(domId);
 		}
 	}
+
+	for (auto domId : added)
+	{
+		// frontends write many entries on connect: rescan the device
+		// list once per dispatch pass
+		mXenStore.setCoalescedWatch(mFrontendsPath + "/" + to_string(domId),
+									bind(&BackendBase::deviceListChanged,
+										 this, _1, domId));
+	}
+
+	for (auto domId : removed)
+	{
+		LOG(mLog, DEBUG) << "Domain removed, domid: " << domId;
+
+		mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId));
+
+		// grants and ports of the removed domain can't be reused
+		RingBufferCache::clear(domId);
+	}
 }
 
-void BackendBase::deviceListChanged(const string& path, domid_t domId)
+void BackendBase::deviceListChanged(const vector<string>& paths,
+									domid_t domId)
 {
-	if (!mXenStore.checkIfExist(path))
+	auto domainPath = mFrontendsPath + "/" + to_string(domId);
+
 	{
-		auto it = find(mDomainList.begin(), mDomainList.end(), domId);
+		lock_guard<mutex> lock(mMutex);
 
-		if (it != mDomainList.end())
+		auto it = mDomains.find(domId);
+
+		if (it == mDomains.end())
 		{
-			mXenStore.clearWatch(path);
-			mDomainList.erase(it);
+			return;
 		}
 
-		return;
+		if (none_of(paths.begin(), paths.end(), [&](const string& path)
+					{ return isListChanged<uint16_t>(path, domainPath,
+													 it->second); }))
+		{
+			return;
+		}
 	}
 
-	for (auto device : mXenStore.readDirectory(path))
+	// the connection is lost in the receive thread which can't delete it
+	if (mAsyncXenStoreLost)
 	{
-		uint16_t devId = stoi(device);
+		mAsyncXenStore.reset();
+	}
 
+	if (mAsyncXenStore)
+	{
 		try
 		{
-			if (!getFrontendHandler(domId, devId))
-			{
-				LOG(mLog, DEBUG) << "New frontend found, domid: "
-						<< domId << ", devid: " << devId;
+			// the replies of one connection come in the request order, thus
+			// the device lists of a domain are applied in order
+			mAsyncXenStore->readDirectory(domainPath,
+				[this, domId, domainPath](int error,
+										  const vector<string>& items)
+				{
+					if (error == ECANCELED)
+					{
+						return;
+					}
+
+					try
+					{
+						// the rescan is not lost: it is done synchronously
+						if (error == ECONNRESET)
+						{
+							mAsyncXenStoreLost = true;
+
+							devicesRead(domId, readDevices(domainPath));
+
+							return;
+						}
+
+						if (error && error != ENOENT)
+						{
+							throw XenStoreException("Can't read directory",
+													error);
+						}
+
+						devicesRead(domId, getIds<uint16_t>(items));
+					}
+					catch(const std::exception& e)
+					{
+						onError(e);
+					}
+				});
+
+			return;
+		}
+		catch(const XenStoreException& e)
+		{
+			LOG(mLog, WARNING) << e.what();
 
-				onNewFrontend(domId, devId);
-			}
+			mAsyncXenStore.reset();
 		}
-		catch(const std::exception& e)
+	}
+
+	devicesRead(domId, readDevices(domainPath));
+}
+
+vector<uint16_t> BackendBase::readDevices(const string& domainPath)
+{
+	if (!mXenStore.checkIfExist(domainPath))
+	{
+		return vector<uint16_t>();
+	}
+
+	return getIds<uint16_t>(mXenStore.readDirectory(domainPath));
+}
+
+void BackendBase::devicesRead(domid_t domId, const vector<uint16_t>& current)
+{
+	vector<uint16_t> added, removed;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mDomains.find(domId);
+
+		if (it == mDomains.end())
 		{
-			LOG(mLog, ERROR) << e.what();
+			return;
 		}
+
+		diffIds(it->second, current, added, removed);
+
+		it->second = current;
+	}
+
+	for (auto devId : removed)
+	{
+		removeFrontend(domId, devId);
+	}
+
+	for (auto devId : added)
+	{
+		auto key = getFrontendKey(domId, devId);
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			if (mFrontendHandlers.count(key) ||
+				!mPendingFrontends.insert(key).second)
+			{
+				continue;
+			}
+
+			if (mPendingFrontends.size() == 1 && !mBurstStats.numFrontends)
+			{
+				mBurstStart = steady_clock::now();
+			}
+		}
+
+		LOG(mLog, DEBUG) << "New frontend found, domid: "
+						 << domId << ", devid: " << devId;
+
+		mWorkerPool.call(domId, bind(&BackendBase::bringUpFrontend, this,
+									 domId, devId, steady_clock::now()));
 	}
 }
 
@@ -212,35 +532,143 @@ void BackendBase::frontendPathChanged(const string& path, domid_t domId,
 {
 	LOG(mLog, DEBUG) << "Frontend path changed: " << path;
 
-	if (!mXenStore.checkIfExist(path))
+	auto frontendPath = mFrontendsPath + "/" + to_string(domId) + "/" +
+						to_string(devId);
+
+	if (!mXenStore.checkIfExist(frontendPath))
+	{
+		removeFrontend(domId, devId);
+	}
+}
+
+void BackendBase::removeFrontend(domid_t domId, uint16_t devId)
+{
+	FrontendHandlerPtr frontendHandler;
+
 	{
-		mXenStore.clearWatch(path);
+		lock_guard<mutex> lock(mMutex);
 
-		auto frontendHandler = getFrontendHandler(domId, devId);
+		auto it = mFrontendHandlers.find(getFrontendKey(domId, devId));
 
-		if (frontendHandler)
+		if (it == mFrontendHandlers.end())
 		{
-			LOG(mLog, DEBUG) << "Delete frontend, domid: "
-							 << domId << ", devid: " << devId;
+			return;
+		}
 
-			frontendHandler->stop();
+		frontendHandler = it->second;
 
-			mFrontendHandlers.remove(frontendHandler);
-		}
+		mFrontendHandlers.erase(it);
+
+		forgetDevice(domId, devId);
 	}
+
+	mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId) + "/" +
+						 to_string(devId));
+
+	LOG(mLog, DEBUG) << "Delete frontend, domid: "
+					 << domId << ", devid: " << devId;
+
+	// stop on the worker: it waits for the frontend threads
+	mWorkerPool.call(domId, [frontendHandler]() { frontendHandler->stop(); });
+}
+
+void BackendBase::forgetDevice(domid_t domId, uint16_t devId)
+{
+	auto it = mDomains.find(domId);
+
+	if (it != mDomains.end())
+	{
+		auto devices = equal_range(it->second.begin(), it->second.end(), devId);
+
+		it->second.erase(devices.first, devices.second);
+	}
+}
+
+void BackendBase::bringUpFrontend(domid_t domId, uint16_t devId,
+								  steady_clock::time_point detected)
+{
+	bool succeeded = false;
+
+	try
+	{
+		onNewFrontend(domId, devId);
+
+		succeeded = true;
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	auto latency = duration_cast<milliseconds>(steady_clock::now() - detected);
+
+	LOG(mLog, DEBUG) << "Frontend brought up, domid: " << domId
+					 << ", devid: " << devId << ", latency: "
+					 << latency.count() << " ms";
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto key = getFrontendKey(domId, devId);
+
+	mPendingFrontends.erase(key);
+
+	if (succeeded)
+	{
+		updateBringUpStats(latency);
+	}
+
+	if (!mFrontendHandlers.count(key))
+	{
+		// onNewFrontend() failed or didn't add the handler: the bring-up is
+		// retried on the next device change
+		forgetDevice(domId, devId);
+	}
+
+	if (mPendingFrontends.empty() && mBurstStats.numFrontends)
+	{
+		mBurstStats.duration = duration_cast<milliseconds>(
+				steady_clock::now() - mBurstStart);
+		mBurstStats.averageLatency /= mBurstStats.numFrontends;
+
+		LOG(mLog, INFO) << "Brought up " << mBurstStats.numFrontends
+						<< " frontend(s) in " << mBurstStats.duration.count()
+						<< " ms, latency min/avg/max: "
+						<< mBurstStats.minLatency.count() << "/"
+						<< mBurstStats.averageLatency.count() << "/"
+						<< mBurstStats.maxLatency.count() << " ms";
+
+		mLastBurstStats = mBurstStats;
+		mBurstStats = BringUpStats();
+	}
+}
+
+void BackendBase::updateBringUpStats(milliseconds latency)
+{
+	if (!mBurstStats.numFrontends || latency < mBurstStats.minLatency)
+	{
+		mBurstStats.minLatency = latency;
+	}
+
+	if (latency > mBurstStats.maxLatency)
+	{
+		mBurstStats.maxLatency = latency;
+	}
+
+	// keeps the sum till the burst is finished
+	mBurstStats.averageLatency += latency;
+	mBurstStats.numFrontends++;
 }
 
 FrontendHandlerPtr BackendBase::getFrontendHandler(domid_t domId,
 												   uint16_t devId)
 {
-	auto it = find_if(mFrontendHandlers.begin(), mFrontendHandlers.end(),
-					  [&](FrontendHandlerPtr frontend) {
-							return (frontend->getDomId() == domId) &&
-								   (frontend->getDevId() == devId); } );
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mFrontendHandlers.find(getFrontendKey(domId, devId));
 
 	if (it != mFrontendHandlers.end())
 	{
-		return *it;
+		return it->second;
 	}
 
 	return FrontendHandlerPtr();
@@ -0,0 +1,662 @@
+/*
+ *  Binary log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "BinaryLog.hpp"
+
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using std::atomic;
+using std::atomic_bool;
+using std::ifstream;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+namespace XenBackend {
+
+/*
+ * File layout:
+ *
+ * file header: magic[8], u32 version, u32 reserved
+ * record:      u32 type, u32 size (including type and size), body
+ *
+ * format body: u32 id, u32 level, u32 line, u32 len, file, u32 len, format
+ * event body:  u32 id, u32 numArgs, u64 time in ns, u32 len, module name,
+ *              args: u8 tag, u32 len and bytes for string or 8 bytes value
+ *
+ * Records are aligned to 4 bytes. The record size is stored on reservation
+ * and the type is stored last, thus type 0 with valid size marks a record
+ * which is not committed yet and is skipped, and size 0 marks the end of
+ * written records.
+ */
+
+namespace {
+
+const char cMagic[8] = {'X', 'E', 'N', 'B', 'E', 'L', 'O', 'G'};
+const uint32_t cVersion = 1;
+const size_t cFileHeaderSize = 16;
+const size_t cRecordHeaderSize = 8;
+// module name length when the source file and line are displayed instead
+const uint32_t cNoName = UINT32_MAX;
+
+enum RecordType : uint32_t
+{
+	RECORD_END = 0,
+	RECORD_FORMAT = 1,
+	RECORD_EVENT = 2
+};
+
+size_t alignRecord(size_t size)
+{
+	return (size + 3) & ~static_cast<size_t>(3);
+}
+
+template<typename T>
+char* put(char* pos, T value)
+{
+	memcpy(pos, &value, sizeof(value));
+
+	return pos + sizeof(value);
+}
+
+char* put(char* pos, const char* data, size_t size)
+{
+	pos = put<uint32_t>(pos, size);
+
+	memcpy(pos, data, size);
+
+	return pos + size;
+}
+
+void commitRecord(char* record, RecordType type)
+{
+	__atomic_store_n(reinterpret_cast<uint32_t*>(record), type,
+					 __ATOMIC_RELEASE);
+}
+
+class Parser
+{
+public:
+
+	Parser(const char* data, size_t size) : mPos(data), mEnd(data + size) {}
+
+	template<typename T>
+	T get()
+	{
+		T value;
+
+		check(sizeof(value));
+		memcpy(&value, mPos, sizeof(value));
+		mPos += sizeof(value);
+
+		return value;
+	}
+
+	const char* getData(size_t size)
+	{
+		check(size);
+
+		auto data = mPos;
+
+		mPos += size;
+
+		return data;
+	}
+
+private:
+
+	const char* mPos;
+	const char* mEnd;
+
+	void check(size_t size)
+	{
+		if (size > static_cast<size_t>(mEnd - mPos))
+		{
+			throw BinaryLogException("Corrupted binary log record", EINVAL);
+		}
+	}
+};
+
+const char* levelToString(LogLevel level)
+{
+	static const char* buffer[] = {"", "ERR", "WRN", "INF", "DBG"};
+
+	auto index = static_cast<size_t>(level);
+
+	return index < sizeof(buffer) / sizeof(buffer[0]) ? buffer[index] : "";
+}
+
+}
+
+/*******************************************************************************
+ * BinaryLog
+ ******************************************************************************/
+
+atomic_bool BinaryLog::sOpened(false);
+atomic<LogLevel> BinaryLog::sLevel(LogLevel::logDEBUG);
+atomic<size_t> BinaryLog::sNumDropped(0);
+atomic<int> BinaryLog::sNumWriting(0);
+atomic<size_t> BinaryLog::sOffset(0);
+char* BinaryLog::sBuffer = nullptr;
+size_t BinaryLog::sSize = 0;
+int BinaryLog::sFd = -1;
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void BinaryLog::open(const string& path, size_t size)
+{
+	lock_guard<mutex> lock(getMutex());
+
+	if (sOpened)
+	{
+		throw BinaryLogException("Binary log is already opened", EPERM);
+	}
+
+	if (size < cFileHeaderSize)
+	{
+		throw BinaryLogException("Binary log size is too small", EINVAL);
+	}
+
+	sFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (sFd < 0)
+	{
+		throw BinaryLogException("Can't open binary log: " + path, errno);
+	}
+
+	if (ftruncate(sFd, size) < 0)
+	{
+		auto error = errno;
+
+		::close(sFd);
+
+		throw BinaryLogException("Can't resize binary log: " + path, error);
+	}
+
+	auto buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+					   sFd, 0);
+
+	if (buffer == MAP_FAILED)
+	{
+		auto error = errno;
+
+		::close(sFd);
+
+		throw BinaryLogException("Can't map binary log: " + path, error);
+	}
+
+	sBuffer = static_cast<char*>(buffer);
+	sSize = size;
+	sNumDropped = 0;
+
+	memcpy(sBuffer, cMagic, sizeof(cMagic));
+
+	auto pos = put(sBuffer + sizeof(cMagic), cVersion);
+	put<uint32_t>(pos, 0);
+
+	sOffset = cFileHeaderSize;
+
+	// call sites registered before are not registered again
+	auto& formats = getFormats();
+
+	for (size_t i = 0; i < formats.size(); i++)
+	{
+		writeFormat(i + 1, formats[i]);
+	}
+
+	sOpened = true;
+}
+
+void BinaryLog::close()
+{
+	if (!sOpened.exchange(false))
+	{
+		return;
+	}
+
+	while (sNumWriting)
+	{
+		std::this_thread::yield();
+	}
+
+	lock_guard<mutex> lock(getMutex());
+
+	auto size = min<size_t>(sOffset, sSize);
+
+	msync(sBuffer, sSize, MS_SYNC);
+	munmap(sBuffer, sSize);
+
+	if (ftruncate(sFd, size) < 0)
+	{
+		LOG("BinaryLog", ERROR) << "Can't truncate binary log, error: "
+								<< strerror(errno);
+	}
+
+	::close(sFd);
+
+	sBuffer = nullptr;
+	sSize = 0;
+	sFd = -1;
+}
+
+string BinaryLog::render(const char* format, const Value* values,
+						 size_t count)
+{
+	ostringstream stream;
+	size_t index = 0;
+
+	for (auto pos = format; *pos; pos++)
+	{
+		if (pos[0] != '{' || pos[1] != '}' || index >= count)
+		{
+			stream << *pos;
+
+			continue;
+		}
+
+		auto& value = values[index++];
+
+		switch (value.tag)
+		{
+		case TAG_INT:
+			stream << value.i;
+			break;
+
+		case TAG_UINT:
+			stream << value.u;
+			break;
+
+		case TAG_BOOL:
+			stream << (value.u != 0);
+			break;
+
+		case TAG_DOUBLE:
+			stream << value.d;
+			break;
+
+		case TAG_STRING:
+			stream.write(value.data(), value.size());
+			break;
+
+		case TAG_POINTER:
+			stream << reinterpret_cast<void*>(value.u);
+			break;
+
+		default:
+			break;
+		}
+
+		pos++;
+	}
+
+	return stream.str();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+mutex& BinaryLog::getMutex()
+{
+	static mutex sMutex;
+
+	return sMutex;
+}
+
+vector<BinaryLog::Format>& BinaryLog::getFormats()
+{
+	static vector<Format> sFormats;
+
+	return sFormats;
+}
+
+bool BinaryLog::writeRecord(const char* name, LogLevel level, const char* file,
+							int line, atomic<uint32_t>& id, const char* format,
+							const Value* values, size_t count)
+{
+	sNumWriting++;
+
+	if (!sOpened)
+	{
+		sNumWriting--;
+
+		return false;
+	}
+
+	auto formatId = id.load(std::memory_order_acquire);
+
+	if (formatId == 0)
+	{
+		formatId = registerFormat(level, file, line, id, format);
+	}
+
+	uint32_t nameLen = name ? strlen(name) : cNoName;
+	size_t size = cRecordHeaderSize + 3 * sizeof(uint32_t) +
+				  sizeof(uint64_t) + (name ? nameLen : 0);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		size += sizeof(uint8_t) + (values[i].tag == TAG_STRING ?
+				sizeof(uint32_t) + values[i].size() : sizeof(uint64_t));
+	}
+
+	size = alignRecord(size);
+
+	auto record = reserve(size);
+
+	if (record)
+	{
+		auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+
+		auto pos = put<uint32_t>(record + cRecordHeaderSize, formatId);
+
+		pos = put<uint32_t>(pos, count);
+		pos = put<uint64_t>(pos, time);
+
+		if (name)
+		{
+			pos = put(pos, name, nameLen);
+		}
+		else
+		{
+			pos = put<uint32_t>(pos, cNoName);
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			pos = put<uint8_t>(pos, values[i].tag);
+
+			if (values[i].tag == TAG_STRING)
+			{
+				pos = put(pos, values[i].data(), values[i].size());
+			}
+			else
+			{
+				pos = put<uint64_t>(pos, values[i].u);
+			}
+		}
+
+		commitRecord(record, RECORD_EVENT);
+	}
+
+	sNumWriting--;
+
+	return true;
+}
+
+uint32_t BinaryLog::registerFormat(LogLevel level, const char* file, int line,
+								   atomic<uint32_t>& id, const char* format)
+{
+	lock_guard<mutex> lock(getMutex());
+
+	uint32_t formatId = id;
+
+	// registered by another thread
+	if (formatId)
+	{
+		return formatId;
+	}
+
+	auto& formats = getFormats();
+
+	formats.push_back({file, static_cast<uint32_t>(line), level, format});
+
+	formatId = formats.size();
+
+	// the format is written before any event which uses it
+	writeFormat(formatId, formats.back());
+
+	id.store(formatId, std::memory_order_release);
+
+	return formatId;
+}
+
+void BinaryLog::writeFormat(uint32_t id, const Format& format)
+{
+	auto size = alignRecord(cRecordHeaderSize + 5 * sizeof(uint32_t) +
+							format.file.length() + format.format.length());
+
+	auto record = reserve(size);
+
+	if (!record)
+	{
+		return;
+	}
+
+	auto pos = put<uint32_t>(record + cRecordHeaderSize, id);
+
+	pos = put<uint32_t>(pos, static_cast<uint32_t>(format.level));
+	pos = put<uint32_t>(pos, format.line);
+	pos = put(pos, format.file.c_str(), format.file.length());
+	put(pos, format.format.c_str(), format.format.length());
+
+	commitRecord(record, RECORD_FORMAT);
+}
+
+char* BinaryLog::reserve(size_t size)
+{
+	auto offset = sOffset.fetch_add(size);
+
+	if (offset + size > sSize)
+	{
+		sNumDropped++;
+
+		return nullptr;
+	}
+
+	auto record = sBuffer + offset;
+
+	// the reader skips the record by the size till the type is committed
+	put<uint32_t>(record + sizeof(uint32_t), size);
+
+	return record;
+}
+
+/*******************************************************************************
+ * BinaryLogReader
+ ******************************************************************************/
+
+BinaryLogReader::BinaryLogReader(const string& path) :
+	mOffset(cFileHeaderSize)
+{
+	ifstream file(path, std::ios::binary);
+
+	if (!file)
+	{
+		throw BinaryLogException("Can't open binary log: " + path, ENOENT);
+	}
+
+	mData.assign(std::istreambuf_iterator<char>(file),
+				 std::istreambuf_iterator<char>());
+
+	if (mData.size() < cFileHeaderSize ||
+		memcmp(mData.data(), cMagic, sizeof(cMagic)) != 0)
+	{
+		throw BinaryLogException("Not a binary log: " + path, EINVAL);
+	}
+
+	uint32_t version;
+
+	memcpy(&version, &mData[sizeof(cMagic)], sizeof(version));
+
+	if (version != cVersion)
+	{
+		throw BinaryLogException("Unsupported binary log version: " +
+								 std::to_string(version), EINVAL);
+	}
+
+	// formats may be written after the events which use them
+	uint32_t type, size;
+
+	for (auto offset = mOffset; readRecord(offset, type, size); offset += size)
+	{
+		if (type != RECORD_FORMAT)
+		{
+			continue;
+		}
+
+		Parser parser(&mData[offset + cRecordHeaderSize],
+					  size - cRecordHeaderSize);
+
+		auto id = parser.get<uint32_t>();
+		auto& format = mFormats[id];
+
+		format.level = static_cast<LogLevel>(parser.get<uint32_t>());
+		format.line = parser.get<uint32_t>();
+
+		auto len = parser.get<uint32_t>();
+
+		format.file.assign(parser.getData(len), len);
+
+		len = parser.get<uint32_t>();
+
+		format.format.assign(parser.getData(len), len);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+bool BinaryLogReader::readLine(string& line)
+{
+	uint32_t type, size;
+
+	while (readRecord(mOffset, type, size))
+	{
+		auto offset = mOffset;
+
+		mOffset += size;
+
+		if (type == RECORD_EVENT)
+		{
+			line = readEvent(&mData[offset + cRecordHeaderSize],
+							 size - cRecordHeaderSize);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+bool BinaryLogReader::readRecord(size_t offset, uint32_t& type, uint32_t& size)
+{
+	if (offset + cRecordHeaderSize > mData.size())
+	{
+		return false;
+	}
+
+	memcpy(&type, &mData[offset], sizeof(type));
+	memcpy(&size, &mData[offset + sizeof(type)], sizeof(size));
+
+	auto valid = size >= cRecordHeaderSize && size <= mData.size() - offset;
+
+	// not committed record is skipped by the caller as unknown type
+	if (type == RECORD_END)
+	{
+		return valid;
+	}
+
+	if (!valid)
+	{
+		throw BinaryLogException("Corrupted binary log record", EINVAL);
+	}
+
+	return true;
+}
+
+string BinaryLogReader::readEvent(const char* data, size_t size)
+{
+	Parser parser(data, size);
+
+	auto id = parser.get<uint32_t>();
+	auto count = parser.get<uint32_t>();
+	auto time = parser.get<uint64_t>();
+	auto nameLen = parser.get<uint32_t>();
+
+	auto it = mFormats.find(id);
+
+	if (it == mFormats.end())
+	{
+		throw BinaryLogException("Unknown binary log format: " +
+								 std::to_string(id), EINVAL);
+	}
+
+	auto& format = it->second;
+	string header;
+
+	if (nameLen == cNoName)
+	{
+		header = format.file + " " + std::to_string(format.line);
+	}
+	else
+	{
+		header.assign(parser.getData(nameLen), nameLen);
+	}
+
+	vector<BinaryLog::Value> values(count);
+
+	for (auto& value : values)
+	{
+		value.tag = static_cast<BinaryLog::Tag>(parser.get<uint8_t>());
+
+		if (value.tag == BinaryLog::TAG_STRING)
+		{
+			value.len = parser.get<uint32_t>();
+			value.str = parser.getData(value.len);
+		}
+		else
+		{
+			value.u = parser.get<uint64_t>();
+		}
+	}
+
+	time_t seconds = time / 1000000000;
+	int ms = (time / 1000000) % 1000;
+	tm localTime;
+	char prefix[32];
+	char timeStr[40];
+
+	localtime_r(&seconds, &localTime);
+	strftime(prefix, sizeof(prefix), "%d.%m.%y %X.", &localTime);
+	snprintf(timeStr, sizeof(timeStr), "%s%03d", prefix, ms);
+
+	return string(timeStr) + " | " + header + " | " +
+		   levelToString(format.level) + " - " +
+		   BinaryLog::render(format.format.c_str(), values.data(),
+							 values.size());
+}
+
+}
@@ -23,6 +23,7 @@
 #include <algorithm>
 #include <functional>
 #include <sstream>
+#include <unordered_map>
 
 extern "C" {
 #include "xenstore.h"
@@ -0,0 +1,591 @@
+/*
+ *  Host I/O queue
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "HostIo.hpp"
+
+#include <cstring>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(HAS_IO_URING) && defined(__NR_io_uring_setup)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+using std::max;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * HostIoQueue
+ ******************************************************************************/
+
+HostIoQueue::HostIoQueue(unsigned int depth, bool useUring) :
+	mEventFd(-1),
+	mRingFd(-1),
+	mSq({nullptr, nullptr, nullptr, nullptr, 0}),
+	mCq({nullptr, nullptr, nullptr, nullptr, 0}),
+	mSqArray(nullptr),
+	mSqes(nullptr),
+	mSqesSize(0),
+	mCqes(nullptr),
+	mNumCompletedReaped(0),
+	mNumUnsubmitted(0),
+	mLog("HostIoQueue")
+{
+	try
+	{
+		init(depth, useUring);
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+HostIoQueue::~HostIoQueue()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void HostIoQueue::read(int fd, void* buffer, size_t size, off_t offset,
+					   Completion completion)
+{
+	queue(OP_READ, fd, buffer, size, offset, std::move(completion));
+}
+
+void HostIoQueue::write(int fd, const void* buffer, size_t size, off_t offset,
+						Completion completion)
+{
+	queue(OP_WRITE, fd, const_cast<void*>(buffer), size, offset,
+		  std::move(completion));
+}
+
+void HostIoQueue::fsync(int fd, Completion completion)
+{
+	queue(OP_FSYNC, fd, nullptr, 0, 0, std::move(completion));
+}
+
+size_t HostIoQueue::submit()
+{
+	if (!mNumUnsubmitted)
+	{
+		return 0;
+	}
+
+	auto count = isUring() ? submitUring() : submitSync();
+
+	DLOG(mLog, DEBUG) << "Submit operations: " << count;
+
+	return count;
+}
+
+size_t HostIoQueue::reap()
+{
+	clearEventFd();
+
+	auto count = isUring() ? reapUring(true) : reapSync();
+
+	submit();
+
+	return count;
+}
+
+void HostIoQueue::wait()
+{
+	while (getNumPending())
+	{
+		submit();
+
+		if (!reap())
+		{
+			waitRunning();
+		}
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void HostIoQueue::init(unsigned int depth, bool useUring)
+{
+	if (depth == 0)
+	{
+		throw HostIoException("Wrong queue depth", EINVAL);
+	}
+
+	mOps.resize(depth);
+	mFreeOps.reserve(depth);
+	mQueued.reserve(depth);
+	mCompleted.reserve(depth);
+
+	// the first allocated operation is at the back
+	for (auto index = depth; index > 0; index--)
+	{
+		mFreeOps.push_back(index - 1);
+	}
+
+	mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (mEventFd < 0)
+	{
+		throw HostIoException("Can't create event fd", errno);
+	}
+
+	if (useUring && !initUring(depth))
+	{
+		LOG(mLog, WARNING) << "io_uring is not available, "
+						   << "operations are synchronous";
+	}
+
+	LOG(mLog, DEBUG) << "Create queue, depth: " << depth
+					 << ", io_uring: " << isUring();
+}
+
+bool HostIoQueue::initUring(unsigned int depth)
+{
+#ifdef USE_IO_URING
+	io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+
+	auto fd = syscall(__NR_io_uring_setup, depth, &params);
+
+	if (fd < 0)
+	{
+		LOG(mLog, DEBUG) << "Can't setup io_uring, error: " << strerror(errno);
+
+		return false;
+	}
+
+	mRingFd = fd;
+
+	mSq.size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	mCq.size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		mSq.size = mCq.size = max(mSq.size, mCq.size);
+	}
+
+	mSq.ptr = mmap(nullptr, mSq.size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+
+	if (mSq.ptr == MAP_FAILED)
+	{
+		mSq.ptr = nullptr;
+
+		throw HostIoException("Can't map submission ring", errno);
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		mCq.ptr = mSq.ptr;
+	}
+	else
+	{
+		mCq.ptr = mmap(nullptr, mCq.size, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+
+		if (mCq.ptr == MAP_FAILED)
+		{
+			mCq.ptr = nullptr;
+
+			throw HostIoException("Can't map completion ring", errno);
+		}
+	}
+
+	mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	mSqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+
+	if (mSqes == MAP_FAILED)
+	{
+		mSqes = nullptr;
+
+		throw HostIoException("Can't map submission entries", errno);
+	}
+
+	auto sq = static_cast<uint8_t*>(mSq.ptr);
+	auto cq = static_cast<uint8_t*>(mCq.ptr);
+
+	mSq.head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	mSq.tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	mSq.mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+	mCq.head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	mCq.tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	mCq.mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	mCqes = cq + params.cq_off.cqes;
+
+	if (syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_EVENTFD,
+				&mEventFd, 1) < 0)
+	{
+		throw HostIoException("Can't register event fd", errno);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void HostIoQueue::release()
+{
+	if (isUring())
+	{
+		try
+		{
+			// unsubmitted operations stay in the submission ring, only the
+			// running ones have to be waited for
+			while (getNumPending() > mNumUnsubmitted)
+			{
+				waitCompletions(1);
+				reapUring(false);
+			}
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+		}
+	}
+
+	if (mSqes)
+	{
+		munmap(mSqes, mSqesSize);
+	}
+
+	if (mCq.ptr && mCq.ptr != mSq.ptr)
+	{
+		munmap(mCq.ptr, mCq.size);
+	}
+
+	if (mSq.ptr)
+	{
+		munmap(mSq.ptr, mSq.size);
+	}
+
+	if (mRingFd >= 0)
+	{
+		close(mRingFd);
+	}
+
+	if (mEventFd >= 0)
+	{
+		close(mEventFd);
+	}
+}
+
+void HostIoQueue::queue(OpCode opcode, int fd, void* buffer, size_t size,
+						off_t offset, Completion completion)
+{
+	while (mFreeOps.empty())
+	{
+		submit();
+
+		if (!reap())
+		{
+			waitRunning();
+		}
+	}
+
+	auto index = mFreeOps.back();
+	auto& op = mOps[index];
+
+	op.opcode = opcode;
+	op.fd = fd;
+	op.iov.iov_base = buffer;
+	op.iov.iov_len = size;
+	op.offset = offset;
+	op.result = 0;
+	op.completion = std::move(completion);
+
+	mFreeOps.pop_back();
+
+	if (isUring())
+	{
+		queueUring(index);
+	}
+	else
+	{
+		mQueued.push_back(index);
+	}
+
+	mNumUnsubmitted++;
+}
+
+void HostIoQueue::queueUring(uint32_t index)
+{
+#ifdef USE_IO_URING
+	auto& op = mOps[index];
+
+	// the submission ring has at least depth entries, thus it can't be full
+	auto tail = *mSq.tail;
+	auto i = tail & *mSq.mask;
+	auto sqe = &static_cast<io_uring_sqe*>(mSqes)[i];
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	sqe->fd = op.fd;
+	sqe->user_data = index;
+
+	switch(op.opcode)
+	{
+	case OP_READ:
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = reinterpret_cast<uintptr_t>(&op.iov);
+		sqe->len = 1;
+		sqe->off = op.offset;
+		break;
+
+	case OP_WRITE:
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = reinterpret_cast<uintptr_t>(&op.iov);
+		sqe->len = 1;
+		sqe->off = op.offset;
+		break;
+
+	case OP_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	}
+
+	mSqArray[i] = i;
+
+	__atomic_store_n(mSq.tail, tail + 1, __ATOMIC_RELEASE);
+#endif
+}
+
+size_t HostIoQueue::submitUring()
+{
+	size_t count = 0;
+
+#ifdef USE_IO_URING
+	while (mNumUnsubmitted)
+	{
+		auto ret = syscall(__NR_io_uring_enter, mRingFd, mNumUnsubmitted, 0, 0,
+						   nullptr, 0);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			// not enough resources or the completion ring is full: the rest
+			// is submitted by reap(), the event fd is armed to call it even
+			// if there are no running operations
+			if (errno == EAGAIN || errno == EBUSY)
+			{
+				uint64_t value = 1;
+
+				if (::write(mEventFd, &value, sizeof(value)) < 0)
+				{
+					throw HostIoException("Can't write event fd", errno);
+				}
+
+				break;
+			}
+
+			throw HostIoException("Can't submit operations", errno);
+		}
+
+		if (ret == 0)
+		{
+			break;
+		}
+
+		mNumUnsubmitted -= ret;
+		count += ret;
+	}
+#endif
+
+	return count;
+}
+
+size_t HostIoQueue::submitSync()
+{
+	for (auto index : mQueued)
+	{
+		execute(mOps[index]);
+
+		mCompleted.push_back(index);
+	}
+
+	auto count = mQueued.size();
+
+	mQueued.clear();
+	mNumUnsubmitted = 0;
+
+	uint64_t value = 1;
+
+	if (::write(mEventFd, &value, sizeof(value)) < 0)
+	{
+		throw HostIoException("Can't write event fd", errno);
+	}
+
+	return count;
+}
+
+void HostIoQueue::waitCompletions(unsigned int count)
+{
+#ifdef USE_IO_URING
+	if (!isUring())
+	{
+		return;
+	}
+
+	while (syscall(__NR_io_uring_enter, mRingFd, 0, count,
+				   IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			throw HostIoException("Can't wait for completions", errno);
+		}
+	}
+#endif
+}
+
+void HostIoQueue::waitRunning()
+{
+	// nothing is running if the submission is postponed: retry it
+	if (getNumPending() > mNumUnsubmitted)
+	{
+		waitCompletions(1);
+	}
+	else
+	{
+		std::this_thread::yield();
+	}
+}
+
+size_t HostIoQueue::reapUring(bool call)
+{
+	size_t count = 0;
+
+#ifdef USE_IO_URING
+	// the head is read on each iteration as completions may reap recursively
+	while (true)
+	{
+		auto head = *mCq.head;
+
+		if (head == __atomic_load_n(mCq.tail, __ATOMIC_ACQUIRE))
+		{
+			break;
+		}
+
+		auto cqe = &static_cast<io_uring_cqe*>(mCqes)[head & *mCq.mask];
+		uint32_t index = cqe->user_data;
+		ssize_t result = cqe->res;
+
+		__atomic_store_n(mCq.head, head + 1, __ATOMIC_RELEASE);
+
+		complete(index, result, call);
+
+		count++;
+	}
+#endif
+
+	return count;
+}
+
+size_t HostIoQueue::reapSync()
+{
+	size_t count = 0;
+
+	// completions may reap recursively: the position is kept in the member
+	while (mNumCompletedReaped < mCompleted.size())
+	{
+		auto index = mCompleted[mNumCompletedReaped++];
+
+		complete(index, mOps[index].result, true);
+
+		count++;
+	}
+
+	mCompleted.clear();
+	mNumCompletedReaped = 0;
+
+	return count;
+}
+
+void HostIoQueue::complete(uint32_t index, ssize_t result, bool call)
+{
+	// the operation is freed before the call to be reused by the completion
+	Completion completion(std::move(mOps[index].completion));
+
+	mFreeOps.push_back(index);
+
+	if (call && completion)
+	{
+		completion(result);
+	}
+}
+
+void HostIoQueue::execute(Op& op)
+{
+	ssize_t ret = 0;
+
+	do
+	{
+		switch(op.opcode)
+		{
+		case OP_READ:
+			ret = pread(op.fd, op.iov.iov_base, op.iov.iov_len, op.offset);
+			break;
+
+		case OP_WRITE:
+			ret = pwrite(op.fd, op.iov.iov_base, op.iov.iov_len, op.offset);
+			break;
+
+		case OP_FSYNC:
+			ret = ::fsync(op.fd);
+			break;
+		}
+	}
+	while (ret < 0 && errno == EINTR);
+
+	op.result = ret < 0 ? -errno : ret;
+}
+
+void HostIoQueue::clearEventFd()
+{
+	uint64_t value;
+
+	if (::read(mEventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		throw HostIoException("Can't read event fd", errno);
+	}
+}
+
+}
@@ -0,0 +1,366 @@
+/*
+ *  Backend log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Log.hpp"
+
+using std::atomic;
+using std::atomic_bool;
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::mutex;
+using std::remove_if;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * LogWriter::ThreadBuffer
+ ******************************************************************************/
+
+/*
+ * Ring of lines with one producer (the logging thread) and one consumer (the
+ * writer thread). The lines are moved in and out, thus they aren't copied.
+ * head and tail count lines, headBytes and tailBytes count their bytes, all
+ * of them grow monotonically.
+ */
+struct LogWriter::ThreadBuffer
+{
+	// lines shorter than this take more than their share of the buffer
+	static const size_t cMinLineSize = 32;
+
+	ThreadBuffer(size_t size, unsigned generation) :
+		lines(std::max<size_t>(size / cMinLineSize, 1)), size(size),
+		head(0), tail(0), headBytes(0), tailBytes(0), generation(generation),
+		writing(false), signalled(false), detached(false)
+	{
+	}
+
+	bool push(string&& line)
+	{
+		auto pos = head.load(std::memory_order_relaxed);
+		auto bytes = headBytes.load(std::memory_order_relaxed) + line.length();
+
+		if (pos - tail.load(std::memory_order_acquire) == lines.size() ||
+			bytes - tailBytes.load(std::memory_order_acquire) > size)
+		{
+			return false;
+		}
+
+		lines[pos % lines.size()] = std::move(line);
+
+		headBytes.store(bytes, std::memory_order_relaxed);
+		head.store(pos + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	void pop(std::ostream& output)
+	{
+		auto pos = tail.load(std::memory_order_relaxed);
+		auto end = head.load(std::memory_order_acquire);
+		auto bytes = tailBytes.load(std::memory_order_relaxed);
+
+		for (; pos < end; pos++)
+		{
+			auto& line = lines[pos % lines.size()];
+
+			output.write(line.data(), line.length()).put('\n');
+
+			bytes += line.length();
+
+			line.clear();
+		}
+
+		tailBytes.store(bytes, std::memory_order_release);
+		tail.store(pos, std::memory_order_release);
+
+		signalled.store(false, std::memory_order_relaxed);
+	}
+
+	bool isEmpty() const { return head == tail; }
+
+	bool isHalfFull() const
+	{
+		return (head - tail) > lines.size() / 2 ||
+			   (headBytes - tailBytes) > size / 2;
+	}
+
+	vector<string> lines;
+	size_t size;
+	atomic<size_t> head;
+	atomic<size_t> tail;
+	atomic<size_t> headBytes;
+	atomic<size_t> tailBytes;
+	unsigned generation;
+	// the logging thread is inside write(): stop() waits for it
+	atomic_bool writing;
+	// the writer thread is notified, reset by the drain
+	atomic_bool signalled;
+	// the logging thread is finished
+	atomic_bool detached;
+};
+
+/*******************************************************************************
+ * LogWriter
+ ******************************************************************************/
+
+atomic_bool LogWriter::sStarted(false);
+atomic<size_t> LogWriter::sNumDropped(0);
+
+LogWriter::LogWriter() :
+	mTerminate(true),
+	mBufferSize(cDefaultBufferSize),
+	mDrainPeriodMs(cDefaultDrainPeriodMs),
+	mGeneration(0)
+{
+}
+
+LogWriter::~LogWriter()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void LogWriter::start(size_t bufferSize, int drainPeriodMs)
+{
+	auto& writer = getInstance();
+
+	lock_guard<mutex> itfLock(writer.mItfMutex);
+
+	if (sStarted)
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(writer.mMutex);
+
+		writer.mBufferSize = bufferSize;
+		writer.mDrainPeriodMs = drainPeriodMs;
+		writer.mTerminate = false;
+		writer.mGeneration++;
+	}
+
+	writer.mThread = thread(&LogWriter::run, &writer);
+
+	sStarted = true;
+}
+
+void LogWriter::stop()
+{
+	getInstance().release();
+}
+
+bool LogWriter::write(string&& line)
+{
+	if (!sStarted)
+	{
+		return false;
+	}
+
+	auto& writer = getInstance();
+	auto& buffer = getThreadBuffer();
+
+	if (!buffer || buffer->generation != writer.mGeneration)
+	{
+		lock_guard<mutex> lock(writer.mMutex);
+
+		buffer.reset(new ThreadBuffer(writer.mBufferSize,
+									  writer.mGeneration));
+
+		writer.mBuffers.push_back(buffer);
+	}
+
+	// the fence is per thread: stop() checks the flags of all buffers, thus
+	// the logging threads don't share a counter
+	buffer->writing = true;
+
+	// stop() may be called meanwhile
+	if (!sStarted)
+	{
+		buffer->writing = false;
+
+		return false;
+	}
+
+	if (!buffer->push(std::move(line)))
+	{
+		sNumDropped++;
+	}
+	else if (!buffer->signalled.load(std::memory_order_relaxed) &&
+			 buffer->isHalfFull())
+	{
+		// once per drain, the next lines are written by the same drain
+		buffer->signalled.store(true, std::memory_order_relaxed);
+
+		writer.mCondVar.notify_one();
+	}
+
+	buffer->writing = false;
+
+	return true;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+LogWriter& LogWriter::getInstance()
+{
+	static LogWriter writer;
+
+	return writer;
+}
+
+shared_ptr<LogWriter::ThreadBuffer>& LogWriter::getThreadBuffer()
+{
+	struct Holder
+	{
+		~Holder()
+		{
+			if (buffer)
+			{
+				buffer->detached = true;
+			}
+		}
+
+		shared_ptr<ThreadBuffer> buffer;
+	};
+
+	static thread_local Holder holder;
+
+	return holder.buffer;
+}
+
+void LogWriter::release()
+{
+	lock_guard<mutex> itfLock(mItfMutex);
+
+	if (!sStarted)
+	{
+		return;
+	}
+
+	sStarted = false;
+
+	// lines being put now should be written by the final drain. Buffers
+	// created meanwhile see the writer stopped.
+	vector<shared_ptr<ThreadBuffer>> buffers;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		buffers = mBuffers;
+	}
+
+	for (auto& buffer : buffers)
+	{
+		while (buffer->writing)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	drain();
+
+	lock_guard<mutex> lock(mMutex);
+
+	mBuffers.clear();
+}
+
+void LogWriter::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while (!mTerminate)
+	{
+		mCondVar.wait_for(lock, milliseconds(mDrainPeriodMs));
+
+		lock.unlock();
+
+		drain();
+
+		lock.lock();
+	}
+}
+
+void LogWriter::drain()
+{
+	vector<shared_ptr<ThreadBuffer>> buffers;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		buffers = mBuffers;
+	}
+
+	{
+		// the lines are written straight from the thread buffers
+		lock_guard<mutex> lock(Log::getOutputMutex());
+
+		bool written = false;
+
+		for (auto& buffer : buffers)
+		{
+			if (!buffer->isEmpty())
+			{
+				buffer->pop(Log::getOutputStream());
+
+				written = true;
+			}
+		}
+
+		if (written)
+		{
+			Log::getOutputStream().flush();
+		}
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	// buffers of finished threads are removed once they are written
+	mBuffers.erase(remove_if(mBuffers.begin(), mBuffers.end(),
+							 [](const shared_ptr<ThreadBuffer>& buffer)
+							 { return buffer->detached &&
+									  buffer->isEmpty(); }),
+				   mBuffers.end());
+}
+
+}
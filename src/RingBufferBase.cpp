@@ -23,21 +23,303 @@
 #include "Log.hpp"
 
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::make_tuple;
+using std::mutex;
+using std::shared_ptr;
+using std::vector;
 
 namespace XenBackend {
 
+/*******************************************************************************
+ * RingBufferCache
+ ******************************************************************************/
+
+RingBufferCache::RingBufferCache() :
+	mGracePeriod(0),
+	mStats({0, 0, 0, 0}),
+	mLog("RingBufferCache"),
+	mXenInterfaceOpened(false),
+	mTimer(bind(&RingBufferCache::purge, this), true)
+{
+	// cached buffers are unmapped with the grant table handle: make sure it
+	// is destroyed after the cache
+	XenGnttab::getHandle();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void RingBufferCache::setGracePeriod(milliseconds period)
+{
+	auto& cache = getInstance();
+
+	cache.mTimer.stop();
+
+	vector<shared_ptr<RingBufferResources>> released;
+
+	{
+		lock_guard<mutex> lock(cache.mMutex);
+
+		cache.mGracePeriod = period;
+
+		if (period == milliseconds(0))
+		{
+			for (auto& entry : cache.mEntries)
+			{
+				released.push_back(entry.second.resources);
+			}
+
+			cache.mEntries.clear();
+		}
+	}
+
+	if (period != milliseconds(0))
+	{
+		cache.mTimer.start(period);
+	}
+
+	LOG(cache.mLog, DEBUG) << "Set grace period: " << period.count() << " ms";
+}
+
+milliseconds RingBufferCache::getGracePeriod()
+{
+	auto& cache = getInstance();
+
+	lock_guard<mutex> lock(cache.mMutex);
+
+	return cache.mGracePeriod;
+}
+
+void RingBufferCache::clear(domid_t domId)
+{
+	auto& cache = getInstance();
+
+	vector<shared_ptr<RingBufferResources>> released;
+
+	lock_guard<mutex> lock(cache.mMutex);
+
+	auto begin = cache.mEntries.lower_bound(make_tuple(domId, 0, 0));
+	auto end = begin;
+
+	while (end != cache.mEntries.end() && std::get<0>(end->first) == domId)
+	{
+		released.push_back(end->second.resources);
+		end++;
+	}
+
+	if (begin != end)
+	{
+		LOG(cache.mLog, DEBUG) << "Clear dom: " << domId
+							   << ", entries: " << released.size();
+	}
+
+	cache.mEntries.erase(begin, end);
+}
+
+size_t RingBufferCache::size()
+{
+	auto& cache = getInstance();
+
+	lock_guard<mutex> lock(cache.mMutex);
+
+	return cache.mEntries.size();
+}
+
+RingBufferCache::Stats RingBufferCache::getStats()
+{
+	auto& cache = getInstance();
+
+	lock_guard<mutex> lock(cache.mMutex);
+
+	return cache.mStats;
+}
+
+shared_ptr<RingBufferResources> RingBufferCache::take(domid_t domId,
+													  evtchn_port_t port,
+													  grant_ref_t ref)
+{
+	auto& cache = getInstance();
+	shared_ptr<RingBufferResources> resources;
+
+	{
+		lock_guard<mutex> lock(cache.mMutex);
+
+		auto it = cache.mEntries.find(make_tuple(domId, port, ref));
+
+		if (it != cache.mEntries.end())
+		{
+			resources = it->second.resources;
+
+			cache.mEntries.erase(it);
+		}
+	}
+
+	// the frontend may have closed the port while the resources were cached
+	if (resources && !cache.isBound(domId, port, *resources))
+	{
+		LOG(cache.mLog, WARNING) << "Drop stale dom: " << domId << ", port: "
+								 << port << ", ref: " << ref;
+
+		resources.reset();
+
+		lock_guard<mutex> lock(cache.mMutex);
+
+		cache.mStats.dropped++;
+	}
+
+	{
+		lock_guard<mutex> lock(cache.mMutex);
+
+		if (resources)
+		{
+			cache.mStats.hits++;
+
+			BLOG(cache.mLog, DEBUG, "Reuse dom: {}, port: {}, ref: {}",
+				 domId, port, ref);
+
+			return resources;
+		}
+
+		cache.mStats.misses++;
+	}
+
+	return shared_ptr<RingBufferResources>(
+			new RingBufferResources(domId, port, ref));
+}
+
+void RingBufferCache::put(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+						  shared_ptr<RingBufferResources> resources)
+{
+	auto& cache = getInstance();
+
+	// the replaced resources are released after unlocking
+	shared_ptr<RingBufferResources> released;
+
+	lock_guard<mutex> lock(cache.mMutex);
+
+	if (cache.mGracePeriod == milliseconds(0))
+	{
+		released = resources;
+
+		return;
+	}
+
+	auto& entry = cache.mEntries[make_tuple(domId, port, ref)];
+
+	released = entry.resources;
+
+	entry.resources = resources;
+	entry.deadline = steady_clock::now() + cache.mGracePeriod;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+RingBufferCache& RingBufferCache::getInstance()
+{
+	static RingBufferCache cache;
+
+	return cache;
+}
+
+bool RingBufferCache::isBound(domid_t domId, evtchn_port_t port,
+							  const RingBufferResources& resources)
+{
+	XenInterface* xenInterface = nullptr;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mXenInterfaceOpened)
+		{
+			mXenInterfaceOpened = true;
+
+			try
+			{
+				mXenInterface.reset(new XenInterface());
+			}
+			catch(const XenCtrlException& e)
+			{
+				LOG(mLog, ERROR) << e.what();
+			}
+		}
+
+		xenInterface = mXenInterface.get();
+	}
+
+	if (!xenInterface)
+	{
+		return false;
+	}
+
+	try
+	{
+		xc_evtchn_status_t status;
+
+		xenInterface->getEvtchnStatus(resources.eventChannel.getPort(),
+									  status);
+
+		return status.status == EVTCHNSTAT_interdomain &&
+			   status.u.interdomain.dom == domId &&
+			   status.u.interdomain.port == port;
+	}
+	catch(const XenCtrlException& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	return false;
+}
+
+void RingBufferCache::purge()
+{
+	vector<shared_ptr<RingBufferResources>> released;
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto now = steady_clock::now();
+
+	for (auto it = mEntries.begin(); it != mEntries.end();)
+	{
+		if (it->second.deadline <= now)
+		{
+			BLOG(mLog, DEBUG, "Expired dom: {}, port: {}, ref: {}",
+				 std::get<0>(it->first), std::get<1>(it->first),
+				 std::get<2>(it->first));
+
+			released.push_back(it->second.resources);
+			it = mEntries.erase(it);
+			mStats.expired++;
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
 /*******************************************************************************
  * RingBufferBase
  ******************************************************************************/
 
 RingBufferBase::RingBufferBase(domid_t domId, evtchn_port_t port,
 							   grant_ref_t ref) :
-	mEventChannel(domId, port, [this] { onReceiveIndication(); }),
-	mBuffer(domId, ref, PROT_READ | PROT_WRITE),
+	mResources(RingBufferCache::take(domId, port, ref)),
+	mEventChannel(mResources->eventChannel),
+	mBuffer(mResources->buffer),
 	mLog("RingBuffer"),
+	mDomId(domId),
 	mPort(port),
 	mRef(ref)
 {
+	mEventChannel.setCallback([this] { onReceiveIndication(); });
+	mEventChannel.setErrorCallback(nullptr);
+
 	LOG(mLog, DEBUG) << "Create ring buffer, port: " << mPort
 					 << ", ref: " << mRef;
 }
@@ -46,6 +328,12 @@ RingBufferBase::~RingBufferBase()
 {
 	stop();
 
+	mEventChannel.setCallback(nullptr);
+	mEventChannel.clearFdCallbacks();
+	mEventChannel.setErrorCallback(nullptr);
+
+	RingBufferCache::put(mDomId, mPort, mRef, mResources);
+
 	LOG(mLog, DEBUG) << "Delete ring buffer, port: " << mPort
 					 << ", ref: " << mRef;
 }
@@ -69,4 +357,13 @@ void RingBufferBase::setErrorCallback(ErrorCallback errorCallback)
 	mEventChannel.setErrorCallback(errorCallback);
 }
 
+/*******************************************************************************
+ * Protected
+ ******************************************************************************/
+
+void RingBufferBase::setFdCallback(int fd, XenEvtchn::Callback callback)
+{
+	mEventChannel.setFdCallback(fd, callback);
+}
+
 }
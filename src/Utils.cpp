@@ -20,17 +20,23 @@
 
 #include "Utils.hpp"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <vector>
 
+#include <sys/eventfd.h>
+
 #include "Exception.hpp"
 #include "Version.hpp"
 
 using std::chrono::milliseconds;
 using std::cv_status;
+using std::find_if;
 using std::function;
 using std::lock_guard;
 using std::mutex;
+using std::remove_if;
 using std::string;
 using std::thread;
 using std::to_string;
@@ -94,12 +100,14 @@ PollFd::~PollFd()
 	release();
 }
 
-bool PollFd::poll()
+bool PollFd::poll(int timeout)
 {
-	mFds[PollIndex::FILE].revents = 0;
-	mFds[PollIndex::PIPE].revents = 0;
+	for (auto& fd : mFds)
+	{
+		fd.revents = 0;
+	}
 
-	if (::poll(mFds, 2, -1) < 0)
+	if (::poll(mFds.data(), mFds.size(), timeout) < 0)
 	{
 		if (errno != EINTR)
 		{
@@ -150,6 +158,36 @@ void PollFd::stop()
 	}
 }
 
+void PollFd::addExtraFd(int fd, short int events)
+{
+	auto it = find_if(mFds.begin() + PollIndex::EXTRA, mFds.end(),
+					  [fd](const pollfd& entry) { return entry.fd == fd; });
+
+	if (it != mFds.end())
+	{
+		it->events = events;
+
+		return;
+	}
+
+	mFds.push_back({fd, events, 0});
+}
+
+void PollFd::removeExtraFd(int fd)
+{
+	mFds.erase(remove_if(mFds.begin() + PollIndex::EXTRA, mFds.end(),
+						 [fd](const pollfd& entry) { return entry.fd == fd; }),
+			   mFds.end());
+}
+
+short int PollFd::getExtraEvents(int fd) const
+{
+	auto it = find_if(mFds.begin() + PollIndex::EXTRA, mFds.end(),
+					  [fd](const pollfd& entry) { return entry.fd == fd; });
+
+	return it != mFds.end() ? it->revents : 0;
+}
+
 void PollFd::init(int fd, short int events)
 {
 	mPipeFds[PipeType::READ] = -1;
@@ -160,6 +198,8 @@ void PollFd::init(int fd, short int events)
 		throw Exception("Can't create pipe", errno);
 	}
 
+	mFds.resize(PollIndex::EXTRA);
+
 	mFds[PollIndex::FILE].fd = fd;
 	mFds[PollIndex::FILE].events = events;
 
@@ -245,6 +285,246 @@ void AsyncContext::run()
 	}
 }
 
+/*******************************************************************************
+ * CallQueue
+ ******************************************************************************/
+
+CallQueue::CallQueue() :
+	mEventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+	mStopped(false)
+{
+	if (mEventFd < 0)
+	{
+		throw Exception("Can't create event fd", errno);
+	}
+}
+
+CallQueue::~CallQueue()
+{
+	close(mEventFd);
+}
+
+bool CallQueue::post(Call call)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mStopped)
+	{
+		return false;
+	}
+
+	// signal only the first call: the rest are run together with it
+	if (mCalls.empty())
+	{
+		uint64_t value = 1;
+
+		if (write(mEventFd, &value, sizeof(value)) < 0)
+		{
+			throw Exception("Can't write event fd", errno);
+		}
+	}
+
+	mCalls.push_back(std::move(call));
+
+	return true;
+}
+
+void CallQueue::stop()
+{
+	vector<Call> calls;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mStopped = true;
+
+		// the functions are destroyed without the lock: they may own objects
+		// which post on deletion
+		calls.swap(mCalls);
+	}
+}
+
+void CallQueue::start()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mStopped = false;
+}
+
+size_t CallQueue::run()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		uint64_t value;
+
+		if (read(mEventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		{
+			throw Exception("Can't read event fd", errno);
+		}
+
+		// swap keeps capacity of both vectors: no allocation in steady state
+		mRunning.swap(mCalls);
+	}
+
+	auto count = mRunning.size();
+
+	try
+	{
+		for (auto& call : mRunning)
+		{
+			if (call)
+			{
+				call();
+			}
+		}
+	}
+	catch(const std::exception& e)
+	{
+		mRunning.clear();
+
+		throw;
+	}
+
+	mRunning.clear();
+
+	return count;
+}
+
+/*******************************************************************************
+ * WorkerPool
+ ******************************************************************************/
+
+WorkerPool::WorkerPool(size_t numWorkers) :
+	mTerminate(false),
+	mNumTasks(0),
+	mLog("WorkerPool")
+{
+	if (numWorkers == 0)
+	{
+		numWorkers = std::max(thread::hardware_concurrency(), 1u);
+	}
+
+	for (size_t i = 0; i < numWorkers; i++)
+	{
+		mThreads.emplace_back(&WorkerPool::run, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::stop()
+{
+	wait();
+
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	for (auto& worker : mThreads)
+	{
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+	}
+}
+
+void WorkerPool::call(uint32_t key, Task task)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (mTerminate)
+	{
+		// there are no workers to call it: wait() would block forever
+		throw Exception("Worker pool is stopped", ECANCELED);
+	}
+
+	auto& queue = mQueues[key];
+
+	if (queue.tasks.empty() && !queue.running)
+	{
+		mReadyQueues.push_back(key);
+
+		mCondVar.notify_one();
+	}
+
+	queue.tasks.push_back(task);
+
+	mNumTasks++;
+}
+
+void WorkerPool::wait()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mIdleCondVar.wait(lock, [this] { return mNumTasks == 0; });
+}
+
+void WorkerPool::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while(true)
+	{
+		mCondVar.wait(lock, [this] { return mTerminate ||
+									 !mReadyQueues.empty(); });
+
+		if (mReadyQueues.empty())
+		{
+			return;
+		}
+
+		auto key = mReadyQueues.front();
+
+		mReadyQueues.pop_front();
+
+		auto& queue = mQueues[key];
+		auto task = queue.tasks.front();
+
+		queue.tasks.pop_front();
+		queue.running = true;
+
+		lock.unlock();
+
+		try
+		{
+			task();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+		}
+
+		lock.lock();
+
+		queue.running = false;
+
+		if (queue.tasks.empty())
+		{
+			mQueues.erase(key);
+		}
+		else
+		{
+			mReadyQueues.push_back(key);
+
+			mCondVar.notify_one();
+		}
+
+		if (--mNumTasks == 0)
+		{
+			mIdleCondVar.notify_all();
+		}
+	}
+}
+
 /*******************************************************************************
  * Timer
  ******************************************************************************/
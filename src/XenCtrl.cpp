@@ -20,6 +20,14 @@
 
 #include "XenCtrl.hpp"
 
+#include <cstring>
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
 using std::vector;
 
 namespace XenBackend {
@@ -54,33 +62,49 @@ XenInterface::~XenInterface()
 
 void XenInterface::getDomainsInfo(vector<xc_domaininfo_t>& infos)
 {
-	vector<xc_domaininfo_t> domainInfo(cDomInfoChunkSize);
-
 	int newDomains = cDomInfoChunkSize;
 	int startDomain = 0;
 
 	infos.clear();
 
+	// chunks are read directly into infos: the caller may reuse its capacity
 	while(newDomains == cDomInfoChunkSize)
 	{
+		auto count = infos.size();
+
+		infos.resize(count + cDomInfoChunkSize);
+
 		newDomains = xc_domain_getinfolist(mHandle, startDomain,
 										   cDomInfoChunkSize,
-										   domainInfo.data());
+										   &infos[count]);
 
 		if (newDomains < 0)
 		{
+			infos.resize(count);
+
 			throw XenCtrlException("Can't get domain info", errno);
 		}
 
+		infos.resize(count + newDomains);
+
 		if (newDomains)
 		{
-			startDomain = domainInfo[newDomains - 1].domain + 1;
+			startDomain = infos.back().domain + 1;
 		}
+	}
+}
 
-		for(auto i = 0; i < newDomains; i++)
-		{
-			infos.push_back(domainInfo[i]);
-		}
+void XenInterface::getEvtchnStatus(evtchn_port_t port,
+								   xc_evtchn_status_t& status)
+{
+	memset(&status, 0, sizeof(status));
+
+	status.dom = DOMID_SELF;
+	status.port = port;
+
+	if (xc_evtchn_status(mHandle, &status) < 0)
+	{
+		throw XenCtrlException("Can't get event channel status", errno);
 	}
 }
 
@@ -110,4 +134,232 @@ void XenInterface::release()
 	}
 }
 
+/*******************************************************************************
+ * XenDomainSampler
+ ******************************************************************************/
+
+XenDomainSampler::XenDomainSampler(milliseconds period, size_t numSamples) :
+	mPeriod(period),
+	mNumSamples(numSamples ? numSamples : 1),
+	mNumSampling(0),
+	mLog("XenDomainSampler"),
+	mTimer([this] { onTimer(); }, true)
+{
+	LOG(mLog, DEBUG) << "Create domain sampler, period: " << mPeriod.count()
+					 << " ms, samples: " << mNumSamples;
+}
+
+XenDomainSampler::~XenDomainSampler()
+{
+	stop();
+
+	LOG(mLog, DEBUG) << "Delete domain sampler";
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void XenDomainSampler::start()
+{
+	LOG(mLog, DEBUG) << "Start";
+
+	sample();
+
+	mTimer.start(mPeriod);
+}
+
+void XenDomainSampler::stop()
+{
+	mTimer.stop();
+}
+
+void XenDomainSampler::sample()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mInterface.getDomainsInfo(mInfos);
+
+	auto time = steady_clock::now();
+
+	mNumSampling++;
+
+	for(auto& info : mInfos)
+	{
+		auto& domain = mDomains[info.domain];
+
+		// the domain is created again with the same id
+		if (domain.count && memcmp(domain.handle, info.handle,
+								   sizeof(domain.handle)) != 0)
+		{
+			domain.count = 0;
+		}
+
+		addSample(domain, info, time);
+	}
+
+	for(auto it = mDomains.begin(); it != mDomains.end();)
+	{
+		if (it->second.seen != mNumSampling)
+		{
+			it = mDomains.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+vector<domid_t> XenDomainSampler::getDomains()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	vector<domid_t> domains;
+
+	domains.reserve(mDomains.size());
+
+	for(auto& domain : mDomains)
+	{
+		domains.push_back(domain.first);
+	}
+
+	return domains;
+}
+
+bool XenDomainSampler::getLatest(domid_t domId, Sample& sample)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mDomains.find(domId);
+
+	if (it == mDomains.end())
+	{
+		return false;
+	}
+
+	auto& domain = it->second;
+
+	sample = domain.samples[(domain.head + mNumSamples - 1) % mNumSamples];
+
+	return true;
+}
+
+vector<XenDomainSampler::Sample> XenDomainSampler::getSamples(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	vector<Sample> samples;
+
+	auto it = mDomains.find(domId);
+
+	if (it == mDomains.end())
+	{
+		return samples;
+	}
+
+	auto& domain = it->second;
+
+	samples.reserve(domain.count);
+
+	for(size_t i = 0; i < domain.count; i++)
+	{
+		samples.push_back(domain.samples[(domain.head + mNumSamples -
+										  domain.count + i) % mNumSamples]);
+	}
+
+	return samples;
+}
+
+double XenDomainSampler::getAverageCpuUsage(domid_t domId)
+{
+	auto samples = getSamples(domId);
+
+	if (samples.size() < 2)
+	{
+		return 0.0;
+	}
+
+	// the first sample has no delta
+	auto wallTime = duration_cast<nanoseconds>(samples.back().time -
+											   samples.front().time).count();
+	auto cpuTime = samples.back().cpuTime - samples.front().cpuTime;
+
+	if (wallTime <= 0 || samples.back().cpuTime < samples.front().cpuTime)
+	{
+		return 0.0;
+	}
+
+	return static_cast<double>(cpuTime) / wallTime;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenDomainSampler::onTimer()
+{
+	try
+	{
+		sample();
+	}
+	catch(const std::exception& e)
+	{
+		LOG_RATELIMIT(mLog, ERROR, 60000) << e.what();
+	}
+}
+
+void XenDomainSampler::addSample(Domain& domain, const xc_domaininfo_t& info,
+								 steady_clock::time_point time)
+{
+	if (domain.samples.size() != mNumSamples)
+	{
+		domain.samples.resize(mNumSamples);
+		domain.head = 0;
+		domain.count = 0;
+	}
+
+	if (domain.count == 0)
+	{
+		memcpy(domain.handle, info.handle, sizeof(domain.handle));
+	}
+
+	auto& sample = domain.samples[domain.head];
+
+	sample.time = time;
+	sample.cpuTime = info.cpu_time;
+	sample.cpuTimeDelta = 0;
+	sample.cpuUsage = 0.0;
+	sample.numVcpus = info.nr_online_vcpus;
+	sample.memory = info.tot_pages * XC_PAGE_SIZE;
+	sample.maxMemory = info.max_pages * XC_PAGE_SIZE;
+
+	if (domain.count)
+	{
+		auto& prev = domain.samples[(domain.head + mNumSamples - 1) %
+									mNumSamples];
+		auto wallTime = duration_cast<nanoseconds>(time - prev.time).count();
+
+		if (info.cpu_time >= prev.cpuTime)
+		{
+			sample.cpuTimeDelta = info.cpu_time - prev.cpuTime;
+		}
+
+		if (wallTime > 0)
+		{
+			sample.cpuUsage = static_cast<double>(sample.cpuTimeDelta) /
+							  wallTime;
+		}
+	}
+
+	domain.head = (domain.head + 1) % mNumSamples;
+
+	if (domain.count < mNumSamples)
+	{
+		domain.count++;
+	}
+
+	domain.seen = mNumSampling;
+}
+
 }
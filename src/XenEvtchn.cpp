@@ -20,10 +20,16 @@
 
 #include "XenEvtchn.hpp"
 
+#include "BinaryLog.hpp"
+
+#include <algorithm>
+
 #include <poll.h>
 
+using std::find_if;
 using std::lock_guard;
 using std::mutex;
+using std::pair;
 using std::thread;
 using std::to_string;
 
@@ -102,7 +108,7 @@ void XenEvtchn::stop()
 
 void XenEvtchn::notify()
 {
-	DLOG(mLog, DEBUG) << "Notify event channel, port: " << mPort;
+	BLOG(mLog, DEBUG, "Notify event channel, port: {}", mPort);
 
 	if (xenevtchn_notify(mHandle, mPort) < 0)
 	{
@@ -117,6 +123,55 @@ void XenEvtchn::setErrorCallback(ErrorCallback errorCallback)
 	mErrorCallback = errorCallback;
 }
 
+void XenEvtchn::setCallback(Callback callback)
+{
+	if (mStarted)
+	{
+		throw XenEvtchnException("Event channel is started", EPERM);
+	}
+
+	mCallback = callback;
+}
+
+void XenEvtchn::setFdCallback(int fd, Callback callback)
+{
+	if (mStarted)
+	{
+		throw XenEvtchnException("Event channel is started", EPERM);
+	}
+
+	auto it = find_if(mFdCallbacks.begin(), mFdCallbacks.end(),
+					  [fd](const pair<int, Callback>& entry)
+					  { return entry.first == fd; });
+
+	if (it != mFdCallbacks.end())
+	{
+		mFdCallbacks.erase(it);
+		mPollFd->removeExtraFd(fd);
+	}
+
+	if (callback)
+	{
+		mFdCallbacks.emplace_back(fd, callback);
+		mPollFd->addExtraFd(fd, POLLIN);
+	}
+}
+
+void XenEvtchn::clearFdCallbacks()
+{
+	if (mStarted)
+	{
+		throw XenEvtchnException("Event channel is started", EPERM);
+	}
+
+	for (auto& entry : mFdCallbacks)
+	{
+		mPollFd->removeExtraFd(entry.first);
+	}
+
+	mFdCallbacks.clear();
+}
+
 /*******************************************************************************
  * Private
  ******************************************************************************/
@@ -166,6 +221,19 @@ void XenEvtchn::eventThread()
 	{
 		while(mCallback && mPollFd->poll())
 		{
+			for (auto& entry : mFdCallbacks)
+			{
+				if (mPollFd->getExtraEvents(entry.first) & POLLIN)
+				{
+					entry.second();
+				}
+			}
+
+			if (!(mPollFd->getEvents() & POLLIN))
+			{
+				continue;
+			}
+
 			auto port = xenevtchn_pending(mHandle);
 
 			if (port < 0)
@@ -185,7 +253,7 @@ void XenEvtchn::eventThread()
 										 to_string(mPort), EINVAL);
 			}
 
-			DLOG(mLog, DEBUG) << "Event received, port: " << mPort;
+			BLOG(mLog, DEBUG, "Event received, port: {}", mPort);
 
 			mCallback();
 		}
@@ -20,6 +20,23 @@
 
 #include "XenGnttab.hpp"
 
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::list;
+using std::make_tuple;
+using std::lock_guard;
+using std::mutex;
+using std::shared_ptr;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
 namespace XenBackend {
 
 /*******************************************************************************
@@ -51,6 +68,235 @@ xengnttab_handle* XenGnttab::getHandle()
 	return gnttab.mHandle;
 }
 
+/*******************************************************************************
+ * XenGnttabUnmapQueue
+ ******************************************************************************/
+
+std::atomic_bool XenGnttabUnmapQueue::sEnabled(false);
+
+XenGnttabUnmapQueue::XenGnttabUnmapQueue() :
+	mMaxDelay(0),
+	mMaxPages(0),
+	mNumPages(0),
+	mTerminate(true),
+	mLog("XenGnttabUnmapQueue")
+{
+	// pending mappings are unmapped with the grant table handle: make sure it
+	// is destroyed after the queue
+	XenGnttab::getHandle();
+}
+
+XenGnttabUnmapQueue::~XenGnttabUnmapQueue()
+{
+	stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void XenGnttabUnmapQueue::enable(milliseconds maxDelay, size_t maxPages)
+{
+	auto& queue = getInstance();
+
+	lock_guard<mutex> itfLock(queue.mItfMutex);
+
+	if (sEnabled)
+	{
+		throw XenGnttabException("Deferred unmapping is already enabled",
+								 EPERM);
+	}
+
+	LOG(queue.mLog, DEBUG) << "Enable, max delay: " << maxDelay.count()
+						   << " ms, max pages: " << maxPages;
+
+	queue.mMaxDelay = maxDelay;
+	queue.mMaxPages = maxPages;
+	queue.mTerminate = false;
+
+	queue.mThread = thread(&XenGnttabUnmapQueue::run, &queue);
+
+	sEnabled = true;
+}
+
+void XenGnttabUnmapQueue::disable()
+{
+	if (!sEnabled)
+	{
+		return;
+	}
+
+	getInstance().stop();
+}
+
+void XenGnttabUnmapQueue::flush()
+{
+	if (!sEnabled)
+	{
+		return;
+	}
+
+	auto& queue = getInstance();
+	list<Mapping> mappings;
+
+	{
+		lock_guard<mutex> lock(queue.mMutex);
+
+		mappings.swap(queue.mMappings);
+		queue.mNumPages = 0;
+	}
+
+	queue.unmapAll(mappings);
+}
+
+size_t XenGnttabUnmapQueue::getNumPendingPages()
+{
+	if (!sEnabled)
+	{
+		return 0;
+	}
+
+	auto& queue = getInstance();
+
+	lock_guard<mutex> lock(queue.mMutex);
+
+	return queue.mNumPages;
+}
+
+void XenGnttabUnmapQueue::unmap(xengnttab_handle* handle, void* address,
+								size_t count)
+{
+	if (sEnabled)
+	{
+		auto& queue = getInstance();
+
+		lock_guard<mutex> lock(queue.mMutex);
+
+		// the queue may be stopped meanwhile
+		if (!queue.mTerminate)
+		{
+			queue.mMappings.push_back({handle, address, count,
+									   steady_clock::now() + queue.mMaxDelay});
+			queue.mNumPages += count;
+
+			// wake up to wait for the first deadline or to unmap now
+			if (queue.mMappings.size() == 1 ||
+				queue.mNumPages > queue.mMaxPages)
+			{
+				queue.mCondVar.notify_all();
+			}
+
+			return;
+		}
+	}
+
+	xengnttab_unmap(handle, address, count);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+XenGnttabUnmapQueue& XenGnttabUnmapQueue::getInstance()
+{
+	static XenGnttabUnmapQueue queue;
+
+	return queue;
+}
+
+void XenGnttabUnmapQueue::stop()
+{
+	lock_guard<mutex> itfLock(mItfMutex);
+
+	sEnabled = false;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	list<Mapping> mappings;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mappings.swap(mMappings);
+		mNumPages = 0;
+	}
+
+	unmapAll(mappings);
+}
+
+void XenGnttabUnmapQueue::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while (!mTerminate)
+	{
+		if (mMappings.empty())
+		{
+			mCondVar.wait(lock);
+
+			continue;
+		}
+
+		if (mNumPages <= mMaxPages &&
+			steady_clock::now() < mMappings.front().deadline)
+		{
+			mCondVar.wait_until(lock, mMappings.front().deadline);
+
+			continue;
+		}
+
+		list<Mapping> mappings;
+
+		mappings.swap(mMappings);
+		mNumPages = 0;
+
+		lock.unlock();
+
+		unmapAll(mappings);
+
+		lock.lock();
+	}
+}
+
+void XenGnttabUnmapQueue::unmapAll(list<Mapping>& mappings)
+{
+	if (mappings.empty())
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Unmap, mappings: " << mappings.size();
+
+	// gntdev unmaps each mapping separately: sort them to walk the address
+	// space once
+	mappings.sort([](const Mapping& a, const Mapping& b)
+				  { return a.address < b.address; });
+
+	for (auto& mapping : mappings)
+	{
+		if (xengnttab_unmap(mapping.handle, mapping.address,
+							mapping.count) < 0)
+		{
+			LOG(mLog, ERROR) << "Can't unmap buffer, address: "
+							 << mapping.address << ", count: "
+							 << mapping.count;
+		}
+	}
+
+	mappings.clear();
+}
+
 /*******************************************************************************
  * XenGnttabBuffer
  ******************************************************************************/
@@ -93,7 +339,7 @@ void XenGnttabBuffer::init(domid_t domId, const grant_ref_t* refs,
 
 	mBuffer = xengnttab_map_domain_grant_refs(mHandle, count, domId,
 											  const_cast<grant_ref_t*>(refs),
-											  PROT_READ | PROT_WRITE);
+											  prot);
 
 	if (!mBuffer)
 	{
@@ -108,8 +354,494 @@ void XenGnttabBuffer::release()
 
 	if (mBuffer)
 	{
-		xengnttab_unmap(mHandle, mBuffer, mCount);
+		XenGnttabUnmapQueue::unmap(mHandle, mBuffer, mCount);
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabSgBuffer
+ ******************************************************************************/
+
+XenGnttabSgBuffer::XenGnttabSgBuffer(domid_t domId,
+									 const vector<XenGnttabSegment>& segments,
+									 int prot) :
+	mSize(0)
+{
+	init(domId, segments, prot);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabSgBuffer::init(domid_t domId,
+							 const vector<XenGnttabSegment>& segments,
+							 int prot)
+{
+	if (segments.empty())
+	{
+		throw XenGnttabException("No segments", EINVAL);
+	}
+
+	GrantRefs refs;
+
+	refs.reserve(segments.size());
+
+	for (auto& segment : segments)
+	{
+		if (segment.len == 0 || segment.offset + segment.len > XC_PAGE_SIZE)
+		{
+			throw XenGnttabException("Wrong segment size", EINVAL);
+		}
+
+		refs.push_back(segment.ref);
+	}
+
+	mBuffer.reset(new XenGnttabBuffer(domId, refs.data(), refs.size(), prot));
+
+	auto page = static_cast<uint8_t*>(mBuffer->get());
+
+	mIov.reserve(segments.size());
+
+	for (auto& segment : segments)
+	{
+		auto data = page + segment.offset;
+
+		if (!mIov.empty() &&
+			static_cast<uint8_t*>(mIov.back().iov_base) +
+			mIov.back().iov_len == data)
+		{
+			mIov.back().iov_len += segment.len;
+		}
+		else
+		{
+			mIov.push_back({data, segment.len});
+		}
+
+		mSize += segment.len;
+		page += XC_PAGE_SIZE;
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabCache
+ ******************************************************************************/
+
+XenGnttabCache::XenGnttabCache(size_t maxPages, int prot) :
+	mMaxPages(maxPages),
+	mProt(prot),
+	mStats({0, 0, 0}),
+	mLog("XenGnttabCache")
+{
+	if (mMaxPages == 0)
+	{
+		throw XenGnttabException("Wrong page budget", EINVAL);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+shared_ptr<XenGnttabBuffer> XenGnttabCache::get(domid_t domId,
+												grant_ref_t ref)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto& domain = mDomains[domId];
+		auto it = domain.index.find(ref);
+
+		if (it != domain.index.end())
+		{
+			domain.entries.splice(domain.entries.begin(), domain.entries,
+								  it->second);
+
+			mStats.hits++;
+
+			return it->second->buffer;
+		}
+
+		mStats.misses++;
+	}
+
+	// map without lock: other domains shouldn't wait for it
+	shared_ptr<XenGnttabBuffer> buffer(new XenGnttabBuffer(domId, ref, mProt));
+	// evicted buffers are unmapped after unlocking
+	std::list<Entry> evicted;
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto& domain = mDomains[domId];
+	auto it = domain.index.find(ref);
+
+	// mapped concurrently by other thread
+	if (it != domain.index.end())
+	{
+		return it->second->buffer;
+	}
+
+	domain.entries.push_front({ref, buffer});
+	domain.index[ref] = domain.entries.begin();
+
+	while (domain.entries.size() > mMaxPages)
+	{
+		DLOG(mLog, DEBUG) << "Evict dom: " << domId
+						  << ", ref: " << domain.entries.back().ref;
+
+		domain.index.erase(domain.entries.back().ref);
+		evicted.splice(evicted.end(), domain.entries,
+					   std::prev(domain.entries.end()));
+
+		mStats.evictions++;
+	}
+
+	return buffer;
+}
+
+void XenGnttabCache::remove(domid_t domId, grant_ref_t ref)
+{
+	std::list<Entry> removed;
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto domain = mDomains.find(domId);
+
+	if (domain == mDomains.end())
+	{
+		return;
+	}
+
+	auto it = domain->second.index.find(ref);
+
+	if (it != domain->second.index.end())
+	{
+		removed.splice(removed.end(), domain->second.entries, it->second);
+		domain->second.index.erase(it);
+	}
+}
+
+void XenGnttabCache::clear(domid_t domId)
+{
+	Domain removed;
+
+	lock_guard<mutex> lock(mMutex);
+
+	auto domain = mDomains.find(domId);
+
+	if (domain != mDomains.end())
+	{
+		removed = std::move(domain->second);
+
+		mDomains.erase(domain);
+	}
+}
+
+size_t XenGnttabCache::size(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto domain = mDomains.find(domId);
+
+	if (domain == mDomains.end())
+	{
+		return 0;
+	}
+
+	return domain->second.entries.size();
+}
+
+XenGnttabCache::Stats XenGnttabCache::getStats()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mStats;
+}
+
+/*******************************************************************************
+ * XenGnttabBatch
+ ******************************************************************************/
+
+XenGnttabBatch::XenGnttabBatch(domid_t domId, int prot) :
+	mDomId(domId),
+	mProt(prot),
+	mMapped(false),
+	mBuffer(nullptr),
+	mHandle(XenGnttab::getHandle()),
+	mLog("XenGnttabBatch")
+{
+}
+
+XenGnttabBatch::~XenGnttabBatch()
+{
+	unmap();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+size_t XenGnttabBatch::add(const grant_ref_t* refs, size_t count)
+{
+	if (mMapped)
+	{
+		throw XenGnttabException("Batch is already mapped", EPERM);
+	}
+
+	if (count == 0)
+	{
+		throw XenGnttabException("Empty request", EINVAL);
+	}
+
+	mRequests.push_back({mRefs.size(), count, nullptr, 0});
+	mRefs.insert(mRefs.end(), refs, refs + count);
+
+	return mRequests.size() - 1;
+}
+
+void XenGnttabBatch::map()
+{
+	if (mMapped)
+	{
+		throw XenGnttabException("Batch is already mapped", EPERM);
+	}
+
+	if (mRefs.empty())
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Map batch, dom: " << mDomId
+					  << ", requests: " << mRequests.size()
+					  << ", count: " << mRefs.size();
+
+	mBuffer = xengnttab_map_domain_grant_refs(mHandle, mRefs.size(), mDomId,
+											  mRefs.data(), mProt);
+
+	if (!mBuffer)
+	{
+		auto error = errno;
+
+		LOG(mLog, WARNING) << "Can't map batch, dom: " << mDomId
+						   << ", error: " << strerror(error)
+						   << ", map requests separately";
+
+		if (!mapRequests())
+		{
+			throw XenGnttabException("Can't map batch", error);
+		}
+	}
+
+	mMapped = true;
+}
+
+void XenGnttabBatch::unmap()
+{
+	if (mBuffer)
+	{
+		DLOG(mLog, DEBUG) << "Unmap batch, dom: " << mDomId
+						  << ", count: " << mRefs.size();
+
+		XenGnttabUnmapQueue::unmap(mHandle, mBuffer, mRefs.size());
+
+		mBuffer = nullptr;
+	}
+
+	for (auto& request : mRequests)
+	{
+		if (request.buffer)
+		{
+			XenGnttabUnmapQueue::unmap(mHandle, request.buffer, request.count);
+
+			request.buffer = nullptr;
+		}
+	}
+
+	mMapped = false;
+	mRefs.clear();
+	mRequests.clear();
+}
+
+void* XenGnttabBatch::get(size_t index) const
+{
+	auto& request = getRequest(index);
+
+	if (mBuffer)
+	{
+		return static_cast<uint8_t*>(mBuffer) + request.offset * XC_PAGE_SIZE;
 	}
+
+	if (!request.buffer)
+	{
+		throw XenGnttabException("Request is not mapped", request.error);
+	}
+
+	return request.buffer;
+}
+
+bool XenGnttabBatch::isMapped(size_t index) const
+{
+	auto& request = getRequest(index);
+
+	return mBuffer || request.buffer;
+}
+
+size_t XenGnttabBatch::size(size_t index) const
+{
+	return getRequest(index).count * XC_PAGE_SIZE;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+const XenGnttabBatch::Request& XenGnttabBatch::getRequest(size_t index) const
+{
+	if (!mMapped)
+	{
+		throw XenGnttabException("Batch is not mapped", EPERM);
+	}
+
+	if (index >= mRequests.size())
+	{
+		throw XenGnttabException("Wrong request index", EINVAL);
+	}
+
+	return mRequests[index];
+}
+
+bool XenGnttabBatch::mapRequests()
+{
+	bool mapped = false;
+
+	for (auto& request : mRequests)
+	{
+		request.buffer = xengnttab_map_domain_grant_refs(
+				mHandle, request.count, mDomId, &mRefs[request.offset], mProt);
+
+		if (!request.buffer)
+		{
+			request.error = errno;
+
+			LOG(mLog, ERROR) << "Can't map request, dom: " << mDomId
+							 << ", ref: " << mRefs[request.offset]
+							 << ", count: " << request.count;
+
+			continue;
+		}
+
+		mapped = true;
+	}
+
+	return mapped;
+}
+
+/*******************************************************************************
+ * XenGnttabCopy
+ ******************************************************************************/
+
+std::atomic<size_t> XenGnttabCopy::sThreshold(XenGnttabCopy::cDefaultThreshold);
+
+XenGnttabCopy::XenGnttabCopy(domid_t domId) :
+	mDomId(domId),
+	mHandle(XenGnttab::getHandle()),
+	mLog("XenGnttabCopy")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+size_t XenGnttabCopy::copyFrom(grant_ref_t ref, size_t offset, void* dst,
+							   size_t len)
+{
+	auto& segment = addSegment(offset, len);
+
+	segment.flags = GNTCOPY_source_gref;
+	segment.source.foreign.ref = ref;
+	segment.source.foreign.offset = offset;
+	segment.source.foreign.domid = mDomId;
+	segment.dest.virt = dst;
+
+	return mSegments.size() - 1;
+}
+
+size_t XenGnttabCopy::copyTo(grant_ref_t ref, size_t offset, const void* src,
+							 size_t len)
+{
+	auto& segment = addSegment(offset, len);
+
+	segment.flags = GNTCOPY_dest_gref;
+	segment.source.virt = const_cast<void*>(src);
+	segment.dest.foreign.ref = ref;
+	segment.dest.foreign.offset = offset;
+	segment.dest.foreign.domid = mDomId;
+
+	return mSegments.size() - 1;
+}
+
+void XenGnttabCopy::copy()
+{
+	if (mSegments.empty())
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Copy, dom: " << mDomId
+					  << ", segments: " << mSegments.size();
+
+	if (xengnttab_grant_copy(mHandle, mSegments.size(),
+							 mSegments.data()) < 0)
+	{
+		throw XenGnttabException("Can't copy grant references", errno);
+	}
+}
+
+int XenGnttabCopy::getStatus(size_t index) const
+{
+	if (index >= mSegments.size())
+	{
+		throw XenGnttabException("Wrong segment index", EINVAL);
+	}
+
+	return mSegments[index].status;
+}
+
+bool XenGnttabCopy::isSucceeded() const
+{
+	for (auto& segment : mSegments)
+	{
+		if (segment.status != GNTST_okay)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+xengnttab_grant_copy_segment_t& XenGnttabCopy::addSegment(size_t offset,
+														  size_t len)
+{
+	if (len == 0 || offset + len > XC_PAGE_SIZE)
+	{
+		throw XenGnttabException("Wrong segment size", EINVAL);
+	}
+
+	xengnttab_grant_copy_segment_t segment = {};
+
+	segment.len = len;
+	// not copied yet
+	segment.status = GNTST_general_error;
+
+	mSegments.push_back(segment);
+
+	return mSegments.back();
 }
 
 #ifdef GNTDEV_DMA_FLAG_WC
@@ -184,23 +916,95 @@ void XenGnttabDmaBufferExporter::init(domid_t domId, const GrantRefs &refs,
 
 int XenGnttabDmaBufferExporter::waitForReleased(int timeoutMs)
 {
-	uint32_t fd = mDmaBufFd;
-	int ret;
+	return waitReleased(mHandle, detach(), timeoutMs);
+}
 
-	release();
+void XenGnttabDmaBufferExporter::waitForReleasedAsync(ReleaseCallback callback,
+													  int timeoutMs)
+{
+	auto handle = mHandle;
+	auto fd = detach();
 
-	ret = xengnttab_dmabuf_exp_wait_released(mHandle, fd, timeoutMs);
+	// the wait blocks up to the timeout: waits of different buffers run in
+	// parallel
+	getReleasePool().call(fd, [handle, fd, timeoutMs, callback]()
+	{
+		auto ret = waitReleased(handle, fd, timeoutMs);
+
+		if (callback)
+		{
+			callback(ret);
+		}
+	});
+}
+
+WorkerPool& XenGnttabDmaBufferExporter::getReleasePool()
+{
+	// the grant table handle is used by the pool: make sure it is destroyed
+	// after the pool
+	XenGnttab::getHandle();
+
+	static WorkerPool pool(cNumReleaseWorkers);
+
+	return pool;
+}
+
+int XenGnttabDmaBufferExporter::getPlaceholderFd()
+{
+	static int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	return fd;
+}
+
+int XenGnttabDmaBufferExporter::waitReleased(xengnttab_handle* handle, int fd,
+											 int timeoutMs)
+{
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	auto ret = xengnttab_dmabuf_exp_wait_released(handle, fd, timeoutMs);
 
 	if (ret)
 	{
-		DLOG(mLog, ERROR) << "Wait for DMA buffer failed, fd: "
-					  << fd << ", err: " << ret
-					  << "(" << strerror(errno) << ")";
+		LOG("XenGnttabDmaBufferExporter", ERROR)
+			<< "Wait for DMA buffer failed, fd: " << fd
+			<< ", err: " << ret << "(" << strerror(errno) << ")";
 	}
 
+	// frees the reserved number
+	close(fd);
+
 	return ret;
 }
 
+int XenGnttabDmaBufferExporter::detach()
+{
+	auto fd = mDmaBufFd;
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	mDmaBufFd = -1;
+
+	// drops the buffer reference but keeps the number: the grant device
+	// finds the buffer to wait for by the number
+	if (dup3(getPlaceholderFd(), fd, O_CLOEXEC) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't reserve DMA buffer fd: " << fd
+						 << " (" << strerror(errno) << ")";
+
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
 void XenGnttabDmaBufferExporter::release()
 {
 	if (mDmaBufFd >= 0)
@@ -210,6 +1014,110 @@ void XenGnttabDmaBufferExporter::release()
 	}
 }
 
+/*******************************************************************************
+ * XenGnttabDmaBufferPool
+ ******************************************************************************/
+
+XenGnttabDmaBufferPool::XenGnttabDmaBufferPool(int releaseTimeoutMs) :
+	mReleaseTimeoutMs(releaseTimeoutMs),
+	mStats({0, 0}),
+	mLog("XenGnttabDmaBufferPool")
+{
+}
+
+XenGnttabDmaBufferPool::~XenGnttabDmaBufferPool()
+{
+	for (auto& exporter : mExporters)
+	{
+		exporter.second->waitForReleasedAsync(nullptr, mReleaseTimeoutMs);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+XenGnttabDmaBufferPool::ExporterPtr XenGnttabDmaBufferPool::get(
+		domid_t domId, const GrantRefs& refs, size_t offset)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto key = make_tuple(domId, offset, refs);
+	auto it = mExporters.find(key);
+
+	if (it != mExporters.end())
+	{
+		mStats.hits++;
+
+		return it->second;
+	}
+
+	mStats.misses++;
+
+	ExporterPtr exporter(new XenGnttabDmaBufferExporter(domId, refs, offset));
+
+	mExporters[key] = exporter;
+
+	DLOG(mLog, DEBUG) << "Add exporter, dom: " << domId
+					  << ", fd: " << exporter->getFd();
+
+	return exporter;
+}
+
+void XenGnttabDmaBufferPool::remove(
+		domid_t domId, const GrantRefs& refs, size_t offset,
+		XenGnttabDmaBufferExporter::ReleaseCallback callback)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mExporters.find(make_tuple(domId, offset, refs));
+
+	if (it == mExporters.end())
+	{
+		throw XenGnttabException("Exporter not found", ENOENT);
+	}
+
+	DLOG(mLog, DEBUG) << "Remove exporter, dom: " << domId
+					  << ", fd: " << it->second->getFd();
+
+	it->second->waitForReleasedAsync(callback, mReleaseTimeoutMs);
+
+	mExporters.erase(it);
+}
+
+void XenGnttabDmaBufferPool::clear(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	for (auto it = mExporters.begin(); it != mExporters.end();)
+	{
+		if (std::get<0>(it->first) == domId)
+		{
+			it->second->waitForReleasedAsync(nullptr, mReleaseTimeoutMs);
+
+			it = mExporters.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+size_t XenGnttabDmaBufferPool::size()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mExporters.size();
+}
+
+XenGnttabDmaBufferPool::Stats XenGnttabDmaBufferPool::getStats()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mStats;
+}
+
 /*******************************************************************************
  * XenGnttabDmaBufferImporter
  ******************************************************************************/
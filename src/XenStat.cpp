@@ -20,6 +20,12 @@
 
 #include "XenStat.hpp"
 
+#include <cstring>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
 using std::vector;
 
 namespace XenBackend {
@@ -28,7 +34,11 @@ namespace XenBackend {
  * XenStat
  ******************************************************************************/
 
-XenStat::XenStat() :
+XenStat::XenStat(milliseconds refreshPeriod) :
+	mRefreshPeriod(refreshPeriod),
+	mValid(false),
+	mNumRefreshes(0),
+	mGeneration(0),
 	mLog("XenStat")
 {
 	LOG(mLog, DEBUG) << "Create xen stat";
@@ -45,13 +55,13 @@ XenStat::~XenStat()
 
 vector<domid_t> XenStat::getRunningDoms()
 {
-	vector<domid_t> runningDomains;
+	lock_guard<mutex> lock(mMutex);
 
-	vector<xc_domaininfo_t> domInfos;
+	update(false);
 
-	mInterface.getDomainsInfo(domInfos);
+	vector<domid_t> runningDomains;
 
-	for(auto info : domInfos)
+	for(auto& info : mInfos)
 	{
 		if (info.flags & XEN_DOMINF_running)
 		{
@@ -64,13 +74,15 @@ vector<domid_t> XenStat::getRunningDoms()
 
 vector<domid_t> XenStat::getExistingDoms()
 {
-	vector<domid_t> existingDomains;
+	lock_guard<mutex> lock(mMutex);
+
+	update(false);
 
-	vector<xc_domaininfo_t> domInfos;
+	vector<domid_t> existingDomains;
 
-	mInterface.getDomainsInfo(domInfos);
+	existingDomains.reserve(mInfos.size());
 
-	for(auto info : domInfos)
+	for(auto& info : mInfos)
 	{
 		existingDomains.push_back(info.domain);
 	}
@@ -78,4 +90,136 @@ vector<domid_t> XenStat::getExistingDoms()
 	return existingDomains;
 }
 
+void XenStat::setRefreshPeriod(milliseconds refreshPeriod)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mRefreshPeriod = refreshPeriod;
+}
+
+void XenStat::refresh()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	update(true);
+}
+
+uint64_t XenStat::getGeneration()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	update(false);
+
+	return mGeneration;
+}
+
+vector<domid_t> XenStat::domainsAdded(uint64_t generation)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	vector<domid_t> domains;
+
+	for(auto& domain : mDomains)
+	{
+		if (domain.second.exists && domain.second.added > generation)
+		{
+			domains.push_back(domain.first);
+		}
+	}
+
+	return domains;
+}
+
+vector<domid_t> XenStat::domainsRemoved(uint64_t generation)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	vector<domid_t> domains;
+
+	for(auto& domain : mDomains)
+	{
+		if (domain.second.removed > generation)
+		{
+			domains.push_back(domain.first);
+		}
+	}
+
+	return domains;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenStat::update(bool force)
+{
+	auto now = steady_clock::now();
+
+	if (!force && mValid && now - mLastRefresh < mRefreshPeriod)
+	{
+		return;
+	}
+
+	try
+	{
+		mInterface.getDomainsInfo(mInfos);
+	}
+	catch(const std::exception& e)
+	{
+		mValid = false;
+
+		throw;
+	}
+
+	mValid = true;
+	mLastRefresh = now;
+	mNumRefreshes++;
+
+	auto generation = mGeneration + 1;
+	bool changed = false;
+
+	for(auto& info : mInfos)
+	{
+		auto& domain = mDomains[info.domain];
+
+		// the domain is created again with the same id
+		if (domain.exists && memcmp(domain.handle, info.handle,
+									sizeof(domain.handle)) != 0)
+		{
+			domain.removed = generation;
+			domain.added = generation;
+			changed = true;
+		}
+
+		if (!domain.exists)
+		{
+			domain.exists = true;
+			domain.added = generation;
+			changed = true;
+		}
+
+		memcpy(domain.handle, info.handle, sizeof(domain.handle));
+		domain.seen = mNumRefreshes;
+	}
+
+	// records of removed domains are kept: number of domain ids is limited
+	for(auto& domain : mDomains)
+	{
+		if (domain.second.exists && domain.second.seen != mNumRefreshes)
+		{
+			domain.second.exists = false;
+			domain.second.removed = generation;
+			changed = true;
+		}
+	}
+
+	if (changed)
+	{
+		mGeneration = generation;
+
+		LOG(mLog, DEBUG) << "Domains changed, generation: " << mGeneration
+						 << ", domains: " << mInfos.size();
+	}
+}
+
 }
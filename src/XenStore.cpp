@@ -19,10 +19,17 @@
  */
 #include "XenStore.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #include <poll.h>
 
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
 using std::mutex;
+using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::to_string;
@@ -30,6 +37,99 @@ using std::vector;
 
 namespace XenBackend {
 
+/*******************************************************************************
+ * XenStoreTree
+ ******************************************************************************/
+
+const char* XenStoreTree::findValue(const char* key) const
+{
+	auto it = std::lower_bound(mEntries.begin(), mEntries.end(), key,
+		[this](const Entry& entry, const char* key)
+		{ return strcmp(getEntryKey(entry), key) < 0; });
+
+	if (it == mEntries.end() || strcmp(getEntryKey(*it), key) != 0)
+	{
+		return nullptr;
+	}
+
+	return &mArena[it->value];
+}
+
+int XenStoreTree::readInt(const string& key) const
+{
+	return stoi(readString(key));
+}
+
+unsigned int XenStoreTree::readUint(const string& key) const
+{
+	return stoul(readString(key));
+}
+
+string XenStoreTree::readString(const string& key) const
+{
+	auto value = findValue(key);
+
+	if (!value)
+	{
+		throw XenStoreException("Can't read from: " + mPath + "/" + key,
+								ENOENT);
+	}
+
+	return value;
+}
+
+vector<string> XenStoreTree::readDirectory(const string& key) const
+{
+	vector<string> result;
+
+	auto prefix = key.empty() ? key : key + "/";
+
+	for (auto& entry : mEntries)
+	{
+		auto entryKey = getEntryKey(entry);
+
+		if (*entryKey &&
+			strncmp(entryKey, prefix.c_str(), prefix.length()) == 0 &&
+			strlen(entryKey) > prefix.length() &&
+			!strchr(entryKey + prefix.length(), '/'))
+		{
+			result.push_back(entryKey + prefix.length());
+		}
+	}
+
+	return result;
+}
+
+void XenStoreTree::clear()
+{
+	mArena.clear();
+	mEntries.clear();
+}
+
+void XenStoreTree::append(const string& key, const char* value, size_t length)
+{
+	Entry entry;
+
+	entry.key = mArena.size();
+
+	mArena.insert(mArena.end(), key.begin(), key.end());
+	mArena.push_back('\0');
+
+	entry.value = mArena.size();
+
+	mArena.insert(mArena.end(), value, value + length);
+	mArena.push_back('\0');
+
+	mEntries.push_back(entry);
+}
+
+void XenStoreTree::sort()
+{
+	std::sort(mEntries.begin(), mEntries.end(),
+		[this](const Entry& a, const Entry& b)
+		{ return strcmp(getEntryKey(a), getEntryKey(b)) < 0; });
+}
+
 /*******************************************************************************
  * XenStore
  ******************************************************************************/
@@ -199,16 +299,25 @@ bool XenStore::checkIfExist(const string& path)
 
 void XenStore::setWatch(const string& path, WatchCallback callback)
 {
-	lock_guard<mutex> lock(mMutex);
+	Watch watch;
 
-	LOG(mLog, DEBUG) << "Set watch: " << path;
+	watch.callback = std::make_shared<const WatchCallback>(std::move(callback));
+	watch.window = milliseconds(0);
 
-	if (!xs_watch(mXsHandle, path.c_str(), path.c_str()))
-	{
-		throw XenStoreException("Can't set xs watch for " + path, errno);
-	}
+	addWatch(path, watch);
+}
+
+void XenStore::setCoalescedWatch(const string& path,
+								 CoalescedWatchCallback callback,
+								 milliseconds window)
+{
+	Watch watch;
 
-	mWatches[path] = callback;
+	watch.coalescedCallback = std::make_shared<const CoalescedWatchCallback>(
+			std::move(callback));
+	watch.window = window;
+
+	addWatch(path, watch);
 }
 
 void XenStore::clearWatch(const string& path)
@@ -217,32 +326,49 @@ void XenStore::clearWatch(const string& path)
 
 	LOG(mLog, DEBUG) << "Clear watch: " << path;
 
+	auto watch = mWatches.find(path);
+
+	mCoalescedEvents.erase(path);
+
+	if (watch && watch->owner != path)
+	{
+		mWatches.erase(path);
+
+		return;
+	}
+
 	if (!xs_unwatch(mXsHandle, path.c_str(), path.c_str()))
 	{
 		LOG(mLog, ERROR) << "Failed to clear watch: " << path;
 	}
 
 	mWatches.erase(path);
+
+	adoptWatches(path);
 }
 
 void XenStore::clearWatches()
 {
 	lock_guard<mutex> lock(mMutex);
 
-	if (mWatches.size())
+	if (!mWatches.empty())
 	{
 		LOG(mLog, DEBUG) << "Clear watches";
 
-		for (auto watch : mWatches)
+		mWatches.forEachInSubtree("", [this](const string& path, Watch& watch)
 		{
-			if (!xs_unwatch(mXsHandle, watch.first.c_str(), watch.first.c_str()))
+			if (watch.owner == path &&
+				!xs_unwatch(mXsHandle, path.c_str(), path.c_str()))
 			{
-				LOG(mLog, ERROR) << "Failed to clear watch: " << watch.first;
+				LOG(mLog, ERROR) << "Failed to clear watch: " << path;
 			}
-		}
+		});
 
 		mWatches.clear();
 	}
+
+	mPendingWatches.clear();
+	mCoalescedEvents.clear();
 }
 
 void XenStore::start()
@@ -312,9 +438,8 @@ void XenStore::release()
 string XenStore::readXsWatch(string& token)
 {
 	string path;
-	unsigned int num;
 
-	auto result = xs_read_watch(mXsHandle, &num);
+	auto result = xs_check_watch(mXsHandle);
 
 	if (result)
 	{
@@ -327,48 +452,308 @@ string XenStore::readXsWatch(string& token)
 	return path;
 }
 
-XenStore::WatchCallback XenStore::getWatchCallback(const string& path)
+string XenStore::getOwner(const string& path)
+{
+	string owner;
+
+	// Only watches set from the watch thread may be served by a parent watch:
+	// the initial notification is delivered by the watch thread as well.
+	if (std::this_thread::get_id() != mThread.get_id())
+	{
+		return owner;
+	}
+
+	mWatches.forEachPrefix(path, [&owner, &path](const string& key,
+												  Watch& watch)
+	{
+		if (key != path && watch.owner == key)
+		{
+			owner = key;
+		}
+	});
+
+	return owner;
+}
+
+void XenStore::adoptWatches(const string& owner)
+{
+	vector<string> orphans;
+
+	mWatches.forEachInSubtree(owner, [&orphans, &owner](const string& path,
+														Watch& watch)
+	{
+		if (watch.owner == owner)
+		{
+			orphans.push_back(path);
+		}
+	});
+
+	// parents go first thus children are adopted by re-registered parents
+	for (auto path : orphans)
+	{
+		string newOwner;
+
+		mWatches.forEachPrefix(path, [&newOwner, &path](const string& key,
+														Watch& watch)
+		{
+			if (key != path && watch.owner == key)
+			{
+				newOwner = key;
+			}
+		});
+
+		if (newOwner.empty())
+		{
+			if (!xs_watch(mXsHandle, path.c_str(), path.c_str()))
+			{
+				LOG(mLog, ERROR) << "Failed to set watch: " << path;
+
+				continue;
+			}
+
+			newOwner = path;
+		}
+
+		mWatches.find(path)->owner = newOwner;
+	}
+}
+
+size_t XenStore::getWatchCallbacks(const string& path, const string& token,
+								  vector<WatchEvent>& events)
 {
 	lock_guard<mutex> lock(mMutex);
 
-	WatchCallback callback = nullptr;
-/*
-	auto result = find_if(mWatches.begin(), mWatches.end(),
-						  [&path] (const pair<string, WatchCallback> &val)
-						  { return path.compare(0, val.first.length(),
-						                           val.first) == 0; });
-*/
-	auto result = mWatches.find(path);
+	size_t count = 0;
+
+	// events are reused between dispatches to keep their path buffers
+	auto addEvent = [&](const string& eventPath, const Watch& watch)
+	{
+		if (count == events.size())
+		{
+			events.emplace_back();
+		}
+
+		events[count].path.assign(eventPath);
+		events[count].callback = watch.callback;
+
+		count++;
+	};
+
+	// watches which are parents of the fired path
+	mWatches.forEachPrefix(path, [&](const string& key, Watch& watch)
+	{
+		if (watch.owner != token)
+		{
+			return;
+		}
+
+		if (watch.coalescedCallback)
+		{
+			addCoalescedEvent(key, path, watch);
+		}
+		else
+		{
+			addEvent(path, watch);
+		}
+	});
+
+	// Xen store notifies watches of removed children with their own path
+	mWatches.forEachInSubtree(path, [&](const string& key, Watch& watch)
+	{
+		if (key.length() == path.length() || watch.owner != token)
+		{
+			return;
+		}
+
+		if (watch.coalescedCallback)
+		{
+			addCoalescedEvent(key, key, watch);
+		}
+		else
+		{
+			addEvent(key, watch);
+		}
+	});
+
+	return count;
+}
+
+bool XenStore::getPendingWatch(string& path,
+							   shared_ptr<const WatchCallback>& callback)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	while (!mPendingWatches.empty())
+	{
+		path = mPendingWatches.front();
+
+		mPendingWatches.pop_front();
+
+		auto watch = mWatches.find(path);
+
+		if (watch && watch->coalescedCallback)
+		{
+			addCoalescedEvent(path, path, *watch);
+		}
+		else if (watch)
+		{
+			callback = watch->callback;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void XenStore::addWatch(const string& path, Watch watch)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	LOG(mLog, DEBUG) << "Set watch: " << path;
+
+	auto current = mWatches.find(path);
+	string owner = current ? current->owner : getOwner(path);
+
+	if (owner.empty() || owner == path)
+	{
+		if (!xs_watch(mXsHandle, path.c_str(), path.c_str()))
+		{
+			throw XenStoreException("Can't set xs watch for " + path, errno);
+		}
+
+		owner = path;
+	}
+	else
+	{
+		// Xen store fires the watch when it is set. Do the same for the watch
+		// served by the parent one.
+		mPendingWatches.push_back(path);
+	}
+
+	watch.owner = owner;
+
+	mWatches.insert(path, watch);
+}
+
+void XenStore::addCoalescedEvent(const string& watchPath, const string& path,
+								 const Watch& watch)
+{
+	auto& events = mCoalescedEvents[watchPath];
 
-	if (result != mWatches.end())
+	if (events.paths.empty())
 	{
-		callback = result->second;
+		events.deadline = steady_clock::now() + watch.window;
 	}
 
-	return callback;
+	events.paths.insert(path);
+}
+
+bool XenStore::getCoalescedEvents(vector<string>& paths,
+		shared_ptr<const CoalescedWatchCallback>& callback)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto now = steady_clock::now();
+
+	for (auto it = mCoalescedEvents.begin(); it != mCoalescedEvents.end(); )
+	{
+		auto watch = mWatches.find(it->first);
+
+		if (!watch || !watch->coalescedCallback)
+		{
+			it = mCoalescedEvents.erase(it);
+
+			continue;
+		}
+
+		if (it->second.deadline <= now)
+		{
+			paths.assign(it->second.paths.begin(), it->second.paths.end());
+			callback = watch->coalescedCallback;
+
+			mCoalescedEvents.erase(it);
+
+			return true;
+		}
+
+		++it;
+	}
+
+	return false;
+}
+
+int XenStore::getCoalescedTimeout()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mCoalescedEvents.empty())
+	{
+		return -1;
+	}
+
+	auto deadline = steady_clock::time_point::max();
+
+	for (auto& events : mCoalescedEvents)
+	{
+		deadline = std::min(deadline, events.second.deadline);
+	}
+
+	auto timeout = duration_cast<milliseconds>(deadline -
+											   steady_clock::now()).count();
+
+	// round up to not wake up before the deadline
+	return timeout < 0 ? 0 : timeout + 1;
 }
 
 void XenStore::watchesThread()
 {
+	vector<WatchEvent> events;
+
 	try
 	{
-		while(mPollFd->poll())
+		while(mPollFd->poll(getCoalescedTimeout()))
 		{
 			string token;
+			string path;
 
-			auto path = readXsWatch(token);
-
-			if (!token.empty())
+			// handle all events queued at the moment within one pass
+			while (!(path = readXsWatch(token)).empty())
 			{
-				auto callback = getWatchCallback(token);
+				auto count = getWatchCallbacks(path, token, events);
 
-				if (callback)
+				for (size_t i = 0; i < count; i++)
 				{
-					LOG(mLog, DEBUG) << "Watch triggered: " << token;
+					LOG(mLog, DEBUG) << "Watch triggered: " << events[i].path
+									 << ", token: " << token;
+
+					(*events[i].callback)(events[i].path);
 
-					callback(token);
+					events[i].callback.reset();
 				}
 			}
+
+			shared_ptr<const WatchCallback> callback;
+
+			while (getPendingWatch(path, callback))
+			{
+				LOG(mLog, DEBUG) << "Watch triggered: " << path;
+
+				(*callback)(path);
+			}
+
+			callback.reset();
+
+			vector<string> paths;
+			shared_ptr<const CoalescedWatchCallback> coalescedCallback;
+
+			while (getCoalescedEvents(paths, coalescedCallback))
+			{
+				LOG(mLog, DEBUG) << "Coalesced watch triggered: "
+								 << paths.size() << " path(s)";
+
+				(*coalescedCallback)(paths);
+			}
 		}
 	}
 	catch(const std::exception& e)
@@ -0,0 +1,203 @@
+/*
+ *  Log microbenchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Log.hpp"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::vector;
+
+using XenBackend::Log;
+using XenBackend::LogLevel;
+using XenBackend::LogWriter;
+
+// writes the output to the file on each flush as a log file does
+class FileBuffer : public std::streambuf
+{
+public:
+
+	explicit FileBuffer(const char* path) :
+		mFd(open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)),
+		mBuffer(4096)
+	{
+		setp(mBuffer.data(), mBuffer.data() + mBuffer.size());
+	}
+
+	~FileBuffer()
+	{
+		sync();
+
+		if (mFd >= 0)
+		{
+			close(mFd);
+		}
+	}
+
+	bool isOpened() const { return mFd >= 0; }
+
+protected:
+
+	int overflow(int c) override
+	{
+		if (sync())
+		{
+			return traits_type::eof();
+		}
+
+		if (c != traits_type::eof())
+		{
+			*pptr() = c;
+			pbump(1);
+		}
+
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override
+	{
+		auto size = pptr() - pbase();
+
+		if (size && ::write(mFd, pbase(), size) != size)
+		{
+			return -1;
+		}
+
+		setp(mBuffer.data(), mBuffer.data() + mBuffer.size());
+
+		return 0;
+	}
+
+private:
+
+	int mFd;
+	vector<char> mBuffer;
+};
+
+// runs the function in the threads, each thread does its share of
+// iterations. The time includes the done function.
+template<typename F, typename D>
+static void measure(const string& name, size_t numThreads, size_t iterations,
+					F f, D done)
+{
+	vector<thread> threads;
+
+	auto start = steady_clock::now();
+
+	for (size_t t = 0; t < numThreads; t++)
+	{
+		threads.emplace_back([&f, numThreads, iterations, t]
+		{
+			for (size_t i = t; i < iterations; i += numThreads)
+			{
+				f(i);
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	done();
+
+	auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+	// time spent by each thread per call
+	cout << name << ", " << numThreads << " threads: "
+		 << static_cast<double>(ns) * numThreads / iterations
+		 << " ns/call" << endl;
+}
+
+template<typename F>
+static void measure(const string& name, size_t numThreads, size_t iterations,
+					F f)
+{
+	measure(name, numThreads, iterations, f, [] {});
+}
+
+int main(int argc, char* argv[])
+{
+	size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+	size_t numThreads = argc > 2 ? strtoul(argv[2], nullptr, 0) : 4;
+	const char* path = argc > 3 ? argv[3] : "/dev/null";
+	size_t bufferSize = argc > 4 ? strtoul(argv[4], nullptr, 0) : 1024 * 1024;
+
+	FileBuffer fileBuffer(path);
+
+	if (!fileBuffer.isOpened())
+	{
+		cout << "Can't open " << path << endl;
+
+		return 1;
+	}
+
+	Log log("Benchmark", LogLevel::logINFO);
+	string text = "ring buffer";
+
+	cout << "Iterations: " << iterations << ", output: " << path << endl;
+
+	Log::setStreamBuffer(&fileBuffer);
+
+	measure("Disabled LOG", 1, iterations, [&](size_t i)
+	{
+		LOG(log, DEBUG) << "Send event, " << text << ", id: " << i;
+	});
+
+	// each line is flushed under the global lock
+	measure("Enabled LOG", numThreads, iterations, [&](size_t i)
+	{
+		LOG(log, INFO) << "Send event, " << text << ", id: " << i;
+	});
+
+	auto numDropped = LogWriter::getNumDropped();
+
+	// the buffers hold the lines produced while the writer thread waits for
+	// a CPU: the threads may share one
+	LogWriter::start(bufferSize);
+
+	// the final drain is measured as well
+	measure("Enabled LOG, async writer", numThreads, iterations, [&](size_t i)
+	{
+		LOG(log, INFO) << "Send event, " << text << ", id: " << i;
+	}, &LogWriter::stop);
+
+	cout << "Dropped: " << LogWriter::getNumDropped() - numDropped << endl;
+
+	Log::setStreamBuffer(cout.rdbuf());
+
+	return 0;
+}
@@ -19,6 +19,7 @@
  */
 
 #include "XenCtrlMock.hpp"
+#include "XenEvtchnMock.hpp"
 
 #include <algorithm>
 
@@ -81,6 +82,32 @@ int xc_domain_getinfolist(xc_interface* xch,
 	return xch->mock->getDomInfos(first_domain, max_domains, info);
 }
 
+int xc_evtchn_status(xc_interface* xch, xc_evtchn_status_t* status)
+{
+	if (XenCtrlMock::getErrorMode() || status->dom != DOMID_SELF)
+	{
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	domid_t domId;
+	evtchn_port_t remotePort;
+
+	if (XenEvtchnMock::getRemotePort(status->port, domId, remotePort))
+	{
+		status->status = EVTCHNSTAT_interdomain;
+		status->u.interdomain.dom = domId;
+		status->u.interdomain.port = remotePort;
+	}
+	else
+	{
+		status->status = EVTCHNSTAT_closed;
+	}
+
+	return 0;
+}
+
 /*******************************************************************************
  * XenCtrlMock
  ******************************************************************************/
@@ -88,6 +115,7 @@ int xc_domain_getinfolist(xc_interface* xch,
 mutex XenCtrlMock::sMutex;
 bool XenCtrlMock::sErrorMode = false;
 list<xc_domaininfo_t> XenCtrlMock::sDomInfos;
+size_t XenCtrlMock::sNumGetDomInfos = 0;
 
 /*******************************************************************************
  * Public
@@ -97,16 +125,27 @@ void XenCtrlMock::addDomInfo(const xc_domaininfo_t& info)
 {
 	lock_guard<mutex> lock(sMutex);
 
+	// domain infos are sorted by domain id
 	auto it = find_if(sDomInfos.begin(), sDomInfos.end(),
 					 [&info](const xc_domaininfo_t& item)
-					 { return item.domain == info.domain; });
+					 { return item.domain >= info.domain; });
 
-	if (it != sDomInfos.end())
+	if (it != sDomInfos.end() && it->domain == info.domain)
 	{
 		*it = info;
 	}
+	else
+	{
+		sDomInfos.insert(it, info);
+	}
+}
+
+void XenCtrlMock::removeDomInfo(domid_t domId)
+{
+	lock_guard<mutex> lock(sMutex);
 
-	sDomInfos.push_back(info);
+	sDomInfos.remove_if([domId](const xc_domaininfo_t& item)
+						{ return item.domain == domId; });
 }
 
 int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
@@ -116,14 +155,11 @@ int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
 
 	unsigned int count = 0;
 
+	sNumGetDomInfos++;
+
 	auto it = find_if(sDomInfos.begin(), sDomInfos.end(),
 					 [&firstDom](const xc_domaininfo_t& item)
-					 { return item.domain == firstDom; });
-
-	if (it == sDomInfos.end())
-	{
-		it = sDomInfos.begin();
-	}
+					 { return item.domain >= firstDom; });
 
 	for(; it != sDomInfos.end(); it++)
 	{
@@ -45,7 +45,15 @@ public:
 		return sErrorMode;
 	}
 
+	static size_t getNumGetDomInfos()
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		return sNumGetDomInfos;
+	}
+
 	static void addDomInfo(const xc_domaininfo_t& info);
+	static void removeDomInfo(domid_t domId);
 	static int getDomInfos(domid_t firstDom, unsigned int maxDoms,
 						   xc_domaininfo_t* info);
 
@@ -54,6 +62,7 @@ private:
 	static std::mutex sMutex;
 	static bool sErrorMode;
 	static std::list<xc_domaininfo_t> sDomInfos;
+	static size_t sNumGetDomInfos;
 };
 
 #endif /* TESTS_MOCKS_XENCTRLMOCK_HPP_ */
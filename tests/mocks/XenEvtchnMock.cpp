@@ -174,6 +174,36 @@ void XenEvtchnMock::signalPort(evtchn_port_t port)
 	client->mPipe.write();
 }
 
+bool XenEvtchnMock::getRemotePort(evtchn_port_t port, domid_t& domId,
+								  evtchn_port_t& remotePort)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	for (auto client : sClients)
+	{
+		auto it = client->getBoundPort(port);
+
+		if (it != client->mBoundPorts.end() && !it->remoteClosed)
+		{
+			domId = it->domId;
+			remotePort = it->remotePort;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void XenEvtchnMock::closeRemotePort(evtchn_port_t port)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto client = getClientByPort(port);
+
+	client->getBoundPort(port)->remoteClosed = true;
+}
+
 void XenEvtchnMock::setNotifyCbk(evtchn_port_t port, NotifyCbk cbk)
 {
 	getClientByPort(port)->mNotifyCbk = cbk;
@@ -193,7 +223,7 @@ evtchn_port_t XenEvtchnMock::bind(domid_t domId, evtchn_port_t remotePort)
 		throw Exception("Port already bound", EPERM);
 	}
 
-	BoundPort boundPort = { domId, remotePort, sPort++ };
+	BoundPort boundPort = { domId, remotePort, sPort++, false };
 
 	mBoundPorts.push_back(boundPort);
 
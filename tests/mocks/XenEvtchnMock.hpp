@@ -66,6 +66,14 @@ public:
 		return sLastBoundPort;
 	}
 	static void signalPort(evtchn_port_t port);
+
+	// Returns the remote end of the local port, false if the port isn't bound
+	// or is closed by the remote end
+	static bool getRemotePort(evtchn_port_t port, domid_t& domId,
+							  evtchn_port_t& remotePort);
+
+	// Simulates closing the port by the remote end
+	static void closeRemotePort(evtchn_port_t port);
 	static void setNotifyCbk(evtchn_port_t port, NotifyCbk cbk);
 
 	int getFd() const { return mPipe.getFd(); }
@@ -81,6 +89,7 @@ private:
 		domid_t domId;
 		evtchn_port_t remotePort;
 		evtchn_port_t localPort;
+		bool remoteClosed;
 	};
 
 	static std::mutex sMutex;
@@ -21,17 +21,25 @@
 #include "XenGnttabMock.hpp"
 
 #include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xengnttab.h>
+#include <xen/grant_table.h>
 }
 
 #include "Exception.hpp"
 
+using std::condition_variable;
 using std::lock_guard;
 using std::mutex;
+using std::unique_lock;
 using std::unordered_map;
+using std::unordered_set;
+using std::vector;
 
 using XenBackend::Exception;
 
@@ -86,7 +94,14 @@ void* xengnttab_map_domain_grant_refs(xengnttab_handle* xgt,
 		return nullptr;
 	}
 
-	return xgt->mock->mapGrantRefs(count, domid, refs);
+	auto address = xgt->mock->mapGrantRefs(count, domid, refs, prot);
+
+	if (!address)
+	{
+		errno = EINVAL;
+	}
+
+	return address;
 }
 
 int xengnttab_unmap(xengnttab_handle* xgt, void* start_address, uint32_t count)
@@ -101,6 +116,70 @@ int xengnttab_unmap(xengnttab_handle* xgt, void* start_address, uint32_t count)
 	return 0;
 }
 
+int xengnttab_grant_copy(xengnttab_handle* xgt, uint32_t count,
+						 xengnttab_grant_copy_segment_t* segs)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto& seg = segs[i];
+
+		if (seg.flags == GNTCOPY_source_gref)
+		{
+			seg.status = xgt->mock->copyGrantRef(seg.source.foreign.domid,
+												 seg.source.foreign.ref,
+												 seg.source.foreign.offset,
+												 seg.dest.virt, seg.len,
+												 false);
+		}
+		else if (seg.flags == GNTCOPY_dest_gref)
+		{
+			seg.status = xgt->mock->copyGrantRef(seg.dest.foreign.domid,
+												 seg.dest.foreign.ref,
+												 seg.dest.foreign.offset,
+												 seg.source.virt, seg.len,
+												 true);
+		}
+		else
+		{
+			seg.status = GNTST_general_error;
+		}
+	}
+
+	return 0;
+}
+
+int xengnttab_dmabuf_exp_from_refs(xengnttab_handle* xgt, uint32_t domid,
+								   uint32_t flags, uint32_t count,
+								   const uint32_t* refs, uint32_t* fd)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return -1;
+	}
+
+	*fd = xgt->mock->exportDmaBuffer();
+
+	return 0;
+}
+
+int xengnttab_dmabuf_exp_wait_released(xengnttab_handle* xgt, uint32_t fd,
+									   uint32_t wait_to_ms)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return -1;
+	}
+
+	xgt->mock->releaseDmaBuffer(fd);
+
+	return 0;
+}
+
 /*******************************************************************************
  * XenGnttabMock
  ******************************************************************************/
@@ -108,6 +187,11 @@ int xengnttab_unmap(xengnttab_handle* xgt, void* start_address, uint32_t count)
 mutex XenGnttabMock::sMutex;
 void* XenGnttabMock::sLastMappedAddress = nullptr;
 unordered_map<void*, XenGnttabMock::MapBuffer> XenGnttabMock::sMapBuffers;
+unordered_map<uint64_t, vector<uint8_t>> XenGnttabMock::sGrantPages;
+unordered_set<uint64_t> XenGnttabMock::sRevokedRefs;
+unordered_set<int> XenGnttabMock::sDmaBuffers;
+bool XenGnttabMock::sHoldDmaRelease = false;
+condition_variable XenGnttabMock::sDmaCondVar;
 bool XenGnttabMock::sErrorMode = false;
 
 /*******************************************************************************
@@ -115,11 +199,19 @@ bool XenGnttabMock::sErrorMode = false;
  ******************************************************************************/
 
 void* XenGnttabMock::mapGrantRefs(uint32_t count, uint32_t domId,
-								  uint32_t *refs)
+								  uint32_t *refs, int prot)
 {
 	lock_guard<mutex> lock(sMutex);
 
-	MapBuffer buffer = { count, domId, count * XC_PAGE_SIZE };
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (sRevokedRefs.count(getGrantKey(domId, refs[i])))
+		{
+			return nullptr;
+		}
+	}
+
+	MapBuffer buffer = { count, domId, count * XC_PAGE_SIZE, prot };
 
 	void* address = calloc(1, buffer.size);
 
@@ -165,9 +257,107 @@ size_t XenGnttabMock::getMapBufferSize(void* address)
 	return it->second.size;
 }
 
+int XenGnttabMock::getMapBufferProt(void* address)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto it = sMapBuffers.find(address);
+
+	if (it == sMapBuffers.end())
+	{
+		throw Exception("Buffer not found", ENOENT);
+	}
+
+	return it->second.prot;
+}
+
 size_t XenGnttabMock::checkMapBuffers()
 {
 	lock_guard<mutex> lock(sMutex);
 
 	return sMapBuffers.size();
 }
+
+uint8_t* XenGnttabMock::getGrantPage(uint32_t domId, uint32_t ref)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto& page = sGrantPages[getGrantKey(domId, ref)];
+
+	page.resize(XC_PAGE_SIZE);
+
+	return page.data();
+}
+
+void XenGnttabMock::revokeGrantRef(uint32_t domId, uint32_t ref)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	sRevokedRefs.insert(getGrantKey(domId, ref));
+}
+
+int16_t XenGnttabMock::copyGrantRef(uint32_t domId, uint32_t ref,
+									uint16_t offset, void* local,
+									uint16_t len, bool toForeign)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto key = getGrantKey(domId, ref);
+
+	if (sRevokedRefs.count(key))
+	{
+		return GNTST_bad_gntref;
+	}
+
+	if (offset + len > XC_PAGE_SIZE)
+	{
+		return GNTST_general_error;
+	}
+
+	auto& page = sGrantPages[key];
+
+	page.resize(XC_PAGE_SIZE);
+
+	if (toForeign)
+	{
+		memcpy(&page[offset], local, len);
+	}
+	else
+	{
+		memcpy(local, &page[offset], len);
+	}
+
+	return GNTST_okay;
+}
+
+int XenGnttabMock::exportDmaBuffer()
+{
+	lock_guard<mutex> lock(sMutex);
+
+	int fd = open("/dev/null", O_RDONLY);
+
+	if (fd < 0)
+	{
+		throw Exception("Can't open DMA buffer", errno);
+	}
+
+	// the number of the buffer being released must not be reused
+	if (!sDmaBuffers.insert(fd).second)
+	{
+		throw Exception("DMA buffer fd is reused", EEXIST);
+	}
+
+	return fd;
+}
+
+void XenGnttabMock::releaseDmaBuffer(int fd)
+{
+	unique_lock<mutex> lock(sMutex);
+
+	sDmaCondVar.wait(lock, [] { return !sHoldDmaRelease; });
+
+	if (!sDmaBuffers.erase(fd))
+	{
+		throw Exception("DMA buffer not found", ENOENT);
+	}
+}
@@ -21,8 +21,13 @@
 #ifndef TESTS_MOCKS_XENGNTTABMOCK_HPP_
 #define TESTS_MOCKS_XENGNTTABMOCK_HPP_
 
+#include <condition_variable>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
 
 class XenGnttabMock
 {
@@ -48,10 +53,47 @@ public:
 	}
 
 	static size_t getMapBufferSize(void* address);
+	static int getMapBufferProt(void* address);
 	static size_t checkMapBuffers();
 
-	void* mapGrantRefs(uint32_t count, uint32_t domId, uint32_t *refs);
+	/**
+	 * Returns foreign page used by grant copy
+	 */
+	static uint8_t* getGrantPage(uint32_t domId, uint32_t ref);
+
+	/**
+	 * Grant copy segments and mappings with revoked reference fail
+	 */
+	static void revokeGrantRef(uint32_t domId, uint32_t ref);
+
+	/**
+	 * Returns number of exported DMA buffers which are not released
+	 */
+	static size_t getNumDmaBuffers()
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		return sDmaBuffers.size();
+	}
+
+	/**
+	 * Blocks waiting for DMA buffer release till the hold is removed
+	 */
+	static void holdDmaBufferRelease(bool hold)
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		sHoldDmaRelease = hold;
+		sDmaCondVar.notify_all();
+	}
+
+	void* mapGrantRefs(uint32_t count, uint32_t domId, uint32_t *refs,
+					   int prot);
 	void unmapGrantRefs(void* address, uint32_t count);
+	int16_t copyGrantRef(uint32_t domId, uint32_t ref, uint16_t offset,
+						 void* local, uint16_t len, bool toForeign);
+	int exportDmaBuffer();
+	void releaseDmaBuffer(int fd);
 
 private:
 
@@ -60,12 +102,23 @@ private:
 		uint32_t count;
 		uint32_t domId;
 		size_t size;
+		int prot;
 	};
 
 	static std::mutex sMutex;
 	static bool sErrorMode;
 	static void* sLastMappedAddress;
 	static std::unordered_map<void*, MapBuffer> sMapBuffers;
+	static std::unordered_map<uint64_t, std::vector<uint8_t>> sGrantPages;
+	static std::unordered_set<uint64_t> sRevokedRefs;
+	static std::unordered_set<int> sDmaBuffers;
+	static bool sHoldDmaRelease;
+	static std::condition_variable sDmaCondVar;
+
+	static uint64_t getGrantKey(uint32_t domId, uint32_t ref)
+	{
+		return (static_cast<uint64_t>(domId) << 32) | ref;
+	}
 };
 
 #endif /* TESTS_MOCKS_XENGNTTABMOCK_HPP_ */
@@ -21,6 +21,7 @@
 #include "XenStoreMock.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 
@@ -77,6 +78,35 @@ int xs_fileno(struct xs_handle* h)
 	return h->mock->getFd();
 }
 
+xs_transaction_t xs_transaction_start(xs_handle* h)
+{
+	static xs_transaction_t transaction = XBT_NULL;
+
+	if (XenStoreMock::getErrorMode())
+	{
+		return XBT_NULL;
+	}
+
+	return ++transaction;
+}
+
+bool xs_transaction_end(xs_handle* h, xs_transaction_t t, bool abort)
+{
+	if (XenStoreMock::getErrorMode())
+	{
+		return false;
+	}
+
+	if (!abort && !XenStoreMock::endTransaction())
+	{
+		errno = EAGAIN;
+
+		return false;
+	}
+
+	return true;
+}
+
 char* xs_get_domain_path(xs_handle* h, unsigned int domid)
 {
 	if (XenStoreMock::getErrorMode())
@@ -119,6 +149,10 @@ void* xs_read(xs_handle* h, xs_transaction_t t,
 
 		strcpy(result, value);
 	}
+	else
+	{
+		errno = ENOENT;
+	}
 
 	return result;
 }
@@ -193,7 +227,7 @@ bool xs_watch(xs_handle* h, const char* path, const char* token)
 		return false;
 	}
 
-	return h->mock->watch(path);
+	return h->mock->watch(path, token);
 }
 
 bool xs_unwatch(xs_handle* h, const char* path, const char* token)
@@ -203,7 +237,7 @@ bool xs_unwatch(xs_handle* h, const char* path, const char* token)
 		return false;
 	}
 
-	return h->mock->unwatch(path);
+	return h->mock->unwatch(path, token);
 }
 
 char **xs_read_watch(struct xs_handle *h, unsigned int *num)
@@ -214,22 +248,25 @@ char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 	}
 
 	char** value = nullptr;
-	string path;
+	string path, token;
 
-	while (h->mock->getChangedEntry(path))
+	if (h->mock->getChangedEntry(path, token))
 	{
-		size_t totalLength = 2 * sizeof(char*) + 2 * (path.length() + 1);
+		size_t totalLength = 2 * sizeof(char*) + path.length() + 1 +
+							 token.length() + 1;
 
 		value = static_cast<char**>(malloc(totalLength));
 		char* pos = reinterpret_cast<char*>(&value[2]);
 
-		value[0] = pos;
+		value[XS_WATCH_PATH] = pos;
+
+		strcpy(value[XS_WATCH_PATH], path.c_str());
 
-		strcpy(value[0], path.c_str());
+		value[XS_WATCH_TOKEN] = pos + path.length() + 1;
 
-		value[1] = pos + path.length() + 1;
+		strcpy(value[XS_WATCH_TOKEN], token.c_str());
 
-		strcpy(value[1], path.c_str());
+		*num = 2;
 	}
 
 	return value;
@@ -238,29 +275,9 @@ char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 
 char** xs_check_watch(xs_handle* h)
 {
-	if (XenStoreMock::getErrorMode())
-	{
-		return nullptr;
-	}
-
-	char** value = nullptr;
-	string path;
-
-	if (h->mock->getChangedEntry(path))
-	{
-		size_t totalLength = 2 * sizeof(char*) + path.length() + 1;
+	unsigned int num;
 
-		value = static_cast<char**>(malloc(totalLength));
-		char* pos = reinterpret_cast<char*>(&value[2]);
-
-		value[0] = pos;
-
-		strcpy(pos, path.c_str());
-
-		value[1] = nullptr;
-	}
-
-	return value;
+	return xs_read_watch(h, &num);
 }
 
 /*******************************************************************************
@@ -268,6 +285,7 @@ char** xs_check_watch(xs_handle* h)
  ******************************************************************************/
 
 bool XenStoreMock::sErrorMode = false;
+int XenStoreMock::sTransactionConflicts = 0;
 
 unordered_map<unsigned int, string> XenStoreMock::sDomPathes;
 unordered_map<string, string> XenStoreMock::sEntries;
@@ -291,6 +309,20 @@ XenStoreMock::~XenStoreMock()
  * Public
  ******************************************************************************/
 
+bool XenStoreMock::endTransaction()
+{
+	lock_guard<mutex> lock(sMutex);
+
+	if (sTransactionConflicts > 0)
+	{
+		sTransactionConflicts--;
+
+		return false;
+	}
+
+	return true;
+}
+
 void XenStoreMock::setDomainPath(unsigned int domId, const std::string& path)
 {
 	lock_guard<mutex> lock(sMutex);
@@ -358,7 +390,7 @@ bool XenStoreMock::deleteEntry(const std::string& path)
 	{
 		sEntries.erase(it);
 
-		pushWatch(path);
+		pushWatch(path, true);
 
 		return true;
 	}
@@ -412,25 +444,29 @@ vector<string> XenStoreMock::readDirectory(const string& path)
 	return result;
 }
 
-bool XenStoreMock::watch(const std::string& path)
+bool XenStoreMock::watch(const string& path, const string& token)
 {
 	lock_guard<mutex> lock(sMutex);
 
-	if (find(mWatches.begin(), mWatches.end(), path) == mWatches.end())
+	WatchEntry entry(path, token);
+
+	if (find(mWatches.begin(), mWatches.end(), entry) == mWatches.end())
 	{
-		mWatches.push_back(path);
+		mWatches.push_back(entry);
 	}
 
-	pushWatch(path);
+	// Xen store fires the watch once it is set
+	mChangedEntries.push_back(entry);
+	mPipe.write();
 
 	return true;
 }
 
-bool XenStoreMock::unwatch(const std::string& path)
+bool XenStoreMock::unwatch(const string& path, const string& token)
 {
 	lock_guard<mutex> lock(sMutex);
 
-	auto it = find(mWatches.begin(), mWatches.end(), path);
+	auto it = find(mWatches.begin(), mWatches.end(), WatchEntry(path, token));
 
 	if (it != mWatches.end())
 	{
@@ -442,13 +478,14 @@ bool XenStoreMock::unwatch(const std::string& path)
 	return false;
 }
 
-bool XenStoreMock::getChangedEntry(std::string& path)
+bool XenStoreMock::getChangedEntry(string& path, string& token)
 {
 	lock_guard<mutex> lock(sMutex);
 
 	if (mChangedEntries.size())
 	{
-		path = mChangedEntries.front();
+		path = mChangedEntries.front().first;
+		token = mChangedEntries.front().second;
 
 		mChangedEntries.pop_front();
 
@@ -460,15 +497,36 @@ bool XenStoreMock::getChangedEntry(std::string& path)
 	return false;
 }
 
-void XenStoreMock::pushWatch(const std::string& path)
+bool XenStoreMock::isChild(const string& path, const string& parent)
+{
+	if (path.compare(0, parent.length(), parent) != 0)
+	{
+		return false;
+	}
+
+	return path.length() == parent.length() || path[parent.length()] == '/' ||
+		   parent.back() == '/';
+}
+
+void XenStoreMock::pushWatch(const string& path, bool recursive)
 {
 	for(auto client : sClients)
 	{
-		if (find(client->mWatches.begin(), client->mWatches.end(), path) !=
-			client->mWatches.end())
+		for(auto watch : client->mWatches)
 		{
-			client->mChangedEntries.push_back(path);
-			client->mPipe.write();
+			// Xen store notifies watches of the path and its parents and,
+			// on removing, watches of the path children
+			if (isChild(path, watch.first))
+			{
+				client->mChangedEntries.push_back(WatchEntry(path,
+															 watch.second));
+				client->mPipe.write();
+			}
+			else if (recursive && isChild(watch.first, path))
+			{
+				client->mChangedEntries.push_back(watch);
+				client->mPipe.write();
+			}
 		}
 	}
 }
@@ -49,6 +49,14 @@ public:
 
 		return sErrorMode;
 	}
+	// number of the next transactions which end with EAGAIN
+	static void setTransactionConflicts(int conflicts)
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		sTransactionConflicts = conflicts;
+	}
+	static bool endTransaction();
 	static void setDomainPath(unsigned int domId, const std::string& path);
 	static const char* getDomainPath(unsigned int domId);
 	static void writeValue(const std::string& path, const std::string& value);
@@ -57,9 +65,9 @@ public:
 	static std::vector<std::string> readDirectory(const std::string& path);
 
 	int getFd() const { return mPipe.getFd(); }
-	bool watch(const std::string& path);
-	bool unwatch(const std::string& path);
-	bool getChangedEntry(std::string& path);
+	bool watch(const std::string& path, const std::string& token);
+	bool unwatch(const std::string& path, const std::string& token);
+	bool getChangedEntry(std::string& path, std::string& token);
 
 	typedef std::function<void(const std::string& path,
 							   const std::string& value)> Callback;
@@ -75,6 +83,7 @@ private:
 
 	static std::mutex sMutex;
 	static bool sErrorMode;
+	static int sTransactionConflicts;
 	static std::unordered_map<unsigned int, std::string> sDomPathes;
 	static std::unordered_map<std::string, std::string> sEntries;
 	static std::list<XenStoreMock*> sClients;
@@ -82,10 +91,14 @@ private:
 
 	Pipe mPipe;
 
-	std::list<std::string> mWatches;
-	std::list<std::string> mChangedEntries;
+	// path and token
+	typedef std::pair<std::string, std::string> WatchEntry;
+
+	std::list<WatchEntry> mWatches;
+	std::list<WatchEntry> mChangedEntries;
 
-	static void pushWatch(const std::string& path);
+	static bool isChild(const std::string& path, const std::string& parent);
+	static void pushWatch(const std::string& path, bool recursive = false);
 };
 
 #endif /* TESTS_MOCKS_XENSTOREMOCK_HPP_ */
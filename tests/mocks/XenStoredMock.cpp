@@ -0,0 +1,357 @@
+/*
+ *  XenStoredMock
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "XenStoredMock.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Exception.hpp"
+#include "XenStoreMock.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::reverse;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::vector;
+
+using XenBackend::Exception;
+
+/*******************************************************************************
+ * XenStoredMock
+ ******************************************************************************/
+
+XenStoredMock::XenStoredMock(const string& socketPath) :
+	mSocketPath(socketPath),
+	mListenFd(-1),
+	mClientFd(-1),
+	mBatchSize(1),
+	mNumRequests(0),
+	mTransactionId(0)
+{
+	sockaddr_un addr = {};
+
+	addr.sun_family = AF_UNIX;
+	mSocketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+	unlink(mSocketPath.c_str());
+
+	mListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (mListenFd < 0)
+	{
+		throw Exception("Can't create socket", errno);
+	}
+
+	if (bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+		listen(mListenFd, 1) < 0)
+	{
+		close(mListenFd);
+
+		throw Exception("Can't listen " + mSocketPath, errno);
+	}
+
+	mThread = thread(&XenStoredMock::run, this);
+}
+
+XenStoredMock::~XenStoredMock()
+{
+	mStopPipe.write();
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	closeConnection();
+
+	close(mListenFd);
+
+	unlink(mSocketPath.c_str());
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void XenStoredMock::closeConnection()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mClientFd >= 0)
+	{
+		shutdown(mClientFd, SHUT_RDWR);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenStoredMock::run()
+{
+	if (!waitForFd(mListenFd))
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mClientFd = accept(mListenFd, nullptr, nullptr);
+
+		if (mClientFd < 0)
+		{
+			return;
+		}
+	}
+
+	while (waitForFd(mClientFd) && receiveRequests());
+
+	lock_guard<mutex> lock(mMutex);
+
+	close(mClientFd);
+
+	mClientFd = -1;
+}
+
+bool XenStoredMock::waitForFd(int fd)
+{
+	pollfd fds[2] = {{fd, POLLIN, 0}, {mStopPipe.getFd(), POLLIN, 0}};
+
+	if (poll(fds, 2, -1) < 0)
+	{
+		return false;
+	}
+
+	return !(fds[1].revents & POLLIN);
+}
+
+bool XenStoredMock::receiveRequests()
+{
+	char buffer[XENSTORE_PAYLOAD_MAX];
+
+	auto size = read(mClientFd, buffer, sizeof(buffer));
+
+	if (size <= 0)
+	{
+		return false;
+	}
+
+	mReceiveBuffer.insert(mReceiveBuffer.end(), buffer, buffer + size);
+
+	size_t pos = 0;
+
+	while (mReceiveBuffer.size() - pos >= sizeof(xsd_sockmsg))
+	{
+		Message request;
+
+		memcpy(&request.header, &mReceiveBuffer[pos], sizeof(xsd_sockmsg));
+
+		if (mReceiveBuffer.size() - pos <
+			sizeof(xsd_sockmsg) + request.header.len)
+		{
+			break;
+		}
+
+		request.payload.assign(&mReceiveBuffer[pos + sizeof(xsd_sockmsg)],
+							   request.header.len);
+
+		pos += sizeof(xsd_sockmsg) + request.header.len;
+
+		mReplies.push_back(processRequest(request));
+
+		lock_guard<mutex> lock(mMutex);
+
+		mNumRequests++;
+	}
+
+	mReceiveBuffer.erase(mReceiveBuffer.begin(), mReceiveBuffer.begin() + pos);
+
+	sendReplies();
+
+	return true;
+}
+
+XenStoredMock::Message XenStoredMock::processRequest(const Message& request)
+{
+	Message reply;
+
+	reply.header = request.header;
+
+	auto path = request.payload.substr(0, request.payload.find('\0'));
+	int error = 0;
+
+	switch(request.header.type)
+	{
+	case XS_READ:
+	{
+		auto value = XenStoreMock::readValue(path);
+
+		if (value)
+		{
+			reply.payload = value;
+		}
+		else
+		{
+			error = ENOENT;
+		}
+
+		break;
+	}
+
+	case XS_WRITE:
+	{
+		auto pos = request.payload.find('\0');
+
+		XenStoreMock::writeValue(path, pos == string::npos ? string() :
+								 request.payload.substr(pos + 1));
+
+		reply.payload = string("OK", 3);
+
+		break;
+	}
+
+	case XS_DIRECTORY:
+	{
+		if (!XenStoreMock::readValue(path))
+		{
+			error = ENOENT;
+
+			break;
+		}
+
+		for (auto item : XenStoreMock::readDirectory(path))
+		{
+			reply.payload.append(item);
+			reply.payload.push_back('\0');
+		}
+
+		break;
+	}
+
+	case XS_RM:
+	{
+		if (!XenStoreMock::deleteEntry(path))
+		{
+			error = ENOENT;
+		}
+		else
+		{
+			reply.payload = string("OK", 3);
+		}
+
+		break;
+	}
+
+	case XS_GET_DOMAIN_PATH:
+	{
+		auto domPath = XenStoreMock::getDomainPath(stoul(path));
+
+		if (domPath)
+		{
+			reply.payload = string(domPath) + '\0';
+		}
+		else
+		{
+			error = ENOENT;
+		}
+
+		break;
+	}
+
+	case XS_TRANSACTION_START:
+	{
+		reply.payload = to_string(++mTransactionId) + '\0';
+
+		break;
+	}
+
+	case XS_TRANSACTION_END:
+	{
+		if (path == "T" && !XenStoreMock::endTransaction())
+		{
+			error = EAGAIN;
+
+			break;
+		}
+
+		reply.payload = string("OK", 3);
+
+		break;
+	}
+
+	default:
+		error = ENOSYS;
+	}
+
+	if (error)
+	{
+		reply.header.type = XS_ERROR;
+
+		for (auto& item : xsd_errors)
+		{
+			if (item.errnum == error)
+			{
+				reply.payload = string(item.errstring) + '\0';
+			}
+		}
+	}
+
+	reply.header.len = reply.payload.length();
+
+	return reply;
+}
+
+void XenStoredMock::sendReplies()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (mReplies.size() < mBatchSize)
+		{
+			return;
+		}
+	}
+
+	reverse(mReplies.begin(), mReplies.end());
+
+	for (auto& reply : mReplies)
+	{
+		string message(reinterpret_cast<const char*>(&reply.header),
+					   sizeof(reply.header));
+
+		message.append(reply.payload);
+
+		if (write(mClientFd, message.data(), message.length()) < 0)
+		{
+			throw Exception("Can't write reply", errno);
+		}
+	}
+
+	mReplies.clear();
+}
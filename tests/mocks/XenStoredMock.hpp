@@ -0,0 +1,96 @@
+/*
+ *  XenStoredMock
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef TESTS_MOCKS_XENSTOREDMOCK_HPP_
+#define TESTS_MOCKS_XENSTOREDMOCK_HPP_
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+#include <xen/io/xs_wire.h>
+}
+
+#include "Pipe.hpp"
+
+/*
+ * In-process xenstored which serves XenStoreMock entries over a Unix socket
+ * using Xen store wire protocol.
+ */
+class XenStoredMock
+{
+public:
+
+	explicit XenStoredMock(const std::string& socketPath);
+	~XenStoredMock();
+
+	const std::string& getSocketPath() const { return mSocketPath; }
+
+	// Holds replies until the defined number of requests is received, then
+	// replies in reverse order
+	void setBatchSize(size_t batchSize)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mBatchSize = batchSize;
+	}
+
+	size_t getNumRequests()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		return mNumRequests;
+	}
+
+	void closeConnection();
+
+private:
+
+	struct Message
+	{
+		xsd_sockmsg header;
+		std::string payload;
+	};
+
+	std::string mSocketPath;
+	int mListenFd;
+	int mClientFd;
+	size_t mBatchSize;
+	size_t mNumRequests;
+	uint32_t mTransactionId;
+
+	Pipe mStopPipe;
+	std::thread mThread;
+	std::mutex mMutex;
+
+	std::vector<char> mReceiveBuffer;
+	std::vector<Message> mReplies;
+
+	void run();
+	bool waitForFd(int fd);
+	bool receiveRequests();
+	Message processRequest(const Message& request);
+	void sendReplies();
+};
+
+#endif /* TESTS_MOCKS_XENSTOREDMOCK_HPP_ */
@@ -0,0 +1,321 @@
+/*
+ *  Test AsyncXenStore
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <utility>
+
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "mocks/XenStoreMock.hpp"
+#include "mocks/XenStoredMock.hpp"
+#include "AsyncXenStore.hpp"
+#include "XenStoreSchema.hpp"
+
+using std::chrono::seconds;
+using std::future;
+using std::future_status;
+using std::string;
+using std::to_string;
+using std::vector;
+
+using XenBackend::AsyncXenStore;
+using XenBackend::XenStoreException;
+using XenBackend::XenStoreField;
+using XenBackend::XenStoreSchema;
+
+struct AsyncSchemaConfig
+{
+	int port;
+	unsigned int ref;
+	string protocol;
+	bool feature;
+};
+
+static const XenStoreField<AsyncSchemaConfig> cAsyncSchemaFields[] = {
+	XENSTORE_FIELD(AsyncSchemaConfig, port, "event-channel"),
+	XENSTORE_FIELD(AsyncSchemaConfig, ref, "ring-ref"),
+	XENSTORE_OPTIONAL_FIELD(AsyncSchemaConfig, protocol, "protocol"),
+	XENSTORE_OPTIONAL_FIELD(AsyncSchemaConfig, feature, "feature-persistent")
+};
+
+TEST_CASE("AsyncXenStore", "[xenstore]")
+{
+	XenStoredMock xenStored("/tmp/xenstored-mock-" + to_string(getpid()));
+
+	AsyncXenStore xenStore(xenStored.getSocketPath());
+
+	SECTION("Check pipelined requests")
+	{
+		const int cNumRequests = 16;
+
+		xenStored.setBatchSize(cNumRequests);
+
+		vector<future<void>> writes;
+
+		for (int i = 0; i < cNumRequests; i++)
+		{
+			writes.push_back(xenStore.writeString(
+					"/async/entry" + to_string(i), "value" + to_string(i)));
+		}
+
+		// all requests are in flight, replies come in reverse order
+
+		for (auto& write : writes)
+		{
+			REQUIRE(write.wait_for(seconds(1)) == future_status::ready);
+			write.get();
+		}
+
+		vector<future<string>> reads;
+
+		for (int i = 0; i < cNumRequests; i++)
+		{
+			reads.push_back(xenStore.readString("/async/entry" +
+												to_string(i)));
+		}
+
+		for (int i = 0; i < cNumRequests; i++)
+		{
+			REQUIRE(reads[i].wait_for(seconds(1)) == future_status::ready);
+			REQUIRE(reads[i].get() == "value" + to_string(i));
+		}
+
+		REQUIRE(xenStored.getNumRequests() == 2 * cNumRequests);
+		REQUIRE(xenStore.getPendingRequests() == 0);
+	}
+
+	SECTION("Check callbacks")
+	{
+		std::promise<std::pair<int, string>> value;
+
+		XenStoreMock::writeValue("/async/callback", "data");
+
+		// the callback is called from the client thread: check the result
+		// in the test thread
+		xenStore.readString("/async/callback",
+							[&value](int error, const string& result)
+		{
+			value.set_value(std::make_pair(error, result));
+		});
+
+		auto result = value.get_future();
+
+		REQUIRE(result.wait_for(seconds(1)) == future_status::ready);
+
+		auto reply = result.get();
+
+		REQUIRE(reply.first == 0);
+		REQUIRE(reply.second == "data");
+	}
+
+	SECTION("Check errors")
+	{
+		auto result = xenStore.readString("/async/notExist");
+
+		REQUIRE_THROWS_AS(result.get(), XenStoreException);
+
+		auto remove = xenStore.removePath("/async/notExist");
+
+		REQUIRE_THROWS_AS(remove.get(), XenStoreException);
+	}
+
+	SECTION("Check directory")
+	{
+		XenStoreMock::writeValue("/async/dir/item1", "");
+		XenStoreMock::writeValue("/async/dir/item2", "");
+		XenStoreMock::writeValue("/async/dir/item3", "");
+
+		auto items = xenStore.readDirectory("/async/dir").get();
+
+		REQUIRE(items.size() == 3);
+
+		xenStore.removePath("/async/dir/item2").get();
+
+		REQUIRE_FALSE(XenStoreMock::readValue("/async/dir/item2"));
+		REQUIRE(xenStore.readDirectory("/async/dir").get().size() == 2);
+	}
+
+	SECTION("Check domain path and transactions")
+	{
+		XenStoreMock::setDomainPath(5, "/local/domain/5");
+
+		REQUIRE(xenStore.getDomainPath(5).get() == "/local/domain/5");
+
+		auto transaction = xenStore.startTransaction().get();
+
+		REQUIRE(transaction != XBT_NULL);
+
+		xenStore.writeString("/async/transaction", "1", transaction);
+
+		xenStore.endTransaction(transaction).get();
+
+		REQUIRE(XenStoreMock::readValue("/async/transaction") == string("1"));
+	}
+
+	SECTION("Check read tree")
+	{
+		string path = "/async/tree";
+
+		XenStoreMock::writeValue(path + "/ring-ref", "8");
+		XenStoreMock::writeValue(path + "/event-channel", "12");
+		XenStoreMock::writeValue(path + "/queue-0/ring-ref", "9");
+		XenStoreMock::writeValue(path + "/queue-0/event-channel", "13");
+		XenStoreMock::writeValue(path + "/queue-1/ring-ref", "10");
+
+		auto tree = xenStore.readTree(path).get();
+
+		REQUIRE(tree.getPath() == path);
+		REQUIRE(tree.size() == 8);
+		REQUIRE(tree.checkIfExist(""));
+		REQUIRE(tree.readInt("ring-ref") == 8);
+		REQUIRE(tree.readUint("event-channel") == 12);
+		REQUIRE(tree.readString("queue-0/event-channel") == "13");
+		REQUIRE(tree.readInt("queue-1/ring-ref") == 10);
+		REQUIRE_FALSE(tree.checkIfExist("queue-1/event-channel"));
+		REQUIRE_THROWS_AS(tree.readInt("queue-1/event-channel"),
+						  XenStoreException);
+
+		auto items = tree.readDirectory("");
+
+		std::sort(items.begin(), items.end());
+
+		REQUIRE(items == vector<string>({"event-channel", "queue-0",
+										 "queue-1", "ring-ref"}));
+		REQUIRE(tree.readDirectory("queue-0").size() == 2);
+
+		for (size_t i = 1; i < tree.size(); i++)
+		{
+			REQUIRE(string(tree.getKey(i - 1)) < string(tree.getKey(i)));
+		}
+
+		// directories of the leaves aren't read: transaction start/end, 8
+		// values and 3 directories
+		auto numRequests = xenStored.getNumRequests();
+
+		tree = xenStore.readTree(path, UINT_MAX,
+								 {"ring-ref", "event-channel",
+								  "queue-0/ring-ref", "queue-0/event-channel",
+								  "queue-1/ring-ref"}).get();
+
+		REQUIRE(tree.size() == 8);
+		REQUIRE(xenStored.getNumRequests() - numRequests == 13);
+
+		// directories aren't read once the depth is spent: transaction
+		// start/end, 5 values and the root directory
+		numRequests = xenStored.getNumRequests();
+
+		tree = xenStore.readTree(path, 1).get();
+
+		REQUIRE(tree.size() == 5);
+		REQUIRE_FALSE(tree.checkIfExist("queue-0/ring-ref"));
+		REQUIRE(xenStored.getNumRequests() - numRequests == 8);
+
+		// children of the leaves aren't read
+		tree = xenStore.readTree(path, UINT_MAX, {"ring-ref", "queue-0"}).get();
+
+		REQUIRE(tree.size() == 6);
+		REQUIRE(tree.checkIfExist("queue-0"));
+		REQUIRE_FALSE(tree.checkIfExist("queue-0/ring-ref"));
+		REQUIRE(tree.readInt("queue-1/ring-ref") == 10);
+
+		XenStoreMock::setTransactionConflicts(2);
+
+		REQUIRE(xenStore.readTree(path).get().size() == 8);
+
+		XenStoreMock::setTransactionConflicts(100);
+
+		REQUIRE_THROWS_AS(xenStore.readTree(path).get(), XenStoreException);
+
+		XenStoreMock::setTransactionConflicts(0);
+
+		REQUIRE_THROWS_AS(xenStore.readTree("/async/notExist").get(),
+						  XenStoreException);
+	}
+
+	SECTION("Check schema")
+	{
+		string path = "/async/schema";
+		XenStoreSchema<AsyncSchemaConfig> schema(cAsyncSchemaFields);
+
+		XenStoreMock::writeValue(path + "/event-channel", "12");
+		XenStoreMock::writeValue(path + "/ring-ref", "8");
+		XenStoreMock::writeValue(path + "/feature-persistent", "1");
+		XenStoreMock::writeValue(path + "/undeclared", "0");
+
+		// only the declared keys are read and all of them are in flight
+		// before the first reply
+		xenStored.setBatchSize(schema.size());
+
+		auto numRequests = xenStored.getNumRequests();
+
+		AsyncSchemaConfig config = {};
+
+		config.protocol = "default";
+
+		schema.read(xenStore, path, config);
+
+		REQUIRE(xenStored.getNumRequests() - numRequests == schema.size());
+		REQUIRE(config.port == 12);
+		REQUIRE(config.ref == 8);
+		REQUIRE(config.protocol == "default");
+		REQUIRE(config.feature);
+
+		XenStoreMock::deleteEntry(path + "/event-channel");
+		XenStoreMock::writeValue(path + "/ring-ref", "-1");
+
+		try
+		{
+			schema.read(xenStore, path, config);
+
+			FAIL("XenStoreException is expected");
+		}
+		catch(const XenStoreException& e)
+		{
+			REQUIRE(e.getErrno() == ENOENT);
+			REQUIRE(string(e.what()).find("ring-ref") != string::npos);
+		}
+	}
+
+	SECTION("Check connection lost")
+	{
+		xenStore.writeString("/async/lost", "").get();
+
+		xenStored.setBatchSize(2);
+
+		auto result = xenStore.readString("/async/lost");
+
+		// the request is held by the server, the reply never comes
+
+		xenStored.closeConnection();
+
+		REQUIRE(result.wait_for(seconds(1)) == future_status::ready);
+		REQUIRE_THROWS_AS(result.get(), XenStoreException);
+	}
+}
+
+TEST_CASE("AsyncXenStore connect", "[xenstore]")
+{
+	REQUIRE_THROWS_AS(AsyncXenStore("/tmp/xenstored-mock-not-exist"),
+					  XenStoreException);
+}
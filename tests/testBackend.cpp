@@ -2,17 +2,26 @@
 #define CATCH_CONFIG_RUNNER
 #define CATCH_CONFIG_COLOUR_NONE
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cstdlib>
 #include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include "catch.hpp"
 
 #include "Log.hpp"
+#include "Utils.hpp"
 #include "mocks/XenCtrlMock.hpp"
 #include "mocks/XenEvtchnMock.hpp"
 #include "mocks/XenGnttabMock.hpp"
 #include "mocks/XenStoreMock.hpp"
+#include "mocks/XenStoredMock.hpp"
 #include "testBackend.hpp"
 #include "testFrontendHandler.hpp"
 
@@ -22,10 +31,12 @@ using std::mutex;
 using std::string;
 using std::to_string;
 using std::unique_lock;
+using std::vector;
 
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::Log;
 using XenBackend::LogLevel;
+using XenBackend::WorkerPool;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -36,6 +47,8 @@ static uint16_t gFrontDevId = 12;
 static const char* gDevName = "test_device";
 
 static bool gNewFrontend = false;
+static bool gSkipHandler = false;
+static int gNumNewFrontends = 0;
 static domid_t gNewFrontDomId = 0;
 static uint16_t gNewFrontDevId = 0;
 
@@ -45,7 +58,16 @@ void TestBackend::onNewFrontend(domid_t domId, uint16_t devId)
 
 	gNewFrontDomId = domId;
 	gNewFrontDevId = devId;
+	gNumNewFrontends++;
+
+	if (gSkipHandler)
+	{
+		gNewFrontend = true;
+
+		gCondVar.notify_all();
 
+		return;
+	}
 
 	FrontendHandlerPtr frontendHandler(new TestFrontendHandler(gDevName,
 															   getDomId(),
@@ -88,6 +110,8 @@ TEST_CASE("BackendHandler", "[backendhandler]")
 	TestBackend testBackend(gDevName);
 
 	gNewFrontend = false;
+	gSkipHandler = false;
+	gNumNewFrontends = 0;
 	gNewFrontDomId = 0;
 	gNewFrontDevId = 0;
 
@@ -107,9 +131,275 @@ TEST_CASE("BackendHandler", "[backendhandler]")
 		REQUIRE(gNewFrontDevId == gFrontDevId);
 	}
 
+	SECTION("Check frontend removal")
+	{
+		REQUIRE(waitForFrontend());
+
+		string bePath = "/local/domain/" + to_string(gDomId) + "/backend/" +
+						gDevName + "/" + to_string(gFrontDomId) + "/" +
+						to_string(gFrontDevId);
+
+		XenStoreMock::deleteEntry(bePath + "/frontend");
+		XenStoreMock::deleteEntry(bePath + "/state");
+
+		std::this_thread::sleep_for(milliseconds(100));
+
+		// the removed frontend is detected again when it comes back
+		TestFrontendHandler::prepareXenStore(gDevName,
+											 gDomId, gFrontDomId,
+											 gFrontDevId);
+
+		REQUIRE(waitForFrontend());
+
+		REQUIRE(gNewFrontDevId == gFrontDevId);
+		REQUIRE(gNumNewFrontends == 2);
+	}
+
+	SECTION("Check frontend without handler")
+	{
+		REQUIRE(waitForFrontend());
+
+		gSkipHandler = true;
+
+		TestFrontendHandler::prepareXenStore(gDevName,
+											 gDomId, gFrontDomId,
+											 gFrontDevId + 1);
+
+		REQUIRE(waitForFrontend());
+
+		gSkipHandler = false;
+
+		std::this_thread::sleep_for(milliseconds(100));
+
+		// the frontend without handler is detected again on the next device
+		// change
+		TestFrontendHandler::prepareXenStore(gDevName,
+											 gDomId, gFrontDomId,
+											 gFrontDevId + 2);
+
+		while (gNumNewFrontends < 4)
+		{
+			REQUIRE(waitForFrontend());
+		}
+
+		REQUIRE(gNumNewFrontends == 4);
+
+		for (uint16_t devId = gFrontDevId + 1; devId <= gFrontDevId + 2;
+			 devId++)
+		{
+			string bePath = "/local/domain/" + to_string(gDomId) +
+							"/backend/" + gDevName + "/" +
+							to_string(gFrontDomId) + "/" + to_string(devId);
+
+			XenStoreMock::deleteEntry(bePath + "/frontend");
+			XenStoreMock::deleteEntry(bePath + "/state");
+		}
+	}
+
+	SECTION("Check frontend registry")
+	{
+		REQUIRE(waitForFrontend());
+
+		// waits till the first burst is finished to not merge it with the
+		// next one
+		for (int i = 0; i < 100 && !testBackend.getBringUpStats().numFrontends;
+			 i++)
+		{
+			std::this_thread::sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(testBackend.getBringUpStats().numFrontends == 1);
+
+		// the device list changes: only the new frontend should be created
+		TestFrontendHandler::prepareXenStore(gDevName,
+											 gDomId, gFrontDomId,
+											 gFrontDevId + 1);
+
+		REQUIRE(waitForFrontend());
+
+		REQUIRE(gNewFrontDomId == gFrontDomId);
+		REQUIRE(gNewFrontDevId == gFrontDevId + 1);
+		REQUIRE(gNumNewFrontends == 2);
+
+		// waits for the bring-up workers
+		testBackend.stop();
+
+		auto stats = testBackend.getBringUpStats();
+
+		REQUIRE(stats.numFrontends == 1);
+		REQUIRE(stats.minLatency <= stats.averageLatency);
+		REQUIRE(stats.averageLatency <= stats.maxLatency);
+		REQUIRE(stats.minLatency <= stats.maxLatency);
+		REQUIRE(stats.maxLatency <= stats.duration);
+	}
+
 	testBackend.stop();
 }
 
+TEST_CASE("BackendHandler pipelined", "[backendhandler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	XenStoredMock xenStored("/tmp/xenstored-mock-" + to_string(getpid()));
+
+	setenv("XENSTORED_PATH", xenStored.getSocketPath().c_str(), 1);
+
+	TestFrontendHandler::prepareXenStore(gDevName,
+										 gDomId, gFrontDomId + 1,
+										 gFrontDevId);
+
+	TestBackend testBackend(gDevName);
+
+	gNewFrontend = false;
+	gNewFrontDomId = 0;
+
+	testBackend.start();
+
+	unsetenv("XENSTORED_PATH");
+
+	// the device lists are read through xenstored socket, frontends of the
+	// previous test are detected as well
+	while (gNewFrontDomId != gFrontDomId + 1)
+	{
+		REQUIRE(waitForFrontend());
+	}
+
+	REQUIRE(gNewFrontDevId == gFrontDevId);
+	REQUIRE(xenStored.getNumRequests() > 0);
+
+	// the rescan which is pending when the connection is lost is done
+	// synchronously
+	auto numRequests = xenStored.getNumRequests();
+
+	xenStored.setBatchSize(1000);
+
+	TestFrontendHandler::prepareXenStore(gDevName,
+										 gDomId, gFrontDomId + 1,
+										 gFrontDevId + 1);
+
+	for (int i = 0; i < 100 && xenStored.getNumRequests() == numRequests; i++)
+	{
+		std::this_thread::sleep_for(milliseconds(10));
+	}
+
+	REQUIRE(xenStored.getNumRequests() > numRequests);
+
+	xenStored.closeConnection();
+
+	while (gNewFrontDevId != gFrontDevId + 1)
+	{
+		REQUIRE(waitForFrontend());
+	}
+
+	REQUIRE(gNewFrontDomId == gFrontDomId + 1);
+
+	testBackend.stop();
+
+	string bePath = "/local/domain/" + to_string(gDomId) + "/backend/" +
+					gDevName + "/" + to_string(gFrontDomId + 1) + "/" +
+					to_string(gFrontDevId + 1);
+
+	XenStoreMock::deleteEntry(bePath + "/frontend");
+	XenStoreMock::deleteEntry(bePath + "/state");
+}
+
+TEST_CASE("WorkerPool", "[backendhandler]")
+{
+	WorkerPool pool(4);
+	vector<vector<int>> results(4);
+	std::atomic_int running(0);
+	std::atomic_int maxRunning(0);
+
+	REQUIRE(pool.getNumWorkers() == 4);
+
+	for (int i = 0; i < 100; i++)
+	{
+		uint32_t key = i % 4;
+
+		pool.call(key, [&, key, i]()
+		{
+			int current = ++running;
+			int max = maxRunning;
+
+			while (current > max &&
+				   !maxRunning.compare_exchange_weak(max, current));
+
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+			results[key].push_back(i);
+
+			running--;
+		});
+	}
+
+	pool.wait();
+
+	for (uint32_t key = 0; key < 4; key++)
+	{
+		REQUIRE(results[key].size() == 25);
+		REQUIRE(std::is_sorted(results[key].begin(), results[key].end()));
+	}
+
+	REQUIRE(maxRunning <= 4);
+	REQUIRE(maxRunning > 1);
+
+	pool.stop();
+
+	// no workers are left to call it
+	REQUIRE_THROWS_AS(pool.call(0, [] {}), XenBackend::Exception);
+
+	pool.wait();
+}
+
+TEST_CASE("CallQueue", "[backendhandler]")
+{
+	XenBackend::CallQueue queue;
+	vector<int> calls;
+
+	REQUIRE(queue.run() == 0);
+
+	std::thread thread([&queue, &calls]()
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			queue.post([&calls, i] { calls.push_back(i); });
+		}
+	});
+
+	thread.join();
+
+	pollfd fds = { queue.getFd(), POLLIN, 0 };
+
+	REQUIRE(poll(&fds, 1, 1000) == 1);
+	REQUIRE(queue.run() == 10);
+
+	REQUIRE(calls.size() == 10);
+	REQUIRE(std::is_sorted(calls.begin(), calls.end()));
+
+	// the file descriptor is cleared by run()
+	REQUIRE(poll(&fds, 1, 0) == 0);
+
+	// posted functions are dropped on stop
+	REQUIRE(queue.post([&calls] { calls.push_back(10); }));
+
+	queue.stop();
+
+	REQUIRE_FALSE(queue.post([&calls] { calls.push_back(11); }));
+
+	queue.run();
+
+	REQUIRE(calls.size() == 10);
+
+	queue.start();
+
+	REQUIRE(queue.post([&calls] { calls.push_back(12); }));
+	REQUIRE(queue.run() == 1);
+	REQUIRE(calls.back() == 12);
+}
+
 int main( int argc, char* argv[] )
 {
 	Log::setLogMask("*:Disable");
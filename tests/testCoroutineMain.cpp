@@ -0,0 +1,41 @@
+/*
+ *  Test runner for C++20 tests
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_COLOUR_NONE
+
+#include "catch.hpp"
+
+#include "Log.hpp"
+
+using XenBackend::Log;
+
+/*
+ * Runs the ring buffer tests built as C++20: the coroutine request handlers
+ * are compiled only there.
+ */
+int main( int argc, char* argv[] )
+{
+	Log::setLogMask("*:Disable");
+
+	int result = Catch::Session().run( argc, argv );
+
+	return ( result < 0xff ? result : 0xff );
+}
@@ -0,0 +1,181 @@
+/*
+ *  Test Delegate
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <array>
+#include <memory>
+#include <string>
+
+#include "catch.hpp"
+
+#include "Delegate.hpp"
+
+using std::bind;
+using std::function;
+using std::string;
+
+using XenBackend::Delegate;
+
+static int gValue = 0;
+
+static void setValue(int value)
+{
+	gValue = value;
+}
+
+class Receiver
+{
+public:
+
+	Receiver() : mValue(0) {}
+
+	void onValue(int value) { mValue = value; }
+
+	int mValue;
+};
+
+TEST_CASE("Delegate", "[delegate]")
+{
+	gValue = 0;
+
+	SECTION("Check empty")
+	{
+		Delegate<void(int)> delegate;
+		Delegate<void(int)> nullDelegate(nullptr);
+		void (*nullFunction)(int) = nullptr;
+
+		REQUIRE_FALSE(delegate);
+		REQUIRE(nullDelegate == nullptr);
+		REQUIRE(Delegate<void(int)>(nullFunction) == nullptr);
+		REQUIRE(Delegate<void(int)>(function<void(int)>()) == nullptr);
+		REQUIRE_THROWS_AS(delegate(1), std::bad_function_call);
+	}
+
+	SECTION("Check inline callables")
+	{
+		Receiver receiver;
+		int captured = 0;
+
+		Delegate<void(int)> pointer(setValue);
+		Delegate<void(int)> member(bind(&Receiver::onValue, &receiver,
+										std::placeholders::_1));
+		Delegate<void(int)> lambda([&captured](int value)
+								   { captured = value; });
+		Delegate<void(int)> stdFunction{function<void(int)>(setValue)};
+
+		REQUIRE(pointer.isInline());
+		REQUIRE(member.isInline());
+		REQUIRE(lambda.isInline());
+		REQUIRE(stdFunction.isInline());
+
+		pointer(1);
+		REQUIRE(gValue == 1);
+
+		member(2);
+		REQUIRE(receiver.mValue == 2);
+
+		lambda(3);
+		REQUIRE(captured == 3);
+
+		stdFunction(4);
+		REQUIRE(gValue == 4);
+	}
+
+	SECTION("Check big callable")
+	{
+		std::array<int, 16> values {};
+
+		Delegate<int(size_t)> delegate([values](size_t i)
+									   { return values[i] + 1; });
+
+		REQUIRE(delegate);
+		REQUIRE_FALSE(delegate.isInline());
+		REQUIRE(delegate(3) == 1);
+
+		auto copy = delegate;
+
+		REQUIRE(copy(5) == 1);
+	}
+
+	SECTION("Check copy and move")
+	{
+		auto counter = std::make_shared<int>(0);
+
+		Delegate<int()> delegate([counter] { return ++(*counter); });
+
+		REQUIRE(counter.use_count() == 2);
+
+		auto copy = delegate;
+
+		REQUIRE(counter.use_count() == 3);
+
+		auto moved = std::move(copy);
+
+		REQUIRE_FALSE(copy);
+		REQUIRE(counter.use_count() == 3);
+
+		REQUIRE(delegate() == 1);
+		REQUIRE(moved() == 2);
+
+		moved = nullptr;
+		delegate = moved;
+
+		REQUIRE_FALSE(delegate);
+		REQUIRE(counter.use_count() == 1);
+	}
+
+	SECTION("Check move-only callable")
+	{
+		std::unique_ptr<int> value(new int(5));
+
+		struct MoveOnly
+		{
+			explicit MoveOnly(std::unique_ptr<int> ptr) noexcept :
+				mPtr(std::move(ptr)) {}
+			MoveOnly(MoveOnly&& other) noexcept = default;
+
+			int operator()() { return mPtr ? *mPtr : 0; }
+
+			std::unique_ptr<int> mPtr;
+		};
+
+		Delegate<int()> delegate(MoveOnly(std::move(value)));
+
+		REQUIRE(delegate.isInline());
+		REQUIRE(delegate() == 5);
+
+		auto moved = std::move(delegate);
+
+		REQUIRE_FALSE(delegate);
+		REQUIRE(moved() == 5);
+		REQUIRE_THROWS_AS(Delegate<int()>(moved), std::logic_error);
+	}
+
+	SECTION("Check string argument")
+	{
+		string result;
+
+		Delegate<void(const string&)> delegate([&result](const string& str)
+											   { result = str; });
+
+		delegate("path");
+
+		REQUIRE(result == "path");
+	}
+}
@@ -0,0 +1,170 @@
+/*
+ *  Test host I/O queue
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "HostIo.hpp"
+
+using std::vector;
+
+using XenBackend::HostIoQueue;
+
+static void checkQueue(bool useUring)
+{
+	char path[] = "/tmp/testHostIoXXXXXX";
+	int fd = mkstemp(path);
+
+	REQUIRE(fd >= 0);
+
+	unlink(path);
+
+	HostIoQueue queue(4, useUring);
+
+	REQUIRE(queue.getFd() >= 0);
+	REQUIRE(queue.getNumPending() == 0);
+
+	vector<uint32_t> values(16);
+	vector<ssize_t> results(16, -1);
+
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		values[i] = i * 7;
+	}
+
+	SECTION("Write and read")
+	{
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			auto result = &results[i];
+
+			queue.write(fd, &values[i], sizeof(uint32_t), i * sizeof(uint32_t),
+						[result](ssize_t value) { *result = value; });
+		}
+
+		queue.wait();
+
+		REQUIRE(queue.getNumPending() == 0);
+
+		for (auto result : results)
+		{
+			REQUIRE(result == sizeof(uint32_t));
+		}
+
+		int fsyncResult = -1;
+
+		queue.fsync(fd, [&fsyncResult](ssize_t value) { fsyncResult = value; });
+		queue.wait();
+
+		REQUIRE(fsyncResult == 0);
+
+		vector<uint32_t> read(values.size());
+
+		for (size_t i = 0; i < read.size(); i++)
+		{
+			queue.read(fd, &read[i], sizeof(uint32_t), i * sizeof(uint32_t),
+					   nullptr);
+		}
+
+		queue.wait();
+
+		REQUIRE(read == values);
+	}
+
+	SECTION("Poll completions")
+	{
+		ssize_t result = -1;
+
+		queue.write(fd, values.data(), sizeof(uint32_t), 0,
+					[&result](ssize_t value) { result = value; });
+
+		REQUIRE(queue.getNumPending() == 1);
+		REQUIRE(result == -1);
+
+		REQUIRE(queue.submit() == 1);
+
+		pollfd fds = { queue.getFd(), POLLIN, 0 };
+
+		while (queue.getNumPending())
+		{
+			REQUIRE(poll(&fds, 1, 1000) == 1);
+
+			queue.reap();
+		}
+
+		REQUIRE(result == sizeof(uint32_t));
+	}
+
+	SECTION("Queue from completion")
+	{
+		uint32_t value = 0;
+		ssize_t result = -1;
+
+		queue.write(fd, &values[3], sizeof(uint32_t), 0,
+					[&](ssize_t)
+					{
+						queue.read(fd, &value, sizeof(uint32_t), 0,
+								   [&result](ssize_t ret) { result = ret; });
+					});
+
+		queue.wait();
+
+		REQUIRE(result == sizeof(uint32_t));
+		REQUIRE(value == values[3]);
+	}
+
+	SECTION("Error")
+	{
+		ssize_t result = 0;
+
+		queue.read(-1, values.data(), sizeof(uint32_t), 0,
+				   [&result](ssize_t value) { result = value; });
+		queue.wait();
+
+		REQUIRE(result == -EBADF);
+	}
+
+	close(fd);
+}
+
+TEST_CASE("HostIoQueue", "[hostio]")
+{
+	SECTION("io_uring")
+	{
+		checkQueue(true);
+	}
+
+	SECTION("Synchronous")
+	{
+		checkQueue(false);
+
+		HostIoQueue queue(1, false);
+
+		REQUIRE_FALSE(queue.isUring());
+	}
+
+	REQUIRE_THROWS_AS(HostIoQueue(0), XenBackend::HostIoException);
+}
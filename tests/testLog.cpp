@@ -0,0 +1,377 @@
+/*
+ *  Test Log
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "BinaryLog.hpp"
+#include "Log.hpp"
+
+using std::string;
+using std::stringbuf;
+
+using XenBackend::BinaryLog;
+using XenBackend::BinaryLogException;
+using XenBackend::BinaryLogReader;
+using XenBackend::Log;
+using XenBackend::LogLevel;
+using XenBackend::LogWriter;
+
+static int gNumEvaluated = 0;
+
+static int evaluate()
+{
+	gNumEvaluated++;
+
+	return gNumEvaluated;
+}
+
+TEST_CASE("Log", "[log]")
+{
+	stringbuf buffer;
+	auto level = Log::getLogLevel();
+
+	Log::setStreamBuffer(&buffer);
+	Log::setLogLevel(LogLevel::logINFO);
+
+	gNumEvaluated = 0;
+
+	SECTION("Check disabled level")
+	{
+		LOG("TestLog", DEBUG) << "value: " << evaluate();
+		DLOG("TestLog", DEBUG) << "value: " << evaluate();
+
+		REQUIRE(gNumEvaluated == 0);
+		REQUIRE(buffer.str().empty());
+	}
+
+	SECTION("Check enabled level")
+	{
+		LOG("TestLog", INFO) << "value: " << evaluate();
+
+		REQUIRE(gNumEvaluated == 1);
+		REQUIRE(buffer.str().find("| TestLog") != string::npos);
+		REQUIRE(buffer.str().find("| INF - value: 1") != string::npos);
+	}
+
+	SECTION("Check dangling else")
+	{
+		bool log = false;
+
+		if (log)
+			LOG("TestLog", INFO) << "value: " << evaluate();
+		else
+			evaluate();
+
+		REQUIRE(gNumEvaluated == 1);
+		REQUIRE(buffer.str().empty());
+	}
+
+	SECTION("Check every n")
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			LOG_EVERY_N("TestLog", INFO, 4) << "line: " << evaluate();
+		}
+
+		auto str = buffer.str();
+
+		REQUIRE(gNumEvaluated == 3);
+		REQUIRE(std::count(str.begin(), str.end(), '\n') == 3);
+		REQUIRE(str.find("| INF - line: 1\n") != string::npos);
+		REQUIRE(str.find("| INF - (3 suppressed) line: 2\n") != string::npos);
+		REQUIRE(str.find("| INF - (3 suppressed) line: 3\n") != string::npos);
+	}
+
+	SECTION("Check rate limit")
+	{
+		auto logLine = []()
+		{
+			LOG_RATELIMIT("TestLog", INFO, 100) << "line: " << evaluate();
+		};
+
+		for (int i = 0; i < 10; i++)
+		{
+			logLine();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+		logLine();
+		LOG_RATELIMIT("TestLog", DEBUG, 100) << "line: " << evaluate();
+
+		auto str = buffer.str();
+
+		REQUIRE(gNumEvaluated == 2);
+		REQUIRE(str.find("| INF - line: 1\n") != string::npos);
+		REQUIRE(str.find("| INF - (9 suppressed) line: 2\n") != string::npos);
+	}
+
+	SECTION("Check limited dangling else")
+	{
+		bool log = false;
+
+		if (log)
+			LOG_EVERY_N("TestLog", INFO, 1) << "value: " << evaluate();
+		else
+			evaluate();
+
+		REQUIRE(gNumEvaluated == 1);
+		REQUIRE(buffer.str().empty());
+	}
+
+	SECTION("Check async writer")
+	{
+		LogWriter::start();
+
+		REQUIRE(LogWriter::isStarted());
+
+		auto logLines = []()
+		{
+			for (int i = 0; i < 100; i++)
+			{
+				LOG("TestLog", INFO) << "line: " << i;
+			}
+		};
+
+		std::thread thread(logLines);
+
+		logLines();
+
+		thread.join();
+
+		LogWriter::stop();
+
+		auto str = buffer.str();
+
+		REQUIRE(std::count(str.begin(), str.end(), '\n') == 200);
+		REQUIRE(str.find("| INF - line: 99\n") != string::npos);
+	}
+
+	SECTION("Check async writer overflow")
+	{
+		auto numDropped = LogWriter::getNumDropped();
+
+		LogWriter::start(64);
+
+		LOG("TestLog", INFO) << string(64, 'x');
+		LOG("TestLog", INFO) << "short";
+
+		LogWriter::stop();
+
+		REQUIRE(LogWriter::getNumDropped() == numDropped + 1);
+		REQUIRE(buffer.str().find("xxx") == string::npos);
+		REQUIRE(buffer.str().find("| INF - short\n") != string::npos);
+	}
+
+	Log::setLogLevel(level);
+	Log::setStreamBuffer(std::cout.rdbuf());
+}
+
+TEST_CASE("BinaryLog", "[log]")
+{
+	stringbuf buffer;
+	auto level = Log::getLogLevel();
+	auto binaryLevel = BinaryLog::getLogLevel();
+	string path = "/tmp/testBinaryLog.blog";
+
+	Log::setStreamBuffer(&buffer);
+	Log::setLogLevel(LogLevel::logINFO);
+
+	gNumEvaluated = 0;
+
+	SECTION("Check text fallback")
+	{
+		REQUIRE_FALSE(BinaryLog::isOpened());
+
+		BLOG("TestLog", INFO, "int: {}, str: {}, bool: {}", -5, "abc", true);
+		BLOG("TestLog", DEBUG, "value: {}", evaluate());
+
+		REQUIRE(gNumEvaluated == 0);
+		REQUIRE(buffer.str().find("| INF - int: -5, str: abc, bool: 1\n") !=
+				string::npos);
+	}
+
+	SECTION("Check write and read")
+	{
+		// the binary log level doesn't depend on the text log level
+		Log::setLogLevel(LogLevel::logDISABLE);
+		BinaryLog::setLogLevel(LogLevel::logINFO);
+
+		BinaryLog::open(path, 4096);
+
+		REQUIRE(BinaryLog::isOpened());
+		REQUIRE_THROWS_AS(BinaryLog::open(path), BinaryLogException);
+
+		for (int i = 0; i < 3; i++)
+		{
+			BLOG("TestBinaryLog", INFO, "i: {}, u: {}, d: {}, s: {}, c: {}", i, 7u, 0.5,
+				 string("str"), 'x');
+		}
+
+		BLOG(nullptr, WARNING, "no args");
+		BLOG("TestBinaryLog", DEBUG, "value: {}", evaluate());
+
+		BinaryLog::close();
+
+		REQUIRE_FALSE(BinaryLog::isOpened());
+		REQUIRE(gNumEvaluated == 0);
+		REQUIRE(buffer.str().empty());
+
+		BinaryLogReader reader(path);
+		string line;
+
+		for (int i = 0; i < 3; i++)
+		{
+			REQUIRE(reader.readLine(line));
+			REQUIRE(line.find(" | TestBinaryLog | INF - i: " +
+							  std::to_string(i) +
+							  ", u: 7, d: 0.5, s: str, c: x") != string::npos);
+		}
+
+		REQUIRE(reader.readLine(line));
+		REQUIRE(line.find("testLog.cpp") != string::npos);
+		REQUIRE(line.find("| WRN - no args") != string::npos);
+
+		REQUIRE_FALSE(reader.readLine(line));
+	}
+
+	SECTION("Check binary log level")
+	{
+		BinaryLog::open(path, 4096);
+
+		BLOG("TestBinaryLog", DEBUG, "value: {}", evaluate());
+
+		BinaryLog::setLogLevel(LogLevel::logDISABLE);
+
+		BLOG("TestBinaryLog", ERROR, "value: {}", evaluate());
+
+		BinaryLog::close();
+
+		REQUIRE(gNumEvaluated == 1);
+
+		BinaryLogReader reader(path);
+		string line;
+
+		REQUIRE(reader.readLine(line));
+		REQUIRE(line.find("| DBG - value: ") != string::npos);
+		REQUIRE_FALSE(reader.readLine(line));
+	}
+
+	SECTION("Check not committed record")
+	{
+		BinaryLog::open(path, 4096);
+
+		for (int i = 0; i < 3; i++)
+		{
+			BLOG("TestLog", INFO, "line: {}", i);
+		}
+
+		BinaryLog::close();
+
+		// clear the type of the first event: skip the file header and the
+		// format records
+		std::fstream file(path, std::ios::in | std::ios::out |
+							   std::ios::binary);
+		uint32_t header[2] = { 1, 0 };
+		std::streamoff offset = 16;
+
+		for (; header[0] == 1; offset += header[1])
+		{
+			file.seekg(offset);
+			file.read(reinterpret_cast<char*>(header), sizeof(header));
+
+			REQUIRE(file);
+		}
+
+		header[0] = 0;
+
+		file.seekp(offset - header[1]);
+		file.write(reinterpret_cast<char*>(header), sizeof(uint32_t));
+		file.close();
+
+		BinaryLogReader reader(path);
+		string line;
+
+		for (int i = 1; i < 3; i++)
+		{
+			REQUIRE(reader.readLine(line));
+			REQUIRE(line.find("| INF - line: " + std::to_string(i)) !=
+					string::npos);
+		}
+
+		REQUIRE_FALSE(reader.readLine(line));
+	}
+
+	SECTION("Check reopen and overflow")
+	{
+		auto writeLine = [](int i) { BLOG("TestLog", INFO, "line: {}", i); };
+
+		// the call site is registered in the first file
+		BinaryLog::open(path, 4096);
+		writeLine(0);
+		BinaryLog::close();
+
+		BinaryLog::open(path, 512);
+
+		for (int i = 1; i <= 100; i++)
+		{
+			writeLine(i);
+		}
+
+		BinaryLog::close();
+
+		REQUIRE(BinaryLog::getNumDropped() > 0);
+
+		BinaryLogReader reader(path);
+		string line;
+		int numLines = 0;
+
+		while (reader.readLine(line))
+		{
+			numLines++;
+
+			REQUIRE(line.find("| INF - line: " + std::to_string(numLines)) !=
+					string::npos);
+		}
+
+		REQUIRE(numLines > 0);
+		REQUIRE(numLines < 100);
+	}
+
+	SECTION("Check invalid file")
+	{
+		REQUIRE_THROWS_AS(BinaryLogReader("/tmp/testBinaryLog.none"),
+						  BinaryLogException);
+	}
+
+	unlink(path.c_str());
+
+	BinaryLog::setLogLevel(binaryLevel);
+	Log::setLogLevel(level);
+	Log::setStreamBuffer(std::cout.rdbuf());
+}
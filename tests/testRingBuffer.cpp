@@ -20,10 +20,14 @@
 
 #include "testRingBuffer.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <cstdlib>
 #include <mutex>
 
+#include <unistd.h>
+
 #include "catch.hpp"
 
 #include "mocks/XenEvtchnMock.hpp"
@@ -188,6 +192,85 @@ void TestRingBufferIn::processRequest(const xentest_req& req)
 	sendResponse(rsp);
 }
 
+void TestStaticRingBufferIn::processRequest(const xentest_req& req)
+{
+	xentest_rsp rsp { req.id };
+
+	rsp.seq = req.seq;
+	rsp.status = 0;
+	rsp.u32data = calculateCommand(req);
+
+	mNumRequests++;
+
+	sendResponse(rsp);
+}
+
+void TestHostIoRingBufferIn::processRequest(const xentest_req& req)
+{
+	auto seq = req.seq;
+	auto value = &mValues[seq % 64];
+
+	// reads the value at the index requested by the command
+	mIo.read(mFd, value, sizeof(*value),
+			 req.op.command2.u64data1 * sizeof(*value),
+			 [this, seq, value](ssize_t result)
+	{
+		xentest_rsp rsp {};
+
+		rsp.seq = seq;
+		rsp.status = result == sizeof(*value) ? 0 : -result;
+		rsp.u32data = *value;
+
+		sendResponse(rsp);
+	});
+}
+
+void TestAsyncRingBufferIn::processAsyncRequest(Request& request)
+{
+	auto req = &request;
+
+	mMaxPending = std::max(mMaxPending, getNumPending());
+
+	// the command is calculated in the other thread
+	mWorker.call([this, req]()
+	{
+		req->getContext().value = calculateCommand(req->get());
+
+		post([this, req]()
+		{
+			xentest_rsp rsp {};
+
+			rsp.seq = req->get().seq;
+			rsp.u32data = req->getContext().value;
+
+			complete(*req, rsp);
+		});
+	});
+}
+
+#ifdef XENBE_HAS_COROUTINES
+
+XenBackend::RequestTask TestCoroutineRingBufferIn::handle(Request& request)
+{
+	auto req = request.get();
+
+	// the command is calculated in the other thread
+	auto [value] = co_await XenBackend::awaitCallback<uint32_t>(*this,
+		[this, req](std::function<void(uint32_t)> done)
+		{
+			mWorker.call([req, done] { done(calculateCommand(req)); });
+		});
+
+	xentest_rsp rsp {};
+
+	rsp.seq = req.seq;
+	rsp.u32data = value;
+
+	complete(request, rsp);
+}
+
+#endif
+
 void errorCallback(const std::exception& e)
 {
 	gError = true;
@@ -271,6 +354,288 @@ TEST_CASE("RingBufferIn", "[ringbuffer]")
 	}
 }
 
+TEST_CASE("StaticRingBufferIn", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestStaticRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	for(int i = 0; i < 100; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i * 3;
+
+		sendReq(req, ring);
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+
+		REQUIRE(rsp.seq == req.seq);
+		REQUIRE(rsp.u32data == calculateCommand(req));
+	}
+
+	REQUIRE(ringBuffer.getNumRequests() == 100);
+	REQUIRE_FALSE(gError);
+}
+
+static void checkHostIoRingBuffer(bool useUring)
+{
+	char path[] = "/tmp/testHostIoRingXXXXXX";
+	int fd = mkstemp(path);
+
+	REQUIRE(fd >= 0);
+
+	unlink(path);
+
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t value = i * 5;
+
+		REQUIRE(pwrite(fd, &value, sizeof(value), i * sizeof(value)) ==
+				sizeof(value));
+	}
+
+	TestHostIoRingBufferIn ringBuffer(gDomId, gPort, gRef, fd, useUring);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+	uint32_t seq = 0;
+
+	// batches are bigger than the I/O queue depth
+	for (int batch = 0; batch < 10; batch++)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			req.seq = seq++;
+			req.op.command2.u64data1 = (req.seq * 3) % 256;
+
+			sendReq(req, ring);
+		}
+
+		for (int i = 0; i < 100 && ring.sring->rsp_prod != ring.req_prod_pvt;
+			 i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(ring.sring->rsp_prod == ring.req_prod_pvt);
+
+		xen_rmb();
+
+		for (auto i = ring.rsp_cons; i != ring.sring->rsp_prod; i++)
+		{
+			auto rsp = RING_GET_RESPONSE(&ring, i);
+
+			REQUIRE(rsp->status == 0);
+			REQUIRE(rsp->u32data == ((rsp->seq * 3) % 256) * 5);
+		}
+
+		ring.rsp_cons = ring.sring->rsp_prod;
+	}
+
+	REQUIRE_FALSE(gError);
+
+	// stop waits for the I/O which may run
+	for (int i = 0; i < 16; i++)
+	{
+		req.seq = seq++;
+		req.op.command2.u64data1 = req.seq % 256;
+
+		sendReq(req, ring);
+	}
+
+	ringBuffer.stop();
+
+	REQUIRE(ringBuffer.getNumIoPending() == 0);
+
+	close(fd);
+}
+
+TEST_CASE("HostIoRingBufferIn", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	SECTION("io_uring")
+	{
+		checkHostIoRingBuffer(true);
+	}
+
+	SECTION("Synchronous")
+	{
+		checkHostIoRingBuffer(false);
+	}
+}
+
+TEST_CASE("AsyncRingBufferIn", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestAsyncRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+	uint32_t seq = 0;
+
+	// the whole ring is in flight: the batch is pushed with one notification
+	for (int batch = 0; batch < 10; batch++)
+	{
+		for (unsigned int i = 0; i < RING_SIZE(&ring); i++)
+		{
+			req.seq = seq++;
+			req.op.command2.u64data1 = req.seq * 3;
+
+			*RING_GET_REQUEST(&ring, ring.req_prod_pvt++) = req;
+		}
+
+		int notify;
+
+		RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+		if (notify)
+		{
+			XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+		}
+
+		for (int i = 0; i < 100 && ring.sring->rsp_prod != ring.req_prod_pvt;
+			 i++)
+		{
+			sleep_for(milliseconds(10));
+		}
+
+		REQUIRE(ring.sring->rsp_prod == ring.req_prod_pvt);
+
+		xen_rmb();
+
+		for (auto i = ring.rsp_cons; i != ring.sring->rsp_prod; i++)
+		{
+			auto rsp = RING_GET_RESPONSE(&ring, i);
+
+			REQUIRE(rsp->u32data == rsp->seq * 3);
+		}
+
+		ring.rsp_cons = ring.sring->rsp_prod;
+	}
+
+	REQUIRE(ringBuffer.getMaxPending() > 1);
+	REQUIRE(ringBuffer.getMaxPending() <= RING_SIZE(&ring));
+
+	// the requests in flight are cancelled
+	for (int i = 0; i < 4; i++)
+	{
+		req.seq = seq++;
+
+		sendReq(req, ring);
+	}
+
+	ringBuffer.stop();
+
+	REQUIRE(ringBuffer.getNumPending() == 0);
+	REQUIRE_FALSE(ringBuffer.post([] {}));
+	REQUIRE_FALSE(gError);
+}
+
+#ifdef XENBE_HAS_COROUTINES
+
+TEST_CASE("CoroutineRingBufferIn", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	// the coroutine is resumed without heap allocation
+	REQUIRE(XenBackend::Delegate<void()>(XenBackend::Coroutine::Resumer(
+			std::coroutine_handle<>())).isInline());
+
+	TestCoroutineRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.start();
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	for (uint32_t seq = 0; seq < 2 * RING_SIZE(&ring); seq++)
+	{
+		req.seq = seq;
+		req.op.command2.u64data1 = seq * 3;
+
+		sendReq(req, ring);
+
+		for (int i = 0; i < 100 && ring.sring->rsp_prod != ring.req_prod_pvt;
+			 i++)
+		{
+			sleep_for(milliseconds(1));
+		}
+
+		REQUIRE(ring.sring->rsp_prod == ring.req_prod_pvt);
+
+		xen_rmb();
+
+		auto rsp = RING_GET_RESPONSE(&ring, ring.rsp_cons++);
+
+		REQUIRE(rsp->seq == seq);
+		REQUIRE(rsp->u32data == seq * 3);
+	}
+
+	// the suspended coroutines are destroyed on stop
+	req.seq = 0;
+
+	sendReq(req, ring);
+
+	ringBuffer.stop();
+
+	REQUIRE(ringBuffer.getNumPending() == 0);
+	REQUIRE_FALSE(gError);
+}
+
+#endif
+
 TEST_CASE("RingBufferOut", "[ringbuffer]")
 {
 	XenEvtchnMock::setErrorMode(false);
@@ -334,3 +699,110 @@ TEST_CASE("RingBufferOut", "[ringbuffer]")
 		ringBuffer.stop();
 	}
 }
+
+TEST_CASE("RingBufferCache", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	XenBackend::RingBufferCache::setGracePeriod(milliseconds(50));
+
+	auto stats = XenBackend::RingBufferCache::getStats();
+	auto numMapBuffers = XenGnttabMock::checkMapBuffers();
+
+	void* buffer = nullptr;
+	evtchn_port_t port = 0;
+
+	{
+		TestRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+		buffer = XenGnttabMock::getLastBuffer();
+		port = XenEvtchnMock::getLastBoundPort();
+	}
+
+	REQUIRE(XenBackend::RingBufferCache::size() == 1);
+	REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+
+	SECTION("Check reuse")
+	{
+		TestRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+		REQUIRE(XenGnttabMock::getLastBuffer() == buffer);
+		REQUIRE(XenEvtchnMock::getLastBoundPort() == port);
+		REQUIRE(XenBackend::RingBufferCache::size() == 0);
+		REQUIRE(XenBackend::RingBufferCache::getStats().hits ==
+				stats.hits + 1);
+
+		// the reused event channel calls the new ring buffer
+		ringBuffer.start();
+
+		XenEvtchnMock::setNotifyCbk(port, respNotification);
+
+		xen_test_front_ring ring;
+		auto sring = static_cast<xen_test_sring*>(buffer);
+
+		SHARED_RING_INIT(sring);
+		FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+		xentest_req req {XENTEST_CMD2};
+		req.op.command2 = {64};
+		req.seq = 1;
+
+		sendReq(req, ring);
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+		REQUIRE(rsp.seq == req.seq);
+	}
+
+	SECTION("Check closed port")
+	{
+		XenEvtchnMock::closeRemotePort(port);
+
+		TestRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+		// the stale event channel is dropped and the port is bound again
+		REQUIRE(XenEvtchnMock::getLastBoundPort() != port);
+		REQUIRE(XenBackend::RingBufferCache::size() == 0);
+		REQUIRE(XenBackend::RingBufferCache::getStats().dropped ==
+				stats.dropped + 1);
+		REQUIRE(XenBackend::RingBufferCache::getStats().hits == stats.hits);
+	}
+
+	SECTION("Check other reference")
+	{
+		TestRingBufferIn ringBuffer(gDomId, gPort, gRef + 1);
+
+		REQUIRE(XenGnttabMock::getLastBuffer() != buffer);
+		REQUIRE(XenBackend::RingBufferCache::size() == 1);
+		REQUIRE(XenBackend::RingBufferCache::getStats().misses ==
+				stats.misses + 2);
+	}
+
+	SECTION("Check expiration")
+	{
+		sleep_for(milliseconds(200));
+
+		REQUIRE(XenBackend::RingBufferCache::size() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+		REQUIRE(XenBackend::RingBufferCache::getStats().expired >
+				stats.expired);
+	}
+
+	SECTION("Check clear domain")
+	{
+		XenBackend::RingBufferCache::clear(gDomId + 1);
+
+		REQUIRE(XenBackend::RingBufferCache::size() == 1);
+
+		XenBackend::RingBufferCache::clear(gDomId);
+
+		REQUIRE(XenBackend::RingBufferCache::size() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+	}
+
+	XenBackend::RingBufferCache::setGracePeriod(milliseconds(0));
+
+	REQUIRE(XenBackend::RingBufferCache::size() == 0);
+}
@@ -21,7 +21,9 @@
 #ifndef TESTS_TESTRINGBUFFER_HPP_
 #define TESTS_TESTRINGBUFFER_HPP_
 
+#include "HostIo.hpp"
 #include "RingBufferBase.hpp"
+#include "RingBufferCoroutine.hpp"
 
 extern "C" {
 #include "testProtocol.h"
@@ -45,6 +47,132 @@ private:
 	void processRequest(const xentest_req& req) override;
 };
 
+class TestStaticRingBufferIn : public XenBackend::StaticRingBufferInBase<
+									TestStaticRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>
+{
+public:
+
+	TestStaticRingBufferIn(domid_t domId, evtchn_port_t port,
+						   grant_ref_t ref) :
+		StaticRingBufferInBase(domId, port, ref), mNumRequests(0) {}
+
+	~TestStaticRingBufferIn() { stop(); }
+
+	int getNumRequests() const { return mNumRequests; }
+
+private:
+
+	friend class XenBackend::StaticRingBufferInBase<
+									TestStaticRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>;
+
+	int mNumRequests;
+
+	void processRequest(const xentest_req& req);
+};
+
+class TestHostIoRingBufferIn : public XenBackend::HostIoRingBufferInBase<
+									TestHostIoRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>
+{
+public:
+
+	TestHostIoRingBufferIn(domid_t domId, evtchn_port_t port,
+						   grant_ref_t ref, int fd, bool useUring) :
+		HostIoRingBufferInBase(domId, port, ref, XC_PAGE_SIZE, 4, useUring),
+		mFd(fd) {}
+
+	~TestHostIoRingBufferIn() { stop(); }
+
+	bool isUring() const { return mIo.isUring(); }
+	size_t getNumIoPending() const { return mIo.getNumPending(); }
+
+private:
+
+	friend class XenBackend::StaticRingBufferInBase<
+									TestHostIoRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>;
+
+	int mFd;
+	uint32_t mValues[64];
+
+	void processRequest(const xentest_req& req);
+};
+
+struct TestAsyncContext
+{
+	TestAsyncContext() : value(0) {}
+
+	uint32_t value;
+};
+
+class TestAsyncRingBufferIn : public XenBackend::AsyncRingBufferInBase<
+									TestAsyncRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp,
+									TestAsyncContext>
+{
+public:
+
+	TestAsyncRingBufferIn(domid_t domId, evtchn_port_t port,
+						  grant_ref_t ref) :
+		AsyncRingBufferInBase(domId, port, ref), mMaxPending(0) {}
+
+	~TestAsyncRingBufferIn() { stop(); mWorker.stop(); }
+
+	size_t getMaxPending() const { return mMaxPending; }
+
+private:
+
+	friend class XenBackend::AsyncRingBufferInBase<
+									TestAsyncRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp,
+									TestAsyncContext>;
+
+	XenBackend::AsyncContext mWorker;
+	size_t mMaxPending;
+
+	void processAsyncRequest(Request& request);
+};
+
+#ifdef XENBE_HAS_COROUTINES
+
+class TestCoroutineRingBufferIn : public XenBackend::AsyncRingBufferInBase<
+									TestCoroutineRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp,
+									TestAsyncContext>
+{
+public:
+
+	TestCoroutineRingBufferIn(domid_t domId, evtchn_port_t port,
+							  grant_ref_t ref) :
+		AsyncRingBufferInBase(domId, port, ref) {}
+
+	~TestCoroutineRingBufferIn() { stop(); mWorker.stop(); }
+
+private:
+
+	friend class XenBackend::AsyncRingBufferInBase<
+									TestCoroutineRingBufferIn,
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp,
+									TestAsyncContext>;
+
+	XenBackend::AsyncContext mWorker;
+
+	void processAsyncRequest(Request& request) { handle(request); }
+	XenBackend::RequestTask handle(Request& request);
+};
+
+#endif
+
 class TestRingBufferOut : public XenBackend::RingBufferOutBase<
 									xentest_event_page, xentest_evt>
 {
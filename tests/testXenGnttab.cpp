@@ -18,12 +18,25 @@
  * Copyright (C) 2016 EPAM Systems Inc.
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
 #include "catch.hpp"
 
 #include "mocks/XenGnttabMock.hpp"
 #include "XenGnttab.hpp"
 
+using XenBackend::XenGnttabBatch;
 using XenBackend::XenGnttabBuffer;
+using XenBackend::XenGnttabCache;
+using XenBackend::XenGnttabCopy;
+using XenBackend::XenGnttabDmaBufferPool;
+using XenBackend::XenGnttabSegment;
+using XenBackend::XenGnttabSgBuffer;
+using XenBackend::XenGnttabUnmapQueue;
 
 TEST_CASE("XenGnttab", "[xengnttab]")
 {
@@ -55,3 +68,467 @@ TEST_CASE("XenGnttab", "[xengnttab]")
 		REQUIRE_THROWS(XenGnttabBuffer(3, 14));
 	}
 }
+
+TEST_CASE("XenGnttabCache", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapBuffers = XenGnttabMock::checkMapBuffers();
+
+	XenGnttabCache cache(2);
+
+	SECTION("Check hit and miss")
+	{
+		auto buffer = cache.get(3, 14);
+
+		REQUIRE(buffer->size() ==
+				XenGnttabMock::getMapBufferSize(buffer->get()));
+		REQUIRE(cache.get(3, 14) == buffer);
+		REQUIRE(cache.get(4, 14) != buffer);
+
+		auto stats = cache.getStats();
+
+		REQUIRE(stats.hits == 1);
+		REQUIRE(stats.misses == 2);
+		REQUIRE(stats.evictions == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 2);
+	}
+
+	SECTION("Check eviction")
+	{
+		auto buffer = cache.get(3, 1);
+
+		cache.get(3, 2);
+		// 1 becomes most recently used
+		cache.get(3, 1);
+		// evicts 2
+		cache.get(3, 3);
+
+		REQUIRE(cache.size(3) == 2);
+		REQUIRE(cache.getStats().evictions == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 2);
+
+		REQUIRE(cache.get(3, 1) == buffer);
+
+		// evicts 3 and 1, 1 is still used
+		cache.get(3, 4);
+		cache.get(3, 5);
+
+		REQUIRE(cache.getStats().evictions == 3);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 3);
+
+		buffer.reset();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 2);
+	}
+
+	SECTION("Check remove")
+	{
+		cache.get(3, 1);
+		cache.get(3, 2);
+		cache.get(4, 1);
+
+		cache.remove(3, 1);
+
+		REQUIRE(cache.size(3) == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 2);
+
+		cache.clear(3);
+
+		REQUIRE(cache.size(3) == 0);
+		REQUIRE(cache.size(4) == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+	}
+
+	SECTION("Check read only")
+	{
+		XenGnttabCache readOnlyCache(2, PROT_READ);
+
+		auto buffer = readOnlyCache.get(3, 14);
+
+		REQUIRE(XenGnttabMock::getMapBufferProt(buffer->get()) == PROT_READ);
+		REQUIRE(XenGnttabMock::getMapBufferProt(cache.get(3, 14)->get()) ==
+				(PROT_READ | PROT_WRITE));
+	}
+
+	SECTION("Check errors")
+	{
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS(cache.get(3, 14));
+		REQUIRE(cache.size(3) == 0);
+
+		XenGnttabMock::setErrorMode(false);
+	}
+}
+
+TEST_CASE("XenGnttabBatch", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapBuffers = XenGnttabMock::checkMapBuffers();
+
+	XenGnttabBatch batch(3);
+
+	grant_ref_t refs[] = { 1, 2, 3 };
+
+	auto first = batch.add(refs, 3);
+	auto second = batch.add(4);
+
+	REQUIRE(batch.getNumRequests() == 2);
+	REQUIRE(batch.getNumPages() == 4);
+	REQUIRE_FALSE(batch.isMapped());
+
+	SECTION("Check map")
+	{
+		batch.map();
+
+		// all requests are mapped with one call
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+		REQUIRE(XenGnttabMock::getMapBufferSize(batch.get(first)) ==
+				4 * XC_PAGE_SIZE);
+
+		REQUIRE(batch.size(first) == 3 * XC_PAGE_SIZE);
+		REQUIRE(batch.size(second) == XC_PAGE_SIZE);
+		REQUIRE(static_cast<uint8_t*>(batch.get(second)) ==
+				static_cast<uint8_t*>(batch.get(first)) + 3 * XC_PAGE_SIZE);
+
+		REQUIRE_THROWS(batch.add(5));
+		REQUIRE_THROWS(batch.get(2));
+
+		batch.unmap();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+		REQUIRE(batch.getNumRequests() == 0);
+		REQUIRE_THROWS(batch.get(first));
+
+		// the batch can be reused
+		batch.add(5);
+		batch.map();
+
+		REQUIRE(batch.size(0) == XC_PAGE_SIZE);
+	}
+
+	SECTION("Check bad reference")
+	{
+		XenGnttabBatch badBatch(4);
+
+		XenGnttabMock::revokeGrantRef(4, 2);
+
+		auto bad = badBatch.add(refs, 3);
+		auto good = badBatch.add(4);
+
+		// the batch call fails: each request is mapped on its own
+		badBatch.map();
+
+		REQUIRE(badBatch.isMapped());
+		REQUIRE_FALSE(badBatch.isMapped(bad));
+		REQUIRE_THROWS_AS(badBatch.get(bad), XenBackend::XenGnttabException);
+		REQUIRE(badBatch.isMapped(good));
+		REQUIRE(XenGnttabMock::getMapBufferSize(badBatch.get(good)) ==
+				XC_PAGE_SIZE);
+
+		badBatch.unmap();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+	}
+
+	SECTION("Check errors")
+	{
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS(batch.map());
+		REQUIRE_FALSE(batch.isMapped());
+
+		XenGnttabMock::setErrorMode(false);
+	}
+}
+
+TEST_CASE("XenGnttabCopy", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	XenGnttabCopy copy(3);
+
+	char out[] = "from backend";
+	char in[sizeof("from frontend")] = {};
+
+	memcpy(XenGnttabMock::getGrantPage(3, 21) + 100, "from frontend", 14);
+
+	auto first = copy.copyFrom(21, 100, in, 14);
+	auto second = copy.copyTo(22, 200, out, sizeof(out));
+
+	REQUIRE(copy.getNumSegments() == 2);
+
+	SECTION("Check copy")
+	{
+		copy.copy();
+
+		REQUIRE(copy.isSucceeded());
+		REQUIRE(copy.getStatus(first) == GNTST_okay);
+		REQUIRE(copy.getStatus(second) == GNTST_okay);
+		REQUIRE(strcmp(in, "from frontend") == 0);
+		REQUIRE(memcmp(XenGnttabMock::getGrantPage(3, 22) + 200,
+					   out, sizeof(out)) == 0);
+	}
+
+	SECTION("Check segment status")
+	{
+		XenGnttabMock::revokeGrantRef(3, 23);
+
+		auto third = copy.copyFrom(23, 0, in, 1);
+
+		copy.copy();
+
+		REQUIRE_FALSE(copy.isSucceeded());
+		REQUIRE(copy.getStatus(first) == GNTST_okay);
+		REQUIRE(copy.getStatus(third) == GNTST_bad_gntref);
+	}
+
+	SECTION("Check errors")
+	{
+		REQUIRE_THROWS(copy.copyFrom(21, XC_PAGE_SIZE - 1, in, 2));
+		REQUIRE_THROWS(copy.getStatus(2));
+
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS(copy.copy());
+
+		XenGnttabMock::setErrorMode(false);
+	}
+
+	SECTION("Check threshold")
+	{
+		REQUIRE(XenGnttabCopy::isPreferred(XenGnttabCopy::cDefaultThreshold));
+		REQUIRE_FALSE(XenGnttabCopy::isPreferred(
+				XenGnttabCopy::cDefaultThreshold + 1));
+
+		XenGnttabCopy::setThreshold(0);
+
+		REQUIRE_FALSE(XenGnttabCopy::isPreferred(1));
+
+		XenGnttabCopy::setThreshold(XenGnttabCopy::cDefaultThreshold);
+	}
+}
+
+TEST_CASE("XenGnttabSgBuffer", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapBuffers = XenGnttabMock::checkMapBuffers();
+
+	SECTION("Check segments")
+	{
+		std::vector<XenGnttabSegment> segments = {
+			{ 1, 512, 512 },
+			// contiguous with the next one
+			{ 2, 1024, XC_PAGE_SIZE - 1024 },
+			{ 3, 0, 256 },
+			{ 4, 0, 128 }
+		};
+
+		XenGnttabSgBuffer buffer(3, segments);
+
+		// all pages are mapped with one call
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+
+		auto page = static_cast<uint8_t*>(XenGnttabMock::getLastBuffer());
+
+		REQUIRE(buffer.getIovCount() == 3);
+		REQUIRE(buffer.size() == 512 + XC_PAGE_SIZE - 1024 + 256 + 128);
+
+		REQUIRE(buffer.getIov()[0].iov_base == page + 512);
+		REQUIRE(buffer.getIov()[0].iov_len == 512);
+		REQUIRE(buffer.getIov()[1].iov_base == page + XC_PAGE_SIZE + 1024);
+		REQUIRE(buffer.getIov()[1].iov_len == XC_PAGE_SIZE - 1024 + 256);
+		REQUIRE(buffer.getIov()[2].iov_base == page + 3 * XC_PAGE_SIZE);
+		REQUIRE(buffer.getIov()[2].iov_len == 128);
+
+		size_t size = 0;
+
+		for (auto& iov : buffer)
+		{
+			size += iov.iov_len;
+		}
+
+		REQUIRE(size == buffer.size());
+		REQUIRE(XenGnttabMock::getMapBufferProt(page) ==
+				(PROT_READ | PROT_WRITE));
+	}
+
+	SECTION("Check read only")
+	{
+		XenGnttabSgBuffer buffer(3, {{ 1, 0, 100 }, { 2, 0, 200 }},
+								 PROT_READ);
+
+		REQUIRE(buffer.size() == 300);
+		REQUIRE(XenGnttabMock::getMapBufferProt(
+				XenGnttabMock::getLastBuffer()) == PROT_READ);
+	}
+
+	SECTION("Check errors")
+	{
+		REQUIRE_THROWS(XenGnttabSgBuffer(3, {}));
+		REQUIRE_THROWS(XenGnttabSgBuffer(3, {{ 1, 100, XC_PAGE_SIZE }}));
+
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS(XenGnttabSgBuffer(3, {{ 1, 0, 100 }}));
+
+		XenGnttabMock::setErrorMode(false);
+	}
+
+	REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+}
+
+TEST_CASE("XenGnttabUnmapQueue", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapBuffers = XenGnttabMock::checkMapBuffers();
+
+	SECTION("Check max delay")
+	{
+		XenGnttabUnmapQueue::enable(std::chrono::milliseconds(50), 1024);
+
+		{
+			XenGnttabBuffer buffer(3, 14);
+		}
+
+		REQUIRE(XenGnttabUnmapQueue::getNumPendingPages() == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		REQUIRE(XenGnttabUnmapQueue::getNumPendingPages() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+	}
+
+	SECTION("Check page budget")
+	{
+		XenGnttabUnmapQueue::enable(std::chrono::milliseconds(10000), 4);
+
+		grant_ref_t refs[] = { 1, 2, 3 };
+
+		{
+			XenGnttabBuffer first(3, refs, 3);
+			XenGnttabBuffer second(3, refs, 3);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		REQUIRE(XenGnttabUnmapQueue::getNumPendingPages() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+	}
+
+	SECTION("Check flush and disable")
+	{
+		XenGnttabUnmapQueue::enable(std::chrono::milliseconds(10000), 1024);
+
+		REQUIRE_THROWS(XenGnttabUnmapQueue::enable(
+				std::chrono::milliseconds(10000), 1024));
+
+		{
+			XenGnttabBuffer buffer(3, 14);
+		}
+
+		XenGnttabUnmapQueue::flush();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+
+		{
+			XenGnttabBuffer buffer(3, 14);
+		}
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers + 1);
+	}
+
+	XenGnttabUnmapQueue::disable();
+
+	REQUIRE_FALSE(XenGnttabUnmapQueue::isEnabled());
+	REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+
+	// unmapped synchronously when disabled
+	{
+		XenGnttabBuffer buffer(3, 14);
+	}
+
+	REQUIRE(XenGnttabMock::checkMapBuffers() == numMapBuffers);
+}
+
+TEST_CASE("XenGnttabDmaBufferPool", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numDmaBuffers = XenGnttabMock::getNumDmaBuffers();
+
+	XenBackend::GrantRefs refs = { 1, 2, 3 };
+
+	std::mutex mutex;
+	std::condition_variable condVar;
+	bool released = false;
+
+	{
+		XenGnttabDmaBufferPool pool;
+
+		auto exporter = pool.get(3, refs);
+
+		REQUIRE(exporter->getFd() >= 0);
+		REQUIRE(pool.get(3, refs) == exporter);
+		REQUIRE(pool.get(3, {1, 2}) != exporter);
+		REQUIRE(pool.get(4, refs) != exporter);
+
+		auto stats = pool.getStats();
+
+		REQUIRE(stats.hits == 1);
+		REQUIRE(stats.misses == 3);
+		REQUIRE(XenGnttabMock::getNumDmaBuffers() == numDmaBuffers + 3);
+
+		auto fd = exporter->getFd();
+
+		XenGnttabMock::holdDmaBufferRelease(true);
+
+		// released asynchronously
+		pool.remove(3, refs, 0, [&](int result)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			released = result == 0;
+
+			condVar.notify_all();
+		});
+
+		REQUIRE(exporter->getFd() == -1);
+		REQUIRE(pool.size() == 2);
+		REQUIRE_THROWS(pool.remove(3, refs));
+
+		// the number is reserved till the buffer is released
+		int newFd = -1;
+
+		CHECK_NOTHROW(newFd = pool.get(5, refs)->getFd());
+
+		XenGnttabMock::holdDmaBufferRelease(false);
+
+		REQUIRE(newFd >= 0);
+		REQUIRE(newFd != fd);
+		REQUIRE(pool.size() == 3);
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		REQUIRE(condVar.wait_for(lock, std::chrono::milliseconds(1000),
+								 [&] { return released; }));
+
+		pool.clear(3);
+
+		REQUIRE(pool.size() == 2);
+	}
+
+	// the pool releases the rest on deletion
+	for (int i = 0; i < 100 &&
+		 XenGnttabMock::getNumDmaBuffers() != numDmaBuffers; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	REQUIRE(XenGnttabMock::getNumDmaBuffers() == numDmaBuffers);
+}
@@ -18,19 +18,27 @@
  * Copyright (C) 2016 EPAM Systems Inc.
  */
 
+#include <algorithm>
+#include <thread>
+
 #include "catch.hpp"
 
 #include "mocks/XenCtrlMock.hpp"
 #include "XenStat.hpp"
 
+using std::chrono::hours;
+using std::chrono::milliseconds;
+using std::vector;
+
+using XenBackend::XenDomainSampler;
 using XenBackend::XenStat;
 
 TEST_CASE("XenStat", "[xenctrl]")
 {
-	XenStat xenStat;
-
 	XenCtrlMock::setErrorMode(false);
 
+	XenStat xenStat;
+
 	xc_domaininfo_t info = {};
 
 	domid_t domIds[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
@@ -72,6 +80,183 @@ TEST_CASE("XenStat", "[xenctrl]")
 
 		REQUIRE_THROWS(xenStat.getExistingDoms());
 	}
+
+	SECTION("Check refresh period")
+	{
+		xenStat.setRefreshPeriod(hours(1));
+
+		REQUIRE(xenStat.getExistingDoms().size() == 8);
+
+		auto numCalls = XenCtrlMock::getNumGetDomInfos();
+
+		info.domain = 9;
+		XenCtrlMock::addDomInfo(info);
+
+		REQUIRE(xenStat.getExistingDoms().size() == 8);
+		REQUIRE(xenStat.getRunningDoms().size() == 3);
+		REQUIRE(XenCtrlMock::getNumGetDomInfos() == numCalls);
+
+		xenStat.refresh();
+
+		REQUIRE(xenStat.getExistingDoms().size() == 9);
+		REQUIRE(XenCtrlMock::getNumGetDomInfos() > numCalls);
+
+		XenCtrlMock::removeDomInfo(9);
+	}
+
+	SECTION("Check domain changes")
+	{
+		auto generation = xenStat.getGeneration();
+
+		REQUIRE(generation > 0);
+		REQUIRE(xenStat.domainsAdded(0).size() == 8);
+		REQUIRE(xenStat.domainsRemoved(0).empty());
+		REQUIRE(xenStat.domainsAdded(generation).empty());
+
+		// no changes: generation is not incremented
+		REQUIRE(xenStat.getGeneration() == generation);
+
+		info.domain = 9;
+		XenCtrlMock::addDomInfo(info);
+		XenCtrlMock::removeDomInfo(2);
+
+		auto newGeneration = xenStat.getGeneration();
+
+		REQUIRE(newGeneration > generation);
+		REQUIRE(xenStat.domainsAdded(generation) == vector<domid_t>{9});
+		REQUIRE(xenStat.domainsRemoved(generation) == vector<domid_t>{2});
+		REQUIRE(xenStat.domainsAdded(newGeneration).empty());
+		REQUIRE(xenStat.domainsRemoved(newGeneration).empty());
+
+		// domain is created again with the same id
+		info.domain = 2;
+		info.flags = 0;
+		XenCtrlMock::addDomInfo(info);
+
+		xenStat.getGeneration();
+
+		REQUIRE(xenStat.domainsAdded(generation) == vector<domid_t>({2, 9}));
+		REQUIRE(xenStat.domainsRemoved(generation) == vector<domid_t>{2});
+		REQUIRE(xenStat.domainsRemoved(newGeneration).empty());
+
+		// domain is recreated between two refreshes: detected by the handle
+		newGeneration = xenStat.getGeneration();
+
+		info.domain = 3;
+		info.handle[0] = 1;
+		XenCtrlMock::addDomInfo(info);
+
+		REQUIRE(xenStat.getGeneration() > newGeneration);
+		REQUIRE(xenStat.domainsAdded(newGeneration) == vector<domid_t>{3});
+		REQUIRE(xenStat.domainsRemoved(newGeneration) == vector<domid_t>{3});
+
+		info.handle[0] = 0;
+		XenCtrlMock::addDomInfo(info);
+		XenCtrlMock::removeDomInfo(9);
+	}
+}
+
+TEST_CASE("XenDomainSampler", "[xenctrl]")
+{
+	XenCtrlMock::setErrorMode(false);
+
+	XenDomainSampler sampler(hours(1), 4);
+
+	xc_domaininfo_t info = {};
+
+	info.domain = 20;
+	info.nr_online_vcpus = 2;
+	info.tot_pages = 16;
+	info.max_pages = 32;
+	info.handle[0] = 1;
+
+	XenCtrlMock::addDomInfo(info);
+
+	XenDomainSampler::Sample sample;
+
+	REQUIRE_FALSE(sampler.getLatest(info.domain, sample));
+
+	SECTION("Check samples")
+	{
+		for (int i = 1; i <= 6; i++)
+		{
+			info.cpu_time = i * 1000000;
+			XenCtrlMock::addDomInfo(info);
+
+			sampler.sample();
+
+			std::this_thread::sleep_for(milliseconds(2));
+		}
+
+		auto domains = sampler.getDomains();
+
+		REQUIRE(std::find(domains.begin(), domains.end(), info.domain) !=
+				domains.end());
+
+		REQUIRE(sampler.getLatest(info.domain, sample));
+		REQUIRE(sample.cpuTime == 6000000);
+		REQUIRE(sample.cpuTimeDelta == 1000000);
+		REQUIRE(sample.cpuUsage > 0.0);
+		REQUIRE(sample.numVcpus == 2);
+		REQUIRE(sample.memory == 16 * XC_PAGE_SIZE);
+		REQUIRE(sample.maxMemory == 32 * XC_PAGE_SIZE);
+
+		auto samples = sampler.getSamples(info.domain);
+
+		REQUIRE(samples.size() == 4);
+
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			REQUIRE(samples[i].cpuTime == (i + 3) * 1000000);
+		}
+
+		REQUIRE(sampler.getAverageCpuUsage(info.domain) > 0.0);
+	}
+
+	SECTION("Check recreated domain")
+	{
+		info.cpu_time = 5000000;
+		XenCtrlMock::addDomInfo(info);
+
+		sampler.sample();
+
+		info.cpu_time = 1000;
+		info.handle[0] = 2;
+		XenCtrlMock::addDomInfo(info);
+
+		sampler.sample();
+
+		REQUIRE(sampler.getSamples(info.domain).size() == 1);
+		REQUIRE(sampler.getLatest(info.domain, sample));
+		REQUIRE(sample.cpuTimeDelta == 0);
+	}
+
+	SECTION("Check removed domain")
+	{
+		sampler.sample();
+
+		XenCtrlMock::removeDomInfo(info.domain);
+
+		sampler.sample();
+
+		REQUIRE_FALSE(sampler.getLatest(info.domain, sample));
+		REQUIRE(sampler.getSamples(info.domain).empty());
+	}
+
+	SECTION("Check periodic sampling")
+	{
+		XenDomainSampler periodic(milliseconds(10));
+
+		periodic.start();
+
+		std::this_thread::sleep_for(milliseconds(50));
+
+		periodic.stop();
+
+		REQUIRE(periodic.getSamples(info.domain).size() > 1);
+	}
+
+	XenCtrlMock::removeDomInfo(info.domain);
 }
 
 TEST_CASE("XenStatError", "[xenctrl]")
@@ -23,10 +23,16 @@
 #include <condition_variable>
 #include <mutex>
 
+extern "C" {
+#include <xen/io/xenbus.h>
+}
+
 #include "catch.hpp"
 
 #include "mocks/XenStoreMock.hpp"
+#include "PathTrie.hpp"
 #include "XenStore.hpp"
+#include "XenStoreSchema.hpp"
 
 using std::chrono::milliseconds;
 using std::condition_variable;
@@ -37,8 +43,12 @@ using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 
+using XenBackend::PathTrie;
 using XenBackend::XenStore;
 using XenBackend::XenStoreException;
+using XenBackend::XenStoreField;
+using XenBackend::XenStoreFieldError;
+using XenBackend::XenStoreSchema;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -77,6 +87,14 @@ static void waitForWatch()
 	gCondVar.wait_for(lock, milliseconds(100));
 }
 
+static bool waitForWatches(const vector<string>& paths, size_t count)
+{
+	unique_lock<mutex> lock(gMutex);
+
+	return gCondVar.wait_for(lock, milliseconds(1000),
+							 [&] { return paths.size() >= count; });
+}
+
 TEST_CASE("XenStore", "[xenstore]")
 {
 	XenStoreMock::setErrorMode(false);
@@ -211,6 +229,110 @@ TEST_CASE("XenStore", "[xenstore]")
 		xenStore.clearWatch(path);
 	}
 
+	SECTION("Check subtree watches")
+	{
+		string parent = "/local/domain/3/subtree";
+		string child = parent + "/child";
+		vector<string> parentPaths;
+		vector<string> childPaths;
+
+		auto childCbk = [&](const string& path)
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			childPaths.push_back(path);
+
+			gCondVar.notify_all();
+		};
+
+		xenStore.setWatch(parent, [&](const string& path)
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			// set the child watch from the watch thread, it should be
+			// served by the parent watch
+			if (parentPaths.empty())
+			{
+				xenStore.setWatch(child, childCbk);
+			}
+
+			parentPaths.push_back(path);
+
+			gCondVar.notify_all();
+		});
+
+		REQUIRE(waitForWatches(parentPaths, 1));
+		REQUIRE(waitForWatches(childPaths, 1));
+
+		REQUIRE(parentPaths[0] == parent);
+		REQUIRE(childPaths[0] == child);
+
+		XenStoreMock::writeValue(child + "/key", "Value");
+
+		REQUIRE(waitForWatches(parentPaths, 2));
+		REQUIRE(waitForWatches(childPaths, 2));
+
+		REQUIRE(parentPaths[1] == child + "/key");
+		REQUIRE(childPaths[1] == child + "/key");
+
+		XenStoreMock::writeValue(parent + "Sibling", "Value");
+		XenStoreMock::writeValue(parent + "/key", "Value");
+
+		REQUIRE(waitForWatches(parentPaths, 3));
+
+		waitForWatch();
+
+		REQUIRE(parentPaths.size() == 3);
+		REQUIRE(parentPaths[2] == parent + "/key");
+		REQUIRE(childPaths.size() == 2);
+
+		xenStore.clearWatch(parent);
+
+		XenStoreMock::writeValue(child + "/key", "Changed");
+
+		// the child watch is registered in Xen store after the parent one is
+		// cleared: it gets the initial event and the change event
+		REQUIRE(waitForWatches(childPaths, 4));
+		REQUIRE(childPaths.back() == child + "/key");
+
+		xenStore.clearWatch(child);
+	}
+
+	SECTION("Check coalesced watches")
+	{
+		string path = "/local/domain/3/coalesced";
+		vector<vector<string>> calls;
+
+		xenStore.setCoalescedWatch(path, [&](const vector<string>& paths)
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			calls.push_back(paths);
+
+			gCondVar.notify_all();
+		}, milliseconds(200));
+
+		for (int i = 0; i < 10; i++)
+		{
+			XenStoreMock::writeValue(path + "/key" + std::to_string(i), "1");
+		}
+
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			REQUIRE(gCondVar.wait_for(lock, milliseconds(1000),
+									  [&] { return calls.size() > 0; }));
+		}
+
+		// the initial notification and all writes are merged
+		REQUIRE(calls.size() == 1);
+		REQUIRE(calls[0].size() == 11);
+		REQUIRE(calls[0].front() == path);
+		REQUIRE(std::is_sorted(calls[0].begin(), calls[0].end()));
+
+		xenStore.clearWatch(path);
+	}
+
 	SECTION("Check watches error")
 	{
 		XenStoreMock::setErrorMode(true);
@@ -233,3 +355,203 @@ TEST_CASE("XenStoreError", "[xenstore]")
 
 	REQUIRE_THROWS(XenStore(errorHandling));
 }
+
+TEST_CASE("PathTrie", "[xenstore]")
+{
+	PathTrie<int> trie;
+
+	trie.insert("/local/domain/1", 1);
+	trie.insert("/local/domain/1/device/vif", 2);
+	trie.insert("/local/domain/12", 3);
+	trie.insert("/local/domain/1/device", 4);
+
+	REQUIRE(trie.size() == 4);
+
+	SECTION("Check find")
+	{
+		REQUIRE(*trie.find("/local/domain/1") == 1);
+		REQUIRE(*trie.find("/local/domain/1/device/vif") == 2);
+		REQUIRE(*trie.find("/local/domain/12") == 3);
+		REQUIRE(*trie.find("/local/domain/1/device") == 4);
+		REQUIRE(trie.find("/local/domain") == nullptr);
+		REQUIRE(trie.find("/local/domain/1/dev") == nullptr);
+
+		trie.insert("/local/domain/1", 5);
+
+		REQUIRE(trie.size() == 4);
+		REQUIRE(*trie.find("/local/domain/1") == 5);
+	}
+
+	SECTION("Check prefixes")
+	{
+		vector<int> values;
+
+		trie.forEachPrefix("/local/domain/1/device/vif/0",
+						   [&values](const string& key, int& value)
+						   { values.push_back(value); });
+
+		REQUIRE(values == vector<int>({1, 4, 2}));
+
+		values.clear();
+
+		trie.forEachPrefix("/local/domain/123",
+						   [&values](const string& key, int& value)
+						   { values.push_back(value); });
+
+		REQUIRE(values.empty());
+
+		string key;
+
+		REQUIRE(*trie.findLongestPrefix("/local/domain/12/device", key) == 3);
+		REQUIRE(key == "/local/domain/12");
+		REQUIRE(trie.findLongestPrefix("/local/dom", key) == nullptr);
+	}
+
+	SECTION("Check subtree")
+	{
+		vector<string> keys;
+
+		trie.forEachInSubtree("/local/domain/1",
+							  [&keys](const string& key, int& value)
+							  { keys.push_back(key); });
+
+		REQUIRE(keys == vector<string>({"/local/domain/1",
+										"/local/domain/1/device",
+										"/local/domain/1/device/vif"}));
+
+		keys.clear();
+
+		trie.forEachInSubtree("/local/domain/1/dev",
+							  [&keys](const string& key, int& value)
+							  { keys.push_back(key); });
+
+		REQUIRE(keys.empty());
+
+		keys.clear();
+
+		trie.forEachInSubtree("", [&keys](const string& key, int& value)
+							  { keys.push_back(key); });
+
+		REQUIRE(keys.size() == 4);
+	}
+
+	SECTION("Check erase")
+	{
+		REQUIRE(trie.erase("/local/domain/1/device"));
+		REQUIRE_FALSE(trie.erase("/local/domain/1/device"));
+		REQUIRE_FALSE(trie.erase("/local/domain"));
+
+		REQUIRE(trie.size() == 3);
+		REQUIRE(trie.find("/local/domain/1/device") == nullptr);
+		REQUIRE(*trie.find("/local/domain/1/device/vif") == 2);
+
+		REQUIRE(trie.erase("/local/domain/1"));
+
+		REQUIRE(*trie.find("/local/domain/1/device/vif") == 2);
+		REQUIRE(*trie.find("/local/domain/12") == 3);
+
+		trie.clear();
+
+		REQUIRE(trie.empty());
+		REQUIRE(trie.find("/local/domain/12") == nullptr);
+	}
+}
+
+struct SchemaConfig
+{
+	int port;
+	unsigned int ref;
+	uint8_t queues;
+	bool feature;
+	std::string protocol;
+	xenbus_state state;
+};
+
+static const XenStoreField<SchemaConfig> cSchemaFields[] = {
+	XENSTORE_FIELD(SchemaConfig, port, "event-channel"),
+	XENSTORE_FIELD(SchemaConfig, ref, "ring-ref"),
+	XENSTORE_FIELD(SchemaConfig, queues, "multi-queue-num-queues"),
+	XENSTORE_OPTIONAL_FIELD(SchemaConfig, feature, "feature-persistent"),
+	XENSTORE_OPTIONAL_FIELD(SchemaConfig, protocol, "protocol"),
+	XENSTORE_FIELD(SchemaConfig, state, "state")
+};
+
+TEST_CASE("XenStoreSchema", "[xenstore]")
+{
+	XenStoreMock::setErrorMode(false);
+
+	XenStore xenStore;
+	XenStoreSchema<SchemaConfig> schema(cSchemaFields);
+	string path = "/local/domain/4/device/schema/0";
+
+	REQUIRE(schema.size() == 6);
+
+	xenStore.writeString(path + "/event-channel", "-12");
+	xenStore.writeString(path + "/ring-ref", "32");
+	xenStore.writeString(path + "/multi-queue-num-queues", "4");
+	xenStore.writeString(path + "/state", "4");
+
+	SECTION("Check read")
+	{
+		SchemaConfig config = {};
+
+		config.protocol = "default";
+
+		schema.read(xenStore, path, config);
+
+		REQUIRE(config.port == -12);
+		REQUIRE(config.ref == 32);
+		REQUIRE(config.queues == 4);
+		REQUIRE_FALSE(config.feature);
+		REQUIRE(config.protocol == "default");
+		REQUIRE(config.state == XenbusStateConnected);
+	}
+
+	SECTION("Check decimal values")
+	{
+		unsigned int ref = 0;
+		int port = 0;
+
+		// Xen store integers are decimal: no hex or octal prefixes
+		REQUIRE(XenBackend::parseXenStoreValue("0x20", ref) == EINVAL);
+		REQUIRE(XenBackend::parseXenStoreValue("-0x20", port) == EINVAL);
+		REQUIRE(XenBackend::parseXenStoreValue("010", ref) == 0);
+		REQUIRE(ref == 10);
+		REQUIRE(XenBackend::parseXenStoreValue("-010", port) == 0);
+		REQUIRE(port == -10);
+	}
+
+	SECTION("Check field errors")
+	{
+		SchemaConfig config = {};
+
+		xenStore.writeString(path + "/ring-ref", "-1");
+		xenStore.writeString(path + "/multi-queue-num-queues", "256");
+		xenStore.writeString(path + "/feature-persistent", "yes");
+		xenStore.removePath(path + "/state");
+
+		try
+		{
+			schema.read(xenStore, path, config);
+
+			FAIL("XenStoreException is expected");
+		}
+		catch(const XenStoreException& e)
+		{
+			string message = e.what();
+
+			// all failed fields are reported, the first error is errno
+			REQUIRE(e.getErrno() == ERANGE);
+			REQUIRE(message.find("ring-ref") != string::npos);
+			REQUIRE(message.find("multi-queue-num-queues") != string::npos);
+			REQUIRE(message.find("feature-persistent") != string::npos);
+			REQUIRE(message.find("state") != string::npos);
+		}
+
+		// valid fields are filled anyway
+		REQUIRE(config.port == -12);
+
+		xenStore.writeString(path + "/state", "4");
+		xenStore.removePath(path + "/feature-persistent");
+	}
+}
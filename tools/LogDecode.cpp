@@ -0,0 +1,60 @@
+/*
+ *  Binary log decoder
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <iostream>
+
+#include "BinaryLog.hpp"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::exception;
+using std::string;
+
+using XenBackend::BinaryLogReader;
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		cerr << "Usage: " << argv[0] << " <binary log file>" << endl;
+
+		return 1;
+	}
+
+	try
+	{
+		BinaryLogReader reader(argv[1]);
+		string line;
+
+		while (reader.readLine(line))
+		{
+			cout << line << "\n";
+		}
+	}
+	catch(const exception& e)
+	{
+		cerr << e.what() << endl;
+
+		return 1;
+	}
+
+	return 0;
+}